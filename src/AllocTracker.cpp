@@ -0,0 +1,162 @@
+#include "AllocTracker.h"
+
+#include <Eigen/Core>
+
+#include <atomic>
+#include <new>
+#include <cstdlib>
+#include <cstdio>
+
+namespace AllocTracker
+{
+
+static const char *subsystemNames[ALLOC_SUBSYSTEM_COUNT] = {
+    "other", "render", "input", "scene", "loading"
+};
+
+class AtomicCounters
+{
+public:
+    std::atomic<size_t> allocations;
+    std::atomic<size_t> bytes;
+    std::atomic<size_t> eigenAllocations;
+
+    Counters load() const
+    {
+        Counters counters;
+        counters.allocations = allocations.load(std::memory_order_relaxed);
+        counters.bytes = bytes.load(std::memory_order_relaxed);
+        counters.eigenAllocations = eigenAllocations.load(std::memory_order_relaxed);
+        return counters;
+    }
+
+    void reset()
+    {
+        allocations.store(0, std::memory_order_relaxed);
+        bytes.store(0, std::memory_order_relaxed);
+        eigenAllocations.store(0, std::memory_order_relaxed);
+    }
+};
+
+// Zero initialized before any dynamic initialization, so that allocations
+// made by static constructors are safe to count
+static AtomicCounters frameCounters[ALLOC_SUBSYSTEM_COUNT];
+static AtomicCounters totalCounters[ALLOC_SUBSYSTEM_COUNT];
+static thread_local AllocSubsystem subsystem = ALLOC_OTHER;
+
+// Make every Eigen heap allocation go through the failed malloc check
+static struct EigenMallocHook
+{
+    EigenMallocHook() { Eigen::internal::set_is_malloc_allowed(false); }
+} eigenMallocHook;
+
+void beginFrame()
+{
+    for (int i = 0; i < ALLOC_SUBSYSTEM_COUNT; i++)
+        frameCounters[i].reset();
+}
+
+Counters frame(AllocSubsystem subsystem)
+{
+    return frameCounters[subsystem].load();
+}
+
+Counters frame()
+{
+    Counters sum;
+    for (int i = 0; i < ALLOC_SUBSYSTEM_COUNT; i++)
+    {
+        Counters counters = frameCounters[i].load();
+        sum.allocations += counters.allocations;
+        sum.bytes += counters.bytes;
+        sum.eigenAllocations += counters.eigenAllocations;
+    }
+    return sum;
+}
+
+Counters total(AllocSubsystem subsystem)
+{
+    return totalCounters[subsystem].load();
+}
+
+const char *name(AllocSubsystem subsystem)
+{
+    return subsystemNames[subsystem];
+}
+
+AllocSubsystem currentSubsystem()
+{
+    return subsystem;
+}
+
+void setSubsystem(AllocSubsystem current)
+{
+    subsystem = current;
+}
+
+void recordAllocation(size_t bytes)
+{
+    frameCounters[subsystem].allocations.fetch_add(1, std::memory_order_relaxed);
+    frameCounters[subsystem].bytes.fetch_add(bytes, std::memory_order_relaxed);
+    totalCounters[subsystem].allocations.fetch_add(1, std::memory_order_relaxed);
+    totalCounters[subsystem].bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void recordEigenAllocation()
+{
+    frameCounters[subsystem].eigenAllocations.fetch_add(1, std::memory_order_relaxed);
+    totalCounters[subsystem].eigenAllocations.fetch_add(1, std::memory_order_relaxed);
+}
+
+void eigenAssertionFailed(const char *expression, const char *file, int line)
+{
+    fprintf(stderr, "Eigen assertion failed: %s - %s:%d\n", expression, file, line);
+    abort();
+}
+
+}
+
+void *operator new(size_t size)
+{
+    AllocTracker::recordAllocation(size);
+    void *memory = std::malloc(size ? size : 1);
+    if (!memory)
+        throw std::bad_alloc();
+    return memory;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    AllocTracker::recordAllocation(size);
+    return std::malloc(size ? size : 1);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+    return operator new(size, std::nothrow);
+}
+
+void operator delete(void *memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete[](void *memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete(void *memory, const std::nothrow_t &) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete[](void *memory, const std::nothrow_t &) noexcept
+{
+    std::free(memory);
+}
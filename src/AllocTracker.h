@@ -0,0 +1,105 @@
+#ifndef ALLOC_TRACKER_H
+#define ALLOC_TRACKER_H
+
+// Counts heap allocations per frame and per subsystem.
+// Allocations through operator new are counted with their size. Eigen calls
+// malloc directly, so its allocations are caught with EIGEN_RUNTIME_NO_MALLOC:
+// malloc is never "allowed", and the failed check is routed to the tracker
+// by the eigen_assert below instead of aborting. This only works if this
+// header is seen before any Eigen header, which Helpers.h takes care of.
+// Eigen does not check reallocations, so conservativeResize is not seen.
+
+#ifdef EIGEN_CORE_H
+#  error "AllocTracker.h must be included before any Eigen header"
+#endif
+
+#include <cstddef>
+#include <type_traits>
+
+// Part of the editor an allocation is charged to
+enum AllocSubsystem
+{
+    ALLOC_OTHER,
+    ALLOC_RENDER,
+    ALLOC_INPUT,
+    ALLOC_SCENE,
+    ALLOC_LOADING,
+    ALLOC_SUBSYSTEM_COUNT
+};
+
+namespace AllocTracker
+{
+    class Counters
+    {
+    public:
+        size_t allocations;
+        size_t bytes;
+        // Eigen does not report sizes, only the number of allocations
+        size_t eigenAllocations;
+
+        Counters() : allocations(0), bytes(0), eigenAllocations(0) {}
+
+        size_t count() const { return allocations + eigenAllocations; }
+    };
+
+    // Reset the counters of the current frame
+    void beginFrame();
+
+    // Counters of the current frame for one subsystem, or all of them
+    Counters frame(AllocSubsystem subsystem);
+    Counters frame();
+
+    // Counters since the start of the program
+    Counters total(AllocSubsystem subsystem);
+
+    const char *name(AllocSubsystem subsystem);
+
+    AllocSubsystem currentSubsystem();
+    void setSubsystem(AllocSubsystem subsystem);
+
+    void recordAllocation(size_t bytes);
+    void recordEigenAllocation();
+
+    // Default behaviour of eigen_assert for every other assertion
+    void eigenAssertionFailed(const char *expression, const char *file, int line);
+
+    constexpr bool startsWith(const char *text, const char *prefix)
+    {
+        return *prefix == 0 || (*text == *prefix && startsWith(text + 1, prefix + 1));
+    }
+
+    // True for the assertion of Eigen's check_that_malloc_is_allowed()
+    constexpr bool isEigenMallocCheck(const char *expression)
+    {
+        return startsWith(expression, "is_malloc_allowed()");
+    }
+}
+
+// Charge the allocations made during its lifetime to a subsystem
+class AllocScope
+{
+public:
+    AllocSubsystem previous;
+
+    AllocScope(AllocSubsystem subsystem) : previous(AllocTracker::currentSubsystem())
+    {
+        AllocTracker::setSubsystem(subsystem);
+    }
+
+    ~AllocScope()
+    {
+        AllocTracker::setSubsystem(previous);
+    }
+};
+
+#define EIGEN_RUNTIME_NO_MALLOC
+#ifdef NDEBUG
+// Release builds keep only the malloc check, every other assertion compiles out
+#  define eigen_assert(x) do { if (std::integral_constant<bool, AllocTracker::isEigenMallocCheck(#x)>::value && !(x)) \
+     AllocTracker::recordEigenAllocation(); } while (false)
+#else
+#  define eigen_assert(x) do { if (!(x)) { if (AllocTracker::isEigenMallocCheck(#x)) AllocTracker::recordEigenAllocation(); \
+     else AllocTracker::eigenAssertionFailed(#x, __FILE__, __LINE__); } } while (false)
+#endif
+
+#endif
@@ -0,0 +1,152 @@
+#include "AssetRegistry.h"
+
+#include <cstdio>
+#include <algorithm>
+
+static const uint64_t FNV_OFFSET_BASIS = 14695981039346656037ULL;
+static const uint64_t FNV_PRIME = 1099511628211ULL;
+
+bool AssetRegistry::hashFile(const std::string &path, uint64_t &hash)
+{
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file)
+        return false;
+    hash = FNV_OFFSET_BASIS;
+    unsigned char buffer[4096];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    {
+        for (size_t i = 0; i < length; i++)
+        {
+            hash ^= buffer[i];
+            hash *= FNV_PRIME;
+        }
+    }
+    fclose(file);
+    return true;
+}
+
+bool AssetRegistry::lookup(const std::string &path, uint64_t &hash, MeshAsset *&asset)
+{
+    std::map<std::string, uint64_t>::const_iterator known = pathHashes.find(path);
+    if (known != pathHashes.end())
+    {
+        hash = known->second;
+    }
+    else
+    {
+        if (!hashFile(path, hash))
+            return false;
+        pathHashes[path] = hash;
+    }
+    std::map<uint64_t, MeshAsset>::iterator found = assets.find(hash);
+    asset = found != assets.end() ? &found->second : NULL;
+    if (asset && asset->gpuResident)
+        hits++;
+    else
+        misses++;
+    return true;
+}
+
+MeshAsset &AssetRegistry::add(uint64_t hash, unsigned int objectId, size_t gpuBytes)
+{
+    MeshAsset &asset = assets[hash];
+    asset.objectId = objectId;
+    asset.contentHash = hash;
+    asset.gpuBytes = gpuBytes;
+    asset.gpuResident = true;
+    asset.lastUsed = ++clock;
+    return asset;
+}
+
+MeshAsset *AssetRegistry::find(unsigned int objectId)
+{
+    for (auto &entry : assets)
+    {
+        if (entry.second.objectId == objectId)
+            return &entry.second;
+    }
+    return NULL;
+}
+
+void AssetRegistry::addReference(unsigned int objectId)
+{
+    MeshAsset *asset = find(objectId);
+    if (!asset)
+        return;
+    asset->references++;
+    asset->lastUsed = ++clock;
+}
+
+void AssetRegistry::releaseReference(unsigned int objectId)
+{
+    MeshAsset *asset = find(objectId);
+    if (!asset || asset->references == 0)
+        return;
+    asset->references--;
+    asset->lastUsed = ++clock;
+}
+
+void AssetRegistry::remove(unsigned int objectId)
+{
+    MeshAsset *asset = find(objectId);
+    if (asset)
+        assets.erase(asset->contentHash);
+}
+
+size_t AssetRegistry::residentBytes() const
+{
+    size_t bytes = 0;
+    for (auto const &entry : assets)
+    {
+        if (entry.second.gpuResident)
+            bytes += entry.second.gpuBytes;
+    }
+    return bytes;
+}
+
+std::vector<unsigned int> AssetRegistry::evictionCandidates(size_t incomingBytes) const
+{
+    std::vector<unsigned int> candidates;
+    size_t resident = residentBytes();
+    if (gpuBudget == 0 || resident + incomingBytes <= gpuBudget)
+        return candidates;
+
+    std::vector<const MeshAsset *> unreferenced;
+    for (auto const &entry : assets)
+    {
+        if (entry.second.gpuResident && entry.second.references == 0)
+            unreferenced.push_back(&entry.second);
+    }
+    std::sort(unreferenced.begin(), unreferenced.end(),
+        [](const MeshAsset *a, const MeshAsset *b) { return a->lastUsed < b->lastUsed; });
+    for (size_t i = 0; i < unreferenced.size() && resident + incomingBytes > gpuBudget; i++)
+    {
+        candidates.push_back(unreferenced[i]->objectId);
+        resident -= unreferenced[i]->gpuBytes;
+    }
+    return candidates;
+}
+
+void AssetRegistry::evicted(unsigned int objectId)
+{
+    MeshAsset *asset = find(objectId);
+    if (!asset || !asset->gpuResident)
+        return;
+    asset->gpuResident = false;
+    evictions++;
+}
+
+void AssetRegistry::log(std::ostream &out) const
+{
+    size_t resident = 0;
+    for (auto const &entry : assets)
+    {
+        if (entry.second.gpuResident)
+            resident++;
+    }
+    out << "Assets: " << assets.size() << " meshes (" << resident << " on the GPU, " << residentBytes() << " B";
+    if (gpuBudget > 0)
+        out << " of " << gpuBudget << " B";
+    out << "), " << pathHashes.size() << " paths, hits " << hits << ", misses " << misses << ", evictions " << evictions << std::endl;
+}
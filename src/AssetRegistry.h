@@ -0,0 +1,86 @@
+#ifndef ASSET_REGISTRY_H
+#define ASSET_REGISTRY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <ostream>
+
+// A mesh known to the registry, the geometry itself lives in the Object
+// with the same id
+class MeshAsset
+{
+public:
+    unsigned int objectId;
+    uint64_t contentHash;
+    // Instances using the mesh
+    unsigned int references;
+    // Registry clock at the last change of references, for LRU eviction
+    uint64_t lastUsed;
+    // Bytes taken in the GPU buffers while resident
+    size_t gpuBytes;
+    bool gpuResident;
+
+    MeshAsset() : objectId(0), contentHash(0), references(0), lastUsed(0), gpuBytes(0), gpuResident(false) {}
+};
+
+// Meshes keyed by path and by content hash. Two paths with the same
+// content share one asset. Unreferenced meshes can be evicted from the
+// GPU, least recently used first, when the budget is exceeded.
+class AssetRegistry
+{
+public:
+    // Content hash of every path seen so far
+    std::map<std::string, uint64_t> pathHashes;
+    std::map<uint64_t, MeshAsset> assets;
+
+    // Bytes of resident meshes above which unreferenced ones are evicted, 0 means no budget
+    size_t gpuBudget;
+
+    // lookup() found a resident mesh
+    unsigned long long hits;
+    // lookup() found nothing or an evicted mesh
+    unsigned long long misses;
+    unsigned long long evictions;
+
+    AssetRegistry() : gpuBudget(0), hits(0), misses(0), evictions(0), clock(0) {}
+
+    // FNV-1a hash of the content of a file, false if it cannot be read
+    static bool hashFile(const std::string &path, uint64_t &hash);
+
+    // Asset with the content of path, NULL if there is none yet. hash
+    // receives the content hash, false if the file cannot be read.
+    bool lookup(const std::string &path, uint64_t &hash, MeshAsset *&asset);
+
+    // Register the mesh loaded from content hash as objectId
+    MeshAsset &add(uint64_t hash, unsigned int objectId, size_t gpuBytes);
+
+    // Asset of an object, NULL if unknown
+    MeshAsset *find(unsigned int objectId);
+
+    void addReference(unsigned int objectId);
+    void releaseReference(unsigned int objectId);
+
+    // Forget an asset, e.g. once its object is deleted
+    void remove(unsigned int objectId);
+
+    // Bytes of all GPU resident meshes
+    size_t residentBytes() const;
+
+    // Unreferenced resident meshes to evict, least recently used first, so
+    // that incomingBytes more fit in the budget. The caller evicts them and
+    // reports each with evicted().
+    std::vector<unsigned int> evictionCandidates(size_t incomingBytes) const;
+
+    void evicted(unsigned int objectId);
+
+    // Write a one line summary
+    void log(std::ostream &out) const;
+
+private:
+    uint64_t clock;
+};
+
+#endif
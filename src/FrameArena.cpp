@@ -0,0 +1,117 @@
+#include "FrameArena.h"
+
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+
+FrameArena frameArena;
+
+static size_t alignUp(size_t value, size_t alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+void LinearArena::init(size_t bytes)
+{
+    free();
+    // 64 byte alignment for the block itself, any smaller alignment follows
+    memory = static_cast<char *>(std::malloc(bytes + 64));
+    capacity = memory ? bytes : 0;
+    used = 0;
+}
+
+void *LinearArena::allocate(size_t bytes, size_t alignment)
+{
+    char *base = reinterpret_cast<char *>(alignUp(reinterpret_cast<uintptr_t>(memory), 64));
+    size_t offset = alignUp(used, alignment);
+    requested = alignUp(requested, alignment) + bytes;
+    if (requested > peak)
+        peak = requested;
+    if (!heap && memory && offset + bytes <= capacity)
+    {
+        used = offset + bytes;
+        return base + offset;
+    }
+    return spill(bytes, alignment);
+}
+
+void *LinearArena::spill(size_t bytes, size_t alignment)
+{
+    if (!heap)
+    {
+#ifndef NDEBUG
+        if (overflows == 0)
+            std::cerr << "LinearArena overflow: " << capacity << " bytes are not enough, spilling to the heap" << std::endl;
+#endif
+        overflows++;
+    }
+    else
+    {
+        // Counted like the operator new of a heap container would be
+        AllocTracker::recordAllocation(bytes);
+    }
+    // The header keeps the chain and the alignment of the payload
+    size_t header = alignUp(sizeof(void *), alignment);
+    char *block = static_cast<char *>(std::malloc(header + bytes + alignment));
+    if (!block)
+        throw std::bad_alloc();
+    *reinterpret_cast<void **>(block) = spilled;
+    spilled = block;
+    return reinterpret_cast<void *>(alignUp(reinterpret_cast<uintptr_t>(block) + header, alignment));
+}
+
+void LinearArena::releaseSpilled()
+{
+    while (spilled)
+    {
+        void *next = *reinterpret_cast<void **>(spilled);
+        std::free(spilled);
+        spilled = next;
+    }
+}
+
+void LinearArena::reset()
+{
+    if (spilled)
+    {
+        // Grow once so that the next frame of the same size fits
+        releaseSpilled();
+        if (!heap)
+            init(alignUp(peak + peak / 2, 64));
+    }
+#ifndef NDEBUG
+    if (memory)
+        memset(reinterpret_cast<char *>(alignUp(reinterpret_cast<uintptr_t>(memory), 64)), 0xCD, used);
+#endif
+    used = 0;
+    requested = 0;
+    generation++;
+}
+
+void LinearArena::free()
+{
+    releaseSpilled();
+    std::free(memory);
+    memory = NULL;
+    capacity = 0;
+    used = 0;
+}
+
+void FrameArena::init(size_t bytes)
+{
+    arenas[0].init(bytes);
+    arenas[1].init(bytes);
+}
+
+void FrameArena::beginFrame()
+{
+    current ^= 1;
+    arenas[current].reset();
+}
+
+void FrameArena::free()
+{
+    arenas[0].free();
+    arenas[1].free();
+}
@@ -0,0 +1,148 @@
+#ifndef FRAME_ARENA_H
+#define FRAME_ARENA_H
+
+// Must come before Eigen, see AllocTracker.h
+#include "AllocTracker.h"
+
+#include <cstddef>
+#include <cassert>
+#include <new>
+#include <Eigen/Core>
+
+// Bump allocator for short-lived data. Allocation moves a pointer, reset
+// releases everything at once. When the block is full, allocations spill to
+// the heap and the block grows to the peak usage on the next reset.
+// Debug builds report overflows and fill released memory with 0xCD so that
+// data used after a reset is easy to spot.
+class LinearArena
+{
+public:
+    char *memory;
+    size_t capacity;
+    size_t used;
+    // Largest amount requested between two resets, spills included
+    size_t peak;
+    // Incremented by every reset, used to detect stale allocators
+    unsigned int generation;
+    unsigned int overflows;
+    // Hand every allocation to the heap, freed at the reset, to measure
+    // what the block saves
+    bool heap;
+
+    LinearArena() : memory(NULL), capacity(0), used(0), peak(0), generation(0), overflows(0), heap(false), spilled(NULL), requested(0) {}
+
+    // Reserve the block
+    void init(size_t bytes);
+
+    // Memory for bytes with the given alignment (a power of two)
+    void *allocate(size_t bytes, size_t alignment);
+
+    // Release every allocation in O(1), growing the block if it overflowed
+    void reset();
+
+    // Release the block
+    void free();
+
+private:
+    // Heap blocks handed out after an overflow, chained through their first word
+    void *spilled;
+    size_t requested;
+
+    void *spill(size_t bytes, size_t alignment);
+    void releaseSpilled();
+};
+
+// Two arenas used on alternate frames, so that data built while updating a
+// frame stays valid while the next one is being prepared
+class FrameArena
+{
+public:
+    LinearArena arenas[2];
+    unsigned int current;
+
+    FrameArena() : current(0) {}
+
+    void init(size_t bytes);
+
+    // Switch to the other arena and reset it
+    void beginFrame();
+
+    // Arena of the frame being built
+    LinearArena &frame() { return arenas[current]; }
+
+    // Arena of the previous frame, still valid until the next beginFrame()
+    LinearArena &previous() { return arenas[current ^ 1]; }
+
+    void free();
+};
+
+// Arena shared by the editor for per-frame data
+extern FrameArena frameArena;
+
+// STL allocator over a LinearArena. Memory is aligned to at least 16 bytes,
+// so it can also hold fixed-size vectorizable Eigen types.
+// Deallocation does nothing, the arena reset releases the memory.
+template <typename T>
+class ArenaAllocator
+{
+public:
+    typedef T value_type;
+    typedef T *pointer;
+    typedef const T *const_pointer;
+    typedef T &reference;
+    typedef const T &const_reference;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+
+    template <typename U> struct rebind { typedef ArenaAllocator<U> other; };
+
+    LinearArena *arena;
+    unsigned int generation;
+
+    ArenaAllocator(LinearArena &arena) : arena(&arena), generation(arena.generation) {}
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U> &other) : arena(other.arena), generation(other.generation) {}
+
+    T *allocate(size_t count)
+    {
+        assert(generation == arena->generation && "arena allocator used after the arena was reset");
+        size_t alignment = alignof(T) > 16 ? alignof(T) : 16;
+        return static_cast<T *>(arena->allocate(sizeof(T) * count, alignment));
+    }
+
+    void deallocate(T *, size_t)
+    {
+        assert(generation == arena->generation && "arena memory released after the arena was reset");
+    }
+
+    template <typename U, typename... Args>
+    void construct(U *p, Args&&... args) { ::new ((void *) p) U(static_cast<Args&&>(args)...); }
+
+    template <typename U>
+    void destroy(U *p) { p->~U(); }
+
+    size_t max_size() const { return (size_t) -1 / sizeof(T); }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U> &other) const { return arena == other.arena; }
+
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U> &other) const { return arena != other.arena; }
+};
+
+// Uninitialized rows x cols float matrix stored in the arena
+inline Eigen::Map<Eigen::MatrixXf, Eigen::Aligned> arenaMatrix(LinearArena &arena, Eigen::DenseIndex rows, Eigen::DenseIndex cols)
+{
+    float *data = static_cast<float *>(arena.allocate(sizeof(float) * rows * cols, 16));
+    return Eigen::Map<Eigen::MatrixXf, Eigen::Aligned>(data, rows, cols);
+}
+
+// Uninitialized float vector stored in the arena
+inline Eigen::Map<Eigen::VectorXf, Eigen::Aligned> arenaVector(LinearArena &arena, Eigen::DenseIndex size)
+{
+    float *data = static_cast<float *>(arena.allocate(sizeof(float) * size, 16));
+    return Eigen::Map<Eigen::VectorXf, Eigen::Aligned>(data, size);
+}
+
+#endif
@@ -0,0 +1,778 @@
+#include "GLCapture.h"
+
+#include <iostream>
+#include <cstring>
+#include <initializer_list>
+
+namespace GLCapture
+{
+
+Backend backend = NATIVE_BACKEND;
+
+static const char CAPTURE_MAGIC[4] = {'S', 'E', 'G', 'C'};
+static const uint32_t CAPTURE_VERSION = 1;
+
+static FILE *file = NULL;
+static unsigned int frames = 0;
+static GLuint lastFakeName = 0;
+// Locations already written, so that per-frame lookups are recorded once
+static std::set< std::pair<GLuint, std::string> > recordedLocations;
+
+static uint32_t floatBits(GLfloat value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static GLfloat bitsFloat(uint32_t bits)
+{
+    GLfloat value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static uint64_t offsetOf(const Call &call, int index)
+{
+    return (uint64_t) call.args[index] | ((uint64_t) call.args[index + 1] << 32);
+}
+
+static uint32_t lowWord(size_t value)
+{
+    return (uint32_t) ((uint64_t) value & 0xffffffff);
+}
+
+static uint32_t highWord(size_t value)
+{
+    return (uint32_t) ((uint64_t) value >> 32);
+}
+
+// Record layout: u8 op, u8 argument count, u8 payload count, the u32
+// arguments, then every payload as a u32 size followed by its bytes
+static void writeCall(Op op, std::initializer_list<uint32_t> args, uint8_t payloads = 0)
+{
+    uint8_t header[3] = {(uint8_t) op, (uint8_t) args.size(), payloads};
+    fwrite(header, 1, 3, file);
+    for (uint32_t arg : args)
+        fwrite(&arg, sizeof(arg), 1, file);
+}
+
+static void writePayload(const void *data, size_t size)
+{
+    uint32_t bytes = (uint32_t) size;
+    fwrite(&bytes, sizeof(bytes), 1, file);
+    fwrite(data, 1, size, file);
+}
+
+bool begin(const std::string &path)
+{
+    end();
+    file = fopen(path.c_str(), "wb");
+    if (!file)
+    {
+        std::cerr << "Could not create capture file " << path << std::endl;
+        return false;
+    }
+    fwrite(CAPTURE_MAGIC, 1, 4, file);
+    fwrite(&CAPTURE_VERSION, sizeof(CAPTURE_VERSION), 1, file);
+    frames = 0;
+    recordedLocations.clear();
+    return true;
+}
+
+void end()
+{
+    if (file)
+    {
+        fclose(file);
+        file = NULL;
+    }
+}
+
+bool capturing()
+{
+    return file != NULL;
+}
+
+unsigned int capturedFrames()
+{
+    return frames;
+}
+
+void endFrame()
+{
+    if (!file)
+        return;
+    writeCall(OP_END_FRAME, {});
+    frames++;
+}
+
+GLuint fakeName()
+{
+    return ++lastFakeName;
+}
+
+void genVertexArray(GLuint *id)
+{
+    if (backend == NATIVE_BACKEND)
+        glGenVertexArrays(1, id);
+    else
+        *id = fakeName();
+    if (file)
+        writeCall(OP_GEN_VERTEX_ARRAY, {*id});
+}
+
+void bindVertexArray(GLuint id)
+{
+    if (backend == NATIVE_BACKEND)
+        glBindVertexArray(id);
+    if (file)
+        writeCall(OP_BIND_VERTEX_ARRAY, {id});
+}
+
+void deleteVertexArray(GLuint *id)
+{
+    if (file)
+        writeCall(OP_DELETE_VERTEX_ARRAY, {*id});
+    if (backend == NATIVE_BACKEND)
+        glDeleteVertexArrays(1, id);
+}
+
+void genBuffer(GLuint *id)
+{
+    if (backend == NATIVE_BACKEND)
+        glGenBuffers(1, id);
+    else
+        *id = fakeName();
+    if (file)
+        writeCall(OP_GEN_BUFFER, {*id});
+}
+
+void bindBuffer(GLenum target, GLuint id)
+{
+    if (backend == NATIVE_BACKEND)
+        glBindBuffer(target, id);
+    if (file)
+        writeCall(OP_BIND_BUFFER, {target, id});
+}
+
+void bufferData(GLenum target, size_t size, const void *data, GLenum usage)
+{
+    if (backend == NATIVE_BACKEND)
+        glBufferData(target, size, data, usage);
+    if (file && data)
+    {
+        writeCall(OP_BUFFER_DATA, {target, usage}, 1);
+        writePayload(data, size);
+    }
+    else if (file)
+    {
+        // Uninitialized storage, only the size is recorded
+        writeCall(OP_BUFFER_DATA, {target, usage, lowWord(size), highWord(size)});
+    }
+}
+
+void bufferSubData(GLenum target, size_t offset, size_t size, const void *data)
+{
+    if (backend == NATIVE_BACKEND)
+        glBufferSubData(target, offset, size, data);
+    if (file)
+    {
+        writeCall(OP_BUFFER_SUB_DATA, {target, lowWord(offset), highWord(offset)}, 1);
+        writePayload(data, size);
+    }
+}
+
+void copyBufferSubData(GLenum readTarget, GLenum writeTarget, size_t readOffset, size_t writeOffset, size_t size)
+{
+    if (backend == NATIVE_BACKEND)
+        glCopyBufferSubData(readTarget, writeTarget, readOffset, writeOffset, size);
+    if (file)
+        writeCall(OP_COPY_BUFFER_SUB_DATA, {readTarget, writeTarget, lowWord(readOffset), highWord(readOffset),
+            lowWord(writeOffset), highWord(writeOffset), lowWord(size), highWord(size)});
+}
+
+void bindBufferRange(GLenum target, GLuint index, GLuint id, size_t offset, size_t size)
+{
+    if (backend == NATIVE_BACKEND)
+        glBindBufferRange(target, index, id, offset, size);
+    if (file)
+        writeCall(OP_BIND_BUFFER_RANGE, {target, index, id, lowWord(offset), highWord(offset), lowWord(size), highWord(size)});
+}
+
+void deleteBuffer(GLuint *id)
+{
+    if (file)
+        writeCall(OP_DELETE_BUFFER, {*id});
+    if (backend == NATIVE_BACKEND)
+        glDeleteBuffers(1, id);
+}
+
+void recordProgram(GLuint program, const std::string &vertex_shader_string,
+    const std::string &fragment_shader_string, const std::string &fragment_data_name,
+    const std::vector<std::string> &attribute_names)
+{
+    if (!file)
+        return;
+    // Older captures have no attribute names, their count reads as 0
+    writeCall(OP_CREATE_PROGRAM, {program, (uint32_t) attribute_names.size()}, (uint8_t) (3 + attribute_names.size()));
+    writePayload(vertex_shader_string.c_str(), vertex_shader_string.size());
+    writePayload(fragment_shader_string.c_str(), fragment_shader_string.size());
+    writePayload(fragment_data_name.c_str(), fragment_data_name.size());
+    for (size_t i = 0; i < attribute_names.size(); i++)
+        writePayload(attribute_names[i].c_str(), attribute_names[i].size());
+}
+
+void deleteProgram(GLuint program)
+{
+    if (file)
+        writeCall(OP_DELETE_PROGRAM, {program});
+    if (backend == NATIVE_BACKEND)
+        glDeleteProgram(program);
+}
+
+void useProgram(GLuint program)
+{
+    if (backend == NATIVE_BACKEND)
+        glUseProgram(program);
+    if (file)
+        writeCall(OP_USE_PROGRAM, {program});
+}
+
+GLint attribLocation(GLuint program, const std::string &name)
+{
+    // The null backend exposes every attribute at location 0
+    GLint location = backend == NATIVE_BACKEND ? glGetAttribLocation(program, name.c_str()) : 0;
+    if (file && recordedLocations.insert(std::make_pair(program, "a:" + name)).second)
+    {
+        writeCall(OP_ATTRIB_LOCATION, {program, (uint32_t) location}, 1);
+        writePayload(name.c_str(), name.size());
+    }
+    return location;
+}
+
+void uniformBlockBinding(GLuint program, const std::string &name, GLuint binding)
+{
+    if (backend == NATIVE_BACKEND)
+    {
+        GLuint block = glGetUniformBlockIndex(program, name.c_str());
+        if (block != GL_INVALID_INDEX)
+            glUniformBlockBinding(program, block, binding);
+    }
+    if (file)
+    {
+        writeCall(OP_UNIFORM_BLOCK_BINDING, {program, binding}, 1);
+        writePayload(name.c_str(), name.size());
+    }
+}
+
+GLint uniformLocation(GLuint program, const std::string &name)
+{
+    GLint location = backend == NATIVE_BACKEND ? glGetUniformLocation(program, name.c_str()) : 0;
+    if (file && recordedLocations.insert(std::make_pair(program, "u:" + name)).second)
+    {
+        writeCall(OP_UNIFORM_LOCATION, {program, (uint32_t) location}, 1);
+        writePayload(name.c_str(), name.size());
+    }
+    return location;
+}
+
+void enableVertexAttribArray(GLuint location)
+{
+    if (backend == NATIVE_BACKEND)
+        glEnableVertexAttribArray(location);
+    if (file)
+        writeCall(OP_ENABLE_VERTEX_ATTRIB, {location});
+}
+
+void disableVertexAttribArray(GLuint location)
+{
+    if (backend == NATIVE_BACKEND)
+        glDisableVertexAttribArray(location);
+    if (file)
+        writeCall(OP_DISABLE_VERTEX_ATTRIB, {location});
+}
+
+void vertexAttribPointer(GLuint location, GLint size, GLenum type, GLboolean normalized, GLsizei stride, size_t offset)
+{
+    if (backend == NATIVE_BACKEND)
+        glVertexAttribPointer(location, size, type, normalized, stride, (void *) offset);
+    if (file)
+        writeCall(OP_VERTEX_ATTRIB_POINTER, {location, (uint32_t) size, type, normalized, (uint32_t) stride,
+            lowWord(offset), highWord(offset)});
+}
+
+void vertexAttribIPointer(GLuint location, GLint size, GLenum type, GLsizei stride, size_t offset)
+{
+    if (backend == NATIVE_BACKEND)
+        glVertexAttribIPointer(location, size, type, stride, (void *) offset);
+    if (file)
+        writeCall(OP_VERTEX_ATTRIB_I_POINTER, {location, (uint32_t) size, type, (uint32_t) stride, lowWord(offset), highWord(offset)});
+}
+
+void vertexAttribI1ui(GLuint location, GLuint value)
+{
+    if (backend == NATIVE_BACKEND)
+        glVertexAttribI1ui(location, value);
+    if (file)
+        writeCall(OP_VERTEX_ATTRIB_I1UI, {location, value});
+}
+
+void vertexAttribDivisor(GLuint location, GLuint divisor)
+{
+    if (backend == NATIVE_BACKEND)
+        glVertexAttribDivisor(location, divisor);
+    if (file)
+        writeCall(OP_VERTEX_ATTRIB_DIVISOR, {location, divisor});
+}
+
+void uniform1i(GLint location, GLint value)
+{
+    if (backend == NATIVE_BACKEND)
+        glUniform1i(location, value);
+    if (file)
+        writeCall(OP_UNIFORM_1I, {(uint32_t) location, (uint32_t) value});
+}
+
+void uniform3fv(GLint location, GLsizei count, const GLfloat *value)
+{
+    if (backend == NATIVE_BACKEND)
+        glUniform3fv(location, count, value);
+    if (file)
+    {
+        writeCall(OP_UNIFORM_3FV, {(uint32_t) location, (uint32_t) count}, 1);
+        writePayload(value, sizeof(GLfloat) * 3 * count);
+    }
+}
+
+void uniformMatrix3fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value)
+{
+    if (backend == NATIVE_BACKEND)
+        glUniformMatrix3fv(location, count, transpose, value);
+    if (file)
+    {
+        writeCall(OP_UNIFORM_MATRIX_3FV, {(uint32_t) location, (uint32_t) count, transpose}, 1);
+        writePayload(value, sizeof(GLfloat) * 9 * count);
+    }
+}
+
+void uniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value)
+{
+    if (backend == NATIVE_BACKEND)
+        glUniformMatrix4fv(location, count, transpose, value);
+    if (file)
+    {
+        writeCall(OP_UNIFORM_MATRIX_4FV, {(uint32_t) location, (uint32_t) count, transpose}, 1);
+        writePayload(value, sizeof(GLfloat) * 16 * count);
+    }
+}
+
+void enable(GLenum capability)
+{
+    if (backend == NATIVE_BACKEND)
+        glEnable(capability);
+    if (file)
+        writeCall(OP_ENABLE, {capability});
+}
+
+void disable(GLenum capability)
+{
+    if (backend == NATIVE_BACKEND)
+        glDisable(capability);
+    if (file)
+        writeCall(OP_DISABLE, {capability});
+}
+
+void clearColor(GLfloat r, GLfloat g, GLfloat b, GLfloat a)
+{
+    if (backend == NATIVE_BACKEND)
+        glClearColor(r, g, b, a);
+    if (file)
+        writeCall(OP_CLEAR_COLOR, {floatBits(r), floatBits(g), floatBits(b), floatBits(a)});
+}
+
+void clearStencil(GLint s)
+{
+    if (backend == NATIVE_BACKEND)
+        glClearStencil(s);
+    if (file)
+        writeCall(OP_CLEAR_STENCIL, {(uint32_t) s});
+}
+
+void clear(GLbitfield mask)
+{
+    if (backend == NATIVE_BACKEND)
+        glClear(mask);
+    if (file)
+        writeCall(OP_CLEAR, {mask});
+}
+
+void stencilFunc(GLenum func, GLint ref, GLuint mask)
+{
+    if (backend == NATIVE_BACKEND)
+        glStencilFunc(func, ref, mask);
+    if (file)
+        writeCall(OP_STENCIL_FUNC, {func, (uint32_t) ref, mask});
+}
+
+void stencilOp(GLenum sfail, GLenum dpfail, GLenum dppass)
+{
+    if (backend == NATIVE_BACKEND)
+        glStencilOp(sfail, dpfail, dppass);
+    if (file)
+        writeCall(OP_STENCIL_OP, {sfail, dpfail, dppass});
+}
+
+void drawElements(GLenum mode, GLsizei count, GLenum type, size_t offset)
+{
+    if (backend == NATIVE_BACKEND)
+        glDrawElements(mode, count, type, (void *) offset);
+    if (file)
+        writeCall(OP_DRAW_ELEMENTS, {mode, (uint32_t) count, type, lowWord(offset), highWord(offset)});
+}
+
+void drawElementsBaseVertex(GLenum mode, GLsizei count, GLenum type, size_t offset, GLint baseVertex)
+{
+    if (backend == NATIVE_BACKEND)
+        glDrawElementsBaseVertex(mode, count, type, (void *) offset, baseVertex);
+    if (file)
+        writeCall(OP_DRAW_ELEMENTS_BASE_VERTEX, {mode, (uint32_t) count, type, lowWord(offset), highWord(offset), (uint32_t) baseVertex});
+}
+
+void drawElementsInstancedBaseVertex(GLenum mode, GLsizei count, GLenum type, size_t offset, GLsizei instances, GLint baseVertex)
+{
+    if (backend == NATIVE_BACKEND)
+        glDrawElementsInstancedBaseVertex(mode, count, type, (void *) offset, instances, baseVertex);
+    if (file)
+        writeCall(OP_DRAW_ELEMENTS_INSTANCED_BASE_VERTEX, {mode, (uint32_t) count, type, lowWord(offset), highWord(offset),
+            (uint32_t) instances, (uint32_t) baseVertex});
+}
+
+void multiDrawElementsIndirect(GLenum mode, GLenum type, size_t offset, GLsizei drawCount, GLsizei stride)
+{
+    if (backend == NATIVE_BACKEND)
+        glMultiDrawElementsIndirect(mode, type, (void *) offset, drawCount, stride);
+    if (file)
+        writeCall(OP_MULTI_DRAW_ELEMENTS_INDIRECT, {mode, type, lowWord(offset), highWord(offset), (uint32_t) drawCount, (uint32_t) stride});
+}
+
+bool CaptureFile::load(const std::string &path)
+{
+    FILE *input = fopen(path.c_str(), "rb");
+    if (!input)
+    {
+        std::cerr << "Could not open capture file " << path << std::endl;
+        return false;
+    }
+    char magic[4];
+    uint32_t version = 0;
+    if (fread(magic, 1, 4, input) != 4 || memcmp(magic, CAPTURE_MAGIC, 4) != 0
+        || fread(&version, sizeof(version), 1, input) != 1 || version != CAPTURE_VERSION)
+    {
+        std::cerr << "Not a capture file: " << path << std::endl;
+        fclose(input);
+        return false;
+    }
+
+    calls.clear();
+    blobs.clear();
+    frameStart.clear();
+    frameStart.push_back(0);
+
+    uint8_t header[3];
+    while (fread(header, 1, 3, input) == 3)
+    {
+        Call call;
+        memset(&call, 0, sizeof(call));
+        call.op = (Op) header[0];
+        call.blob = -1;
+        if (header[1] > 8 || fread(call.args, sizeof(uint32_t), header[1], input) != header[1])
+            break;
+        bool complete = true;
+        for (int i = 0; i < header[2] && complete; i++)
+        {
+            uint32_t size = 0;
+            std::vector<char> payload;
+            complete = fread(&size, sizeof(size), 1, input) == 1;
+            if (complete)
+            {
+                payload.resize(size);
+                complete = size == 0 || fread(payload.data(), 1, size, input) == size;
+            }
+            if (i == 0)
+                call.blob = (int) blobs.size();
+            blobs.push_back(payload);
+        }
+        if (!complete)
+            break;
+        calls.push_back(call);
+        if (call.op == OP_END_FRAME)
+            frameStart.push_back(calls.size());
+    }
+    fclose(input);
+    // The last entry is the start of a frame that was never completed
+    frameStart.pop_back();
+    return true;
+}
+
+void CaptureFile::frameRange(unsigned int frame, size_t &first, size_t &last) const
+{
+    first = frameStart[frame];
+    last = first;
+    while (last < calls.size() && calls[last].op != OP_END_FRAME)
+        last++;
+}
+
+void CaptureFile::execute(size_t first, size_t last)
+{
+    for (size_t i = first; i < last; i++)
+        issueCall(resolveCall(calls[i]));
+}
+
+std::vector<Call> CaptureFile::resolve(size_t first, size_t last)
+{
+    std::vector<Call> resolved;
+    resolved.reserve(last - first);
+    for (size_t i = first; i < last; i++)
+    {
+        Call call = resolveCall(calls[i]);
+        // Object creation was already done by resolveCall
+        switch (call.op)
+        {
+            case OP_GEN_VERTEX_ARRAY:
+            case OP_GEN_BUFFER:
+            case OP_CREATE_PROGRAM:
+            case OP_ATTRIB_LOCATION:
+            case OP_UNIFORM_LOCATION:
+            case OP_UNIFORM_BLOCK_BINDING:
+                break;
+            default:
+                resolved.push_back(call);
+                break;
+        }
+    }
+    return resolved;
+}
+
+void CaptureFile::issue(const std::vector<Call> &resolved) const
+{
+    for (size_t i = 0; i < resolved.size(); i++)
+        issueCall(resolved[i]);
+}
+
+void CaptureFile::free()
+{
+    for (auto &entry : vertexArrays)
+        glDeleteVertexArrays(1, &entry.second);
+    for (auto &entry : buffers)
+        glDeleteBuffers(1, &entry.second);
+    for (auto &entry : programs)
+        entry.second.free();
+    vertexArrays.clear();
+    buffers.clear();
+    programs.clear();
+    locations.clear();
+}
+
+// Translate recorded names into replay names, creating objects on first sight
+Call CaptureFile::resolveCall(const Call &call)
+{
+    Call resolved = call;
+    switch (call.op)
+    {
+        case OP_GEN_VERTEX_ARRAY:
+        {
+            GLuint id;
+            glGenVertexArrays(1, &id);
+            vertexArrays[call.args[0]] = id;
+            break;
+        }
+        case OP_BIND_VERTEX_ARRAY:
+        case OP_DELETE_VERTEX_ARRAY:
+            resolved.args[0] = call.args[0] ? vertexArrays[call.args[0]] : 0;
+            break;
+        case OP_GEN_BUFFER:
+        {
+            GLuint id;
+            glGenBuffers(1, &id);
+            buffers[call.args[0]] = id;
+            break;
+        }
+        case OP_BIND_BUFFER:
+            resolved.args[1] = call.args[1] ? buffers[call.args[1]] : 0;
+            break;
+        case OP_DELETE_BUFFER:
+            resolved.args[0] = buffers[call.args[0]];
+            break;
+        case OP_BIND_BUFFER_RANGE:
+            resolved.args[2] = call.args[2] ? buffers[call.args[2]] : 0;
+            break;
+        case OP_UNIFORM_BLOCK_BINDING:
+        {
+            // Program state, set once here
+            const std::vector<char> &name = blobs[call.blob];
+            GLuint program = programs[call.args[0]].program_shader;
+            GLuint block = glGetUniformBlockIndex(program, std::string(name.begin(), name.end()).c_str());
+            if (block != GL_INVALID_INDEX)
+                glUniformBlockBinding(program, block, call.args[1]);
+            break;
+        }
+        case OP_CREATE_PROGRAM:
+        {
+            const std::vector<char> &vs = blobs[call.blob];
+            const std::vector<char> &fs = blobs[call.blob + 1];
+            const std::vector<char> &out = blobs[call.blob + 2];
+            std::vector<std::string> attributes;
+            for (uint32_t i = 0; i < call.args[1]; i++)
+                attributes.push_back(std::string(blobs[call.blob + 3 + i].begin(), blobs[call.blob + 3 + i].end()));
+            Program program;
+            program.init(std::string(vs.begin(), vs.end()), std::string(fs.begin(), fs.end()), std::string(out.begin(), out.end()), attributes);
+            programs[call.args[0]] = program;
+            break;
+        }
+        case OP_DELETE_PROGRAM:
+        case OP_USE_PROGRAM:
+            resolved.args[0] = call.args[0] ? programs[call.args[0]].program_shader : 0;
+            currentProgram = call.args[0];
+            break;
+        case OP_ATTRIB_LOCATION:
+        case OP_UNIFORM_LOCATION:
+        {
+            const std::vector<char> &name = blobs[call.blob];
+            GLuint program = programs[call.args[0]].program_shader;
+            GLint location = call.op == OP_ATTRIB_LOCATION
+                ? glGetAttribLocation(program, std::string(name.begin(), name.end()).c_str())
+                : glGetUniformLocation(program, std::string(name.begin(), name.end()).c_str());
+            locations[((uint64_t) call.args[0] << 32) | call.args[1]] = location;
+            break;
+        }
+        case OP_ENABLE_VERTEX_ATTRIB:
+        case OP_DISABLE_VERTEX_ATTRIB:
+        case OP_VERTEX_ATTRIB_POINTER:
+        case OP_VERTEX_ATTRIB_I_POINTER:
+        case OP_VERTEX_ATTRIB_I1UI:
+        case OP_VERTEX_ATTRIB_DIVISOR:
+        case OP_UNIFORM_1I:
+        case OP_UNIFORM_3FV:
+        case OP_UNIFORM_MATRIX_3FV:
+        case OP_UNIFORM_MATRIX_4FV:
+        {
+            uint64_t key = ((uint64_t) currentProgram << 32) | call.args[0];
+            std::map<uint64_t, GLint>::const_iterator found = locations.find(key);
+            if (found != locations.end())
+                resolved.args[0] = (uint32_t) found->second;
+            break;
+        }
+        default:
+            break;
+    }
+    return resolved;
+}
+
+void CaptureFile::issueCall(const Call &call) const
+{
+    const uint32_t *a = call.args;
+    switch (call.op)
+    {
+        case OP_BIND_VERTEX_ARRAY:
+            glBindVertexArray(a[0]);
+            break;
+        case OP_DELETE_VERTEX_ARRAY:
+            glDeleteVertexArrays(1, &a[0]);
+            break;
+        case OP_BIND_BUFFER:
+            glBindBuffer(a[0], a[1]);
+            break;
+        case OP_BUFFER_DATA:
+            if (call.blob >= 0)
+                glBufferData(a[0], blobs[call.blob].size(), blobs[call.blob].data(), a[1]);
+            else
+                glBufferData(a[0], offsetOf(call, 2), NULL, a[1]);
+            break;
+        case OP_BUFFER_SUB_DATA:
+            glBufferSubData(a[0], offsetOf(call, 1), blobs[call.blob].size(), blobs[call.blob].data());
+            break;
+        case OP_COPY_BUFFER_SUB_DATA:
+            glCopyBufferSubData(a[0], a[1], offsetOf(call, 2), offsetOf(call, 4), offsetOf(call, 6));
+            break;
+        case OP_BIND_BUFFER_RANGE:
+            glBindBufferRange(a[0], a[1], a[2], offsetOf(call, 3), offsetOf(call, 5));
+            break;
+        case OP_DELETE_BUFFER:
+            glDeleteBuffers(1, &a[0]);
+            break;
+        case OP_DELETE_PROGRAM:
+            glDeleteProgram(a[0]);
+            break;
+        case OP_USE_PROGRAM:
+            glUseProgram(a[0]);
+            break;
+        case OP_ENABLE_VERTEX_ATTRIB:
+            glEnableVertexAttribArray(a[0]);
+            break;
+        case OP_DISABLE_VERTEX_ATTRIB:
+            glDisableVertexAttribArray(a[0]);
+            break;
+        case OP_VERTEX_ATTRIB_POINTER:
+            glVertexAttribPointer(a[0], a[1], a[2], (GLboolean) a[3], a[4], (void *) offsetOf(call, 5));
+            break;
+        case OP_VERTEX_ATTRIB_I_POINTER:
+            glVertexAttribIPointer(a[0], a[1], a[2], a[3], (void *) offsetOf(call, 4));
+            break;
+        case OP_VERTEX_ATTRIB_I1UI:
+            glVertexAttribI1ui(a[0], a[1]);
+            break;
+        case OP_VERTEX_ATTRIB_DIVISOR:
+            glVertexAttribDivisor(a[0], a[1]);
+            break;
+        case OP_UNIFORM_1I:
+            glUniform1i(a[0], a[1]);
+            break;
+        case OP_UNIFORM_3FV:
+            glUniform3fv(a[0], a[1], (const GLfloat *) blobs[call.blob].data());
+            break;
+        case OP_UNIFORM_MATRIX_3FV:
+            glUniformMatrix3fv(a[0], a[1], (GLboolean) a[2], (const GLfloat *) blobs[call.blob].data());
+            break;
+        case OP_UNIFORM_MATRIX_4FV:
+            glUniformMatrix4fv(a[0], a[1], (GLboolean) a[2], (const GLfloat *) blobs[call.blob].data());
+            break;
+        case OP_ENABLE:
+            glEnable(a[0]);
+            break;
+        case OP_DISABLE:
+            glDisable(a[0]);
+            break;
+        case OP_CLEAR_COLOR:
+            glClearColor(bitsFloat(a[0]), bitsFloat(a[1]), bitsFloat(a[2]), bitsFloat(a[3]));
+            break;
+        case OP_CLEAR_STENCIL:
+            glClearStencil(a[0]);
+            break;
+        case OP_CLEAR:
+            glClear(a[0]);
+            break;
+        case OP_STENCIL_FUNC:
+            glStencilFunc(a[0], a[1], a[2]);
+            break;
+        case OP_STENCIL_OP:
+            glStencilOp(a[0], a[1], a[2]);
+            break;
+        case OP_DRAW_ELEMENTS:
+            glDrawElements(a[0], a[1], a[2], (void *) offsetOf(call, 3));
+            break;
+        case OP_DRAW_ELEMENTS_BASE_VERTEX:
+            glDrawElementsBaseVertex(a[0], a[1], a[2], (void *) offsetOf(call, 3), (GLint) a[5]);
+            break;
+        case OP_DRAW_ELEMENTS_INSTANCED_BASE_VERTEX:
+            glDrawElementsInstancedBaseVertex(a[0], a[1], a[2], (void *) offsetOf(call, 3), (GLsizei) a[5], (GLint) a[6]);
+            break;
+        case OP_MULTI_DRAW_ELEMENTS_INDIRECT:
+            glMultiDrawElementsIndirect(a[0], a[1], (void *) offsetOf(call, 2), (GLsizei) a[4], (GLsizei) a[5]);
+            break;
+        default:
+            break;
+    }
+}
+
+}
@@ -0,0 +1,198 @@
+#ifndef GL_CAPTURE_H
+#define GL_CAPTURE_H
+
+#include "Helpers.h"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <cstdio>
+#include <cstdint>
+
+// Thin layer between the editor and OpenGL.
+// Every call made by Helpers.cpp and by the render loop goes through one of
+// the functions below so that it can be
+//  - serialized to a capture file that the standalone replayer re-issues, and
+//  - skipped entirely by the null backend, which leaves only the CPU side of
+//    the editor to be timed.
+namespace GLCapture
+{
+    enum Backend
+    {
+        NATIVE_BACKEND,
+        NULL_BACKEND
+    };
+
+    enum Op
+    {
+        OP_GEN_VERTEX_ARRAY,
+        OP_BIND_VERTEX_ARRAY,
+        OP_DELETE_VERTEX_ARRAY,
+        OP_GEN_BUFFER,
+        OP_BIND_BUFFER,
+        OP_BUFFER_DATA,
+        OP_DELETE_BUFFER,
+        OP_CREATE_PROGRAM,
+        OP_DELETE_PROGRAM,
+        OP_USE_PROGRAM,
+        OP_ATTRIB_LOCATION,
+        OP_UNIFORM_LOCATION,
+        OP_ENABLE_VERTEX_ATTRIB,
+        OP_DISABLE_VERTEX_ATTRIB,
+        OP_VERTEX_ATTRIB_POINTER,
+        OP_UNIFORM_1I,
+        OP_UNIFORM_3FV,
+        OP_UNIFORM_MATRIX_4FV,
+        OP_ENABLE,
+        OP_DISABLE,
+        OP_CLEAR_COLOR,
+        OP_CLEAR_STENCIL,
+        OP_CLEAR,
+        OP_STENCIL_FUNC,
+        OP_STENCIL_OP,
+        OP_DRAW_ELEMENTS,
+        OP_END_FRAME,
+        // Added later, kept after OP_END_FRAME so that older captures still load
+        OP_BUFFER_SUB_DATA,
+        OP_COPY_BUFFER_SUB_DATA,
+        OP_DRAW_ELEMENTS_BASE_VERTEX,
+        OP_UNIFORM_MATRIX_3FV,
+        OP_BIND_BUFFER_RANGE,
+        OP_UNIFORM_BLOCK_BINDING,
+        OP_VERTEX_ATTRIB_I_POINTER,
+        OP_VERTEX_ATTRIB_I1UI,
+        OP_VERTEX_ATTRIB_DIVISOR,
+        OP_DRAW_ELEMENTS_INSTANCED_BASE_VERTEX,
+        OP_MULTI_DRAW_ELEMENTS_INDIRECT
+    };
+
+    // Backend used by all the calls below (NATIVE_BACKEND by default)
+    extern Backend backend;
+
+    // Start serializing calls to a file, returns false if it cannot be created
+    bool begin(const std::string &path);
+
+    // Stop serializing and close the file
+    void end();
+
+    bool capturing();
+
+    // Number of frames written since begin()
+    unsigned int capturedFrames();
+
+    // Mark the end of a frame in the capture
+    void endFrame();
+
+    // Ids handed out instead of real names by the null backend
+    GLuint fakeName();
+
+    void genVertexArray(GLuint *id);
+    void bindVertexArray(GLuint id);
+    void deleteVertexArray(GLuint *id);
+
+    void genBuffer(GLuint *id);
+    void bindBuffer(GLenum target, GLuint id);
+    // data may be NULL to allocate uninitialized storage
+    void bufferData(GLenum target, size_t size, const void *data, GLenum usage);
+    void bufferSubData(GLenum target, size_t offset, size_t size, const void *data);
+    void copyBufferSubData(GLenum readTarget, GLenum writeTarget, size_t readOffset, size_t writeOffset, size_t size);
+    void bindBufferRange(GLenum target, GLuint index, GLuint id, size_t offset, size_t size);
+    void deleteBuffer(GLuint *id);
+
+    // Record a linked program together with the sources it was built from
+    void recordProgram(GLuint program, const std::string &vertex_shader_string,
+        const std::string &fragment_shader_string, const std::string &fragment_data_name,
+        const std::vector<std::string> &attribute_names);
+    void deleteProgram(GLuint program);
+    void useProgram(GLuint program);
+    // Attach the uniform block called name to a binding point, nothing
+    // happens if the program has no such block
+    void uniformBlockBinding(GLuint program, const std::string &name, GLuint binding);
+    GLint attribLocation(GLuint program, const std::string &name);
+    GLint uniformLocation(GLuint program, const std::string &name);
+
+    void enableVertexAttribArray(GLuint location);
+    void disableVertexAttribArray(GLuint location);
+    void vertexAttribPointer(GLuint location, GLint size, GLenum type, GLboolean normalized, GLsizei stride, size_t offset);
+    void vertexAttribIPointer(GLuint location, GLint size, GLenum type, GLsizei stride, size_t offset);
+    // Value of an integer attribute while its array is disabled
+    void vertexAttribI1ui(GLuint location, GLuint value);
+    void vertexAttribDivisor(GLuint location, GLuint divisor);
+
+    void uniform1i(GLint location, GLint value);
+    void uniform3fv(GLint location, GLsizei count, const GLfloat *value);
+    void uniformMatrix3fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value);
+    void uniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value);
+
+    void enable(GLenum capability);
+    void disable(GLenum capability);
+    void clearColor(GLfloat r, GLfloat g, GLfloat b, GLfloat a);
+    void clearStencil(GLint s);
+    void clear(GLbitfield mask);
+    void stencilFunc(GLenum func, GLint ref, GLuint mask);
+    void stencilOp(GLenum sfail, GLenum dpfail, GLenum dppass);
+    void drawElements(GLenum mode, GLsizei count, GLenum type, size_t offset);
+    void drawElementsBaseVertex(GLenum mode, GLsizei count, GLenum type, size_t offset, GLint baseVertex);
+    void drawElementsInstancedBaseVertex(GLenum mode, GLsizei count, GLenum type, size_t offset, GLsizei instances, GLint baseVertex);
+    // The commands are read from the buffer bound to GL_DRAW_INDIRECT_BUFFER
+    void multiDrawElementsIndirect(GLenum mode, GLenum type, size_t offset, GLsizei drawCount, GLsizei stride);
+
+    // One decoded call of a capture file. Floats are stored bit for bit and
+    // 64 bit offsets as two consecutive arguments (low word first).
+    class Call
+    {
+    public:
+        Op op;
+        uint32_t args[8];
+        // Index in CaptureFile::blobs of the first payload (-1 if none),
+        // calls with several payloads use consecutive indices
+        int blob;
+    };
+
+    // A capture file loaded in memory, executed with raw OpenGL calls.
+    // Object names and attribute/uniform locations recorded in the file are
+    // mapped to the ones created during the replay.
+    class CaptureFile
+    {
+    public:
+        std::vector<Call> calls;
+        std::vector< std::vector<char> > blobs;
+        // Index in calls of the first call of every frame
+        std::vector<size_t> frameStart;
+
+        CaptureFile() : currentProgram(0) {}
+
+        bool load(const std::string &path);
+
+        unsigned int frames() const { return (unsigned int) frameStart.size(); }
+
+        // [first, last) range of calls of a frame, END_FRAME excluded
+        void frameRange(unsigned int frame, size_t &first, size_t &last) const;
+
+        // Execute calls[first, last), creating the objects they refer to
+        void execute(size_t first, size_t last);
+
+        // Copy of calls[first, last) with every name and location replaced by
+        // the replay one, so that it can be re-issued without lookups
+        std::vector<Call> resolve(size_t first, size_t last);
+
+        // Issue already resolved calls
+        void issue(const std::vector<Call> &resolved) const;
+
+        // Release every object created by execute()
+        void free();
+
+    private:
+        std::map<uint32_t, GLuint> vertexArrays;
+        std::map<uint32_t, GLuint> buffers;
+        std::map<uint32_t, Program> programs;
+        std::map<uint64_t, GLint> locations;
+        uint32_t currentProgram;
+
+        Call resolveCall(const Call &call);
+        void issueCall(const Call &call) const;
+    };
+}
+
+#endif
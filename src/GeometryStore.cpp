@@ -0,0 +1,148 @@
+#include "GeometryStore.h"
+
+#include <cstring>
+#include <cstdio>
+#include <cstdint>
+
+static const char GEOMETRY_CACHE_MAGIC[4] = {'S', 'E', 'G', 'N'};
+
+static float *growAttribute(float *attribute, unsigned int count, unsigned int capacity)
+{
+    float *grown = static_cast<float *>(Eigen::internal::aligned_malloc(sizeof(float) * 3 * capacity));
+    if (attribute)
+    {
+        memcpy(grown, attribute, sizeof(float) * 3 * count);
+        Eigen::internal::aligned_free(attribute);
+    }
+    return grown;
+}
+
+unsigned int GeometryStore::appendVertices(unsigned int count)
+{
+    unsigned int first = vertexCount;
+    if (vertexCount + count > vertexCapacity)
+    {
+        unsigned int doubled = 2 * vertexCapacity;
+        reserve(vertexCount + count > doubled ? vertexCount + count : doubled);
+    }
+    vertexCount += count;
+    return first;
+}
+
+void GeometryStore::reserve(unsigned int vertices)
+{
+    if (vertices <= vertexCapacity)
+        return;
+    unsigned int capacity = (vertices + CHUNK_VERTICES - 1) / CHUNK_VERTICES * CHUNK_VERTICES;
+    positions = growAttribute(positions, vertexCount, capacity);
+    if (normals)
+    {
+        normals = growAttribute(normals, vertexCount, capacity);
+        barycenters = growAttribute(barycenters, vertexCount, capacity);
+    }
+    vertexCapacity = capacity;
+}
+
+void GeometryStore::allocateNormals()
+{
+    if (normals || vertexCapacity == 0)
+        return;
+    normals = growAttribute(NULL, 0, vertexCapacity);
+    barycenters = growAttribute(NULL, 0, vertexCapacity);
+}
+
+void GeometryStore::remove(unsigned int offset, unsigned int count)
+{
+    unsigned int tail = vertexCount - offset - count;
+    float *attributes[3] = {positions, normals, barycenters};
+    for (int a = 0; a < 3 && attributes[a]; a++)
+        memmove(attributes[a] + 3 * offset, attributes[a] + 3 * (offset + count), sizeof(float) * 3 * tail);
+    vertexCount -= count;
+
+    if (vertexCount == 0)
+    {
+        free();
+    }
+    else if (vertexCount <= vertexCapacity / 4)
+    {
+        // Keep room to double before the next reallocation
+        unsigned int capacity = (2 * vertexCount + CHUNK_VERTICES - 1) / CHUNK_VERTICES * CHUNK_VERTICES;
+        positions = growAttribute(positions, vertexCount, capacity);
+        if (normals)
+        {
+            normals = growAttribute(normals, vertexCount, capacity);
+            barycenters = growAttribute(barycenters, vertexCount, capacity);
+        }
+        vertexCapacity = capacity;
+    }
+}
+
+void GeometryStore::free()
+{
+    Eigen::internal::aligned_free(positions);
+    Eigen::internal::aligned_free(normals);
+    Eigen::internal::aligned_free(barycenters);
+    positions = NULL;
+    normals = NULL;
+    barycenters = NULL;
+    vertexCount = 0;
+    vertexCapacity = 0;
+}
+
+bool GeometryStore::saveSpan(const std::string &path, unsigned int offset, unsigned int count, const unsigned int *indices, unsigned int indexCount, bool withNormals) const
+{
+    FILE *file = fopen(path.c_str(), "wb");
+    if (!file)
+        return false;
+    withNormals = withNormals && normals;
+    uint32_t header[3] = {count, indexCount, withNormals};
+    fwrite(GEOMETRY_CACHE_MAGIC, 1, 4, file);
+    fwrite(header, sizeof(uint32_t), 3, file);
+    fwrite(positions + 3 * offset, sizeof(float), 3 * count, file);
+    if (withNormals)
+    {
+        fwrite(normals + 3 * offset, sizeof(float), 3 * count, file);
+        fwrite(barycenters + 3 * offset, sizeof(float), 3 * count, file);
+    }
+    fwrite(indices, sizeof(unsigned int), indexCount, file);
+    bool written = !ferror(file);
+    fclose(file);
+    return written;
+}
+
+bool GeometryStore::loadSpan(const std::string &path, unsigned int count, std::vector<unsigned int> &indices, bool &withNormals)
+{
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file)
+        return false;
+    char magic[4];
+    uint32_t header[3];
+    if (fread(magic, 1, 4, file) != 4 || memcmp(magic, GEOMETRY_CACHE_MAGIC, 4) != 0
+        || fread(header, sizeof(uint32_t), 3, file) != 3 || header[0] != count)
+    {
+        fclose(file);
+        return false;
+    }
+    unsigned int first = appendVertices(count);
+    size_t previousIndices = indices.size();
+    indices.resize(previousIndices + header[1]);
+    bool complete = fread(positions + 3 * first, sizeof(float), 3 * count, file) == 3 * count;
+    withNormals = header[2] != 0 && normals;
+    if (withNormals)
+    {
+        complete = complete && fread(normals + 3 * first, sizeof(float), 3 * count, file) == 3 * count
+            && fread(barycenters + 3 * first, sizeof(float), 3 * count, file) == 3 * count;
+    }
+    else if (header[2] != 0)
+    {
+        complete = complete && fseek(file, (long) (2 * 3 * sizeof(float) * count), SEEK_CUR) == 0;
+    }
+    complete = complete && fread(indices.data() + previousIndices, sizeof(unsigned int), header[1], file) == header[1];
+    fclose(file);
+    if (!complete)
+    {
+        vertexCount = first;
+        indices.resize(previousIndices);
+    }
+    return complete;
+}
@@ -0,0 +1,79 @@
+#ifndef GEOMETRY_STORE_H
+#define GEOMETRY_STORE_H
+
+// Must come before Eigen, see AllocTracker.h
+#include "AllocTracker.h"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <Eigen/Core>
+
+// CPU copy of the vertex attributes of every loaded mesh.
+// Each attribute is one aligned 3 x capacity column-major block and a mesh
+// is a contiguous span of columns starting at its vertexOffset. Capacity
+// grows geometrically in whole chunks, so appending a mesh only copies the
+// existing geometry when the block doubles and loading the k-th mesh costs
+// O(mesh size) amortized. The normals and barycenters are only allocated
+// once something asks for them with allocateNormals(), the flat and
+// wireframe shading never do.
+class GeometryStore
+{
+public:
+    typedef Eigen::Map<Eigen::Matrix3Xf, Eigen::Aligned> Attribute;
+    typedef Eigen::Map<Eigen::Matrix3Xf> Span;
+
+    // Capacity is always a multiple of this many vertices
+    static const unsigned int CHUNK_VERTICES = 1024;
+
+    float *positions;
+    // NULL until allocateNormals()
+    float *normals;
+    float *barycenters;
+    unsigned int vertexCount;
+    unsigned int vertexCapacity;
+
+    GeometryStore() : positions(NULL), normals(NULL), barycenters(NULL), vertexCount(0), vertexCapacity(0) {}
+
+    // Make room for count more vertices and return the offset of the first.
+    // The new columns are uninitialized.
+    unsigned int appendVertices(unsigned int count);
+
+    // Grow the capacity to at least vertices
+    void reserve(unsigned int vertices);
+
+    // Allocate the normals and barycenters at the current capacity, their
+    // columns are uninitialized
+    void allocateNormals();
+
+    // Drop columns [offset, offset + count), moving the following ones down.
+    // The capacity shrinks once the store is mostly empty.
+    void remove(unsigned int offset, unsigned int count);
+
+    // Every stored vertex, column i is vertex i
+    Attribute V() { return Attribute(positions, 3, vertexCount); }
+    Attribute N() { return Attribute(normals, 3, vertexCount); }
+    Attribute B() { return Attribute(barycenters, 3, vertexCount); }
+
+    // Columns [offset, offset + count) of one attribute
+    Span span(float *attribute, unsigned int offset, unsigned int count) { return Span(attribute + 3 * offset, 3, count); }
+
+    // Bytes reserved for each attribute
+    size_t capacityBytes() const { return sizeof(float) * 3 * vertexCapacity; }
+    size_t normalBytes() const { return normals ? capacityBytes() : 0; }
+
+    // Release every attribute
+    void free();
+
+    // Write columns [offset, offset + count) of the positions, and of the
+    // normals and barycenters when withNormals, together with the indices
+    // of the mesh to a binary cache file
+    bool saveSpan(const std::string &path, unsigned int offset, unsigned int count, const unsigned int *indices, unsigned int indexCount, bool withNormals) const;
+
+    // Append a mesh written by saveSpan, returns false if the file is
+    // missing or does not hold count vertices. withNormals tells whether
+    // the normals were read, they are skipped while none are allocated.
+    bool loadSpan(const std::string &path, unsigned int count, std::vector<unsigned int> &indices, bool &withNormals);
+};
+
+#endif
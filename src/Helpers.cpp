@@ -1,92 +1,228 @@
 #include "Helpers.h"
+#include "GLCapture.h"
+#include "MemoryStats.h"
 
 #include <iostream>
 #include <fstream>
 
 void VertexArrayObject::init()
 {
-  glGenVertexArrays(1, &id);
+  GLCapture::genVertexArray(&id);
   check_gl_error();
 }
 
 void VertexArrayObject::bind()
 {
-  glBindVertexArray(id);
+  GLCapture::bindVertexArray(id);
   check_gl_error();
 }
 
 void VertexArrayObject::free()
 {
-  glDeleteVertexArrays(1, &id);
+  GLCapture::deleteVertexArray(&id);
   check_gl_error();
 }
 
 void VertexBufferObject::init()
 {
-  glGenBuffers(1,&id);
+  GLCapture::genBuffer(&id);
   check_gl_error();
 }
 
 void VertexBufferObject::bind()
 {
-  glBindBuffer(GL_ARRAY_BUFFER,id);
+  GLCapture::bindBuffer(GL_ARRAY_BUFFER, id);
   check_gl_error();
 }
 
 void VertexBufferObject::free()
 {
-  glDeleteBuffers(1,&id);
+  GLCapture::deleteBuffer(&id);
+  memoryStats.resize(GPU_VERTEX_BUFFERS, bytes, 0);
+  bytes = 0;
   check_gl_error();
 }
 
 void VertexBufferObject::update(const Eigen::MatrixXf& M)
+{
+  update(M.data(), M.rows(), M.cols());
+}
+
+void VertexBufferObject::update(const float *data, GLuint rows, GLuint cols)
+{
+  assert(id != 0);
+  size_t size = sizeof(float)*rows*cols;
+  GLCapture::bindBuffer(GL_ARRAY_BUFFER, id);
+  GLCapture::bufferData(GL_ARRAY_BUFFER, size, data, GL_DYNAMIC_DRAW);
+  this->rows = rows;
+  this->cols = cols;
+  memoryStats.resize(GPU_VERTEX_BUFFERS, bytes, size);
+  memoryStats.uploaded(size);
+  bytes = size;
+  check_gl_error();
+}
+
+// Move the first used bytes of buffer id into a new buffer of capacity
+// bytes, on the GPU, and return the new buffer
+static GLuint reallocateBuffer(GLuint id, size_t used, size_t capacity, GLenum usage)
+{
+  GLuint grown;
+  GLCapture::genBuffer(&grown);
+  GLCapture::bindBuffer(GL_COPY_WRITE_BUFFER, grown);
+  GLCapture::bufferData(GL_COPY_WRITE_BUFFER, capacity, NULL, usage);
+  if (used > 0)
+  {
+    GLCapture::bindBuffer(GL_COPY_READ_BUFFER, id);
+    GLCapture::copyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, used);
+  }
+  GLCapture::deleteBuffer(&id);
+  check_gl_error();
+  return grown;
+}
+
+bool VertexBufferObject::updateRange(const float *data, GLuint rows, GLuint first, GLuint cols)
 {
   assert(id != 0);
-  glBindBuffer(GL_ARRAY_BUFFER, id);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(float)*M.size(), M.data(), GL_DYNAMIC_DRAW);
-  rows = M.rows();
-  cols = M.cols();
+  assert(this->rows == 0 || this->cols == 0 || this->rows == rows);
+  size_t end = sizeof(float)*rows*(first + cols);
+  bool grown = end > bytes;
+  if (grown)
+  {
+    size_t capacity = end > 2*bytes ? end : 2*bytes;
+    id = reallocateBuffer(id, sizeof(float)*this->rows*this->cols, capacity, GL_DYNAMIC_DRAW);
+    memoryStats.resize(GPU_VERTEX_BUFFERS, bytes, capacity);
+    bytes = capacity;
+  }
+  GLCapture::bindBuffer(GL_ARRAY_BUFFER, id);
+  GLCapture::bufferSubData(GL_ARRAY_BUFFER, sizeof(float)*rows*first, sizeof(float)*rows*cols, data);
+  memoryStats.uploaded(sizeof(float)*rows*cols);
+  this->rows = rows;
+  if (first + cols > this->cols)
+    this->cols = first + cols;
+  check_gl_error();
+  return grown;
+}
+
+void VertexBufferObject::copyRange(GLuint from, GLuint to, GLuint cols)
+{
+  assert(from + cols <= to || to + cols <= from);
+  GLCapture::bindBuffer(GL_COPY_READ_BUFFER, id);
+  GLCapture::bindBuffer(GL_COPY_WRITE_BUFFER, id);
+  GLCapture::copyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, sizeof(float)*rows*from, sizeof(float)*rows*to, sizeof(float)*rows*cols);
   check_gl_error();
 }
 
+void VertexBufferObject::reallocate(GLuint capacity)
+{
+  if (cols > capacity)
+    cols = capacity;
+  size_t size = sizeof(float)*rows*capacity;
+  id = reallocateBuffer(id, sizeof(float)*rows*cols, size, GL_DYNAMIC_DRAW);
+  memoryStats.resize(GPU_VERTEX_BUFFERS, bytes, size);
+  bytes = size;
+}
+
 void IndexBufferObject::init()
 {
-    glGenBuffers(1,&id);
+    GLCapture::genBuffer(&id);
     check_gl_error();
 }
 
 void IndexBufferObject::bind()
 {
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, id);
+    GLCapture::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, id);
     check_gl_error();
 }
 
 void IndexBufferObject::free()
 {
-    glDeleteBuffers(1,&id);
+    GLCapture::deleteBuffer(&id);
+    memoryStats.resize(GPU_INDEX_BUFFERS, bytes, 0);
+    bytes = 0;
     check_gl_error();
 }
 
-void IndexBufferObject::update(std::vector<unsigned int> I)
+void IndexBufferObject::update(const std::vector<unsigned int> &I)
 {
     assert(id != 0);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, id);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int)*I.size(), I.data(), GL_STATIC_DRAW);
+    GLCapture::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, id);
+    GLCapture::bufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int)*I.size(), I.data(), GL_STATIC_DRAW);
     size = I.size();
+    memoryStats.resize(GPU_INDEX_BUFFERS, bytes, sizeof(unsigned int)*I.size());
+    memoryStats.uploaded(sizeof(unsigned int)*I.size());
+    bytes = sizeof(unsigned int)*I.size();
+    check_gl_error();
+}
+
+void IndexBufferObject::copyRange(GLuint from, GLuint to, GLuint count)
+{
+    assert(from + count <= to || to + count <= from);
+    GLCapture::bindBuffer(GL_COPY_READ_BUFFER, id);
+    GLCapture::bindBuffer(GL_COPY_WRITE_BUFFER, id);
+    GLCapture::copyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, sizeof(unsigned int)*from, sizeof(unsigned int)*to, sizeof(unsigned int)*count);
+    check_gl_error();
+}
+
+void IndexBufferObject::reallocate(GLuint capacity)
+{
+    if (size > capacity)
+        size = capacity;
+    size_t capacityBytes = sizeof(unsigned int)*capacity;
+    id = reallocateBuffer(id, sizeof(unsigned int)*size, capacityBytes, GL_STATIC_DRAW);
+    memoryStats.resize(GPU_INDEX_BUFFERS, bytes, capacityBytes);
+    bytes = capacityBytes;
+    // the deleted buffer was the element buffer of the bound VAO
+    bind();
+}
+
+bool IndexBufferObject::updateRange(const unsigned int *data, GLuint first, GLuint count)
+{
+    assert(id != 0);
+    size_t end = sizeof(unsigned int)*(first + count);
+    bool grown = end > bytes;
+    if (grown)
+    {
+        size_t capacity = end > 2*bytes ? end : 2*bytes;
+        id = reallocateBuffer(id, sizeof(unsigned int)*size, capacity, GL_STATIC_DRAW);
+        memoryStats.resize(GPU_INDEX_BUFFERS, bytes, capacity);
+        bytes = capacity;
+    }
+    GLCapture::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, id);
+    GLCapture::bufferSubData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int)*first, sizeof(unsigned int)*count, data);
+    memoryStats.uploaded(sizeof(unsigned int)*count);
+    if (first + count > size)
+        size = first + count;
     check_gl_error();
+    return grown;
 }
 
 bool Program::init(
   const std::string &vertex_shader_string,
   const std::string &fragment_shader_string,
-  const std::string &fragment_data_name)
+  const std::string &fragment_data_name,
+  const std::vector<std::string> &attribute_names)
 {
-  using namespace std;
-  vertex_shader = create_shader_helper(GL_VERTEX_SHADER, vertex_shader_string);
-  fragment_shader = create_shader_helper(GL_FRAGMENT_SHADER, fragment_shader_string);
+  start(vertex_shader_string, fragment_shader_string, fragment_data_name, attribute_names);
+  return finish(vertex_shader_string, fragment_shader_string, fragment_data_name, attribute_names);
+}
 
-  if (!vertex_shader || !fragment_shader)
-    return false;
+void Program::start(
+  const std::string &vertex_shader_string,
+  const std::string &fragment_shader_string,
+  const std::string &fragment_data_name,
+  const std::vector<std::string> &attribute_names)
+{
+  if (GLCapture::backend == GLCapture::NULL_BACKEND)
+    return;
+
+  // No status is queried here, it would wait for the driver
+  const char *sources[2] = {vertex_shader_string.c_str(), fragment_shader_string.c_str()};
+  vertex_shader = glCreateShader(GL_VERTEX_SHADER);
+  glShaderSource(vertex_shader, 1, &sources[0], NULL);
+  glCompileShader(vertex_shader);
+  fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
+  glShaderSource(fragment_shader, 1, &sources[1], NULL);
+  glCompileShader(fragment_shader);
 
   program_shader = glCreateProgram();
 
@@ -94,7 +230,35 @@ bool Program::init(
   glAttachShader(program_shader, fragment_shader);
 
   glBindFragDataLocation(program_shader, 0, fragment_data_name.c_str());
+  for (size_t i = 0; i < attribute_names.size(); i++)
+    glBindAttribLocation(program_shader, (GLuint) i, attribute_names[i].c_str());
+  if (retrievable && binariesSupported())
+    glProgramParameteri(program_shader, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
   glLinkProgram(program_shader);
+}
+
+bool Program::finish(
+  const std::string &vertex_shader_string,
+  const std::string &fragment_shader_string,
+  const std::string &fragment_data_name,
+  const std::vector<std::string> &attribute_names)
+{
+  using namespace std;
+  if (GLCapture::backend == GLCapture::NULL_BACKEND)
+  {
+    // Nothing is compiled, the program only needs a name for the capture
+    program_shader = GLCapture::fakeName();
+    GLCapture::recordProgram(program_shader, vertex_shader_string, fragment_shader_string, fragment_data_name, attribute_names);
+    return true;
+  }
+
+  if (!check_shader(vertex_shader, GL_VERTEX_SHADER, vertex_shader_string)
+      || !check_shader(fragment_shader, GL_FRAGMENT_SHADER, fragment_shader_string))
+  {
+    glDeleteProgram(program_shader);
+    program_shader = 0;
+    return false;
+  }
 
   GLint status;
   glGetProgramiv(program_shader, GL_LINK_STATUS, &status);
@@ -108,24 +272,75 @@ bool Program::init(
     return false;
   }
 
+  GLCapture::recordProgram(program_shader, vertex_shader_string, fragment_shader_string, fragment_data_name, attribute_names);
   check_gl_error();
   return true;
 }
 
+bool Program::loadBinary(GLenum format, const std::vector<char> &binary,
+  const std::string &vertex_shader_string,
+  const std::string &fragment_shader_string,
+  const std::string &fragment_data_name,
+  const std::vector<std::string> &attribute_names)
+{
+  if (!binariesSupported() || binary.empty())
+    return false;
+  program_shader = glCreateProgram();
+  glProgramBinary(program_shader, format, binary.data(), (GLsizei) binary.size());
+  GLint status;
+  glGetProgramiv(program_shader, GL_LINK_STATUS, &status);
+  if (status != GL_TRUE)
+  {
+    glDeleteProgram(program_shader);
+    program_shader = 0;
+    return false;
+  }
+  GLCapture::recordProgram(program_shader, vertex_shader_string, fragment_shader_string, fragment_data_name, attribute_names);
+  check_gl_error();
+  return true;
+}
+
+bool Program::getBinary(GLenum &format, std::vector<char> &binary) const
+{
+  if (!binariesSupported() || !program_shader)
+    return false;
+  GLint length = 0;
+  glGetProgramiv(program_shader, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0)
+    return false;
+  binary.resize(length);
+  glGetProgramBinary(program_shader, length, &length, &format, binary.data());
+  binary.resize(length);
+  return length > 0;
+}
+
+bool Program::binariesSupported()
+{
+#ifdef __APPLE__
+  return false;
+#else
+  if (GLCapture::backend != GLCapture::NATIVE_BACKEND || (!GLEW_ARB_get_program_binary && !GLEW_VERSION_4_1))
+    return false;
+  GLint formats = 0;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+  return formats > 0;
+#endif
+}
+
 void Program::bind()
 {
-  glUseProgram(program_shader);
+  GLCapture::useProgram(program_shader);
   check_gl_error();
 }
 
 GLint Program::attrib(const std::string &name) const
 {
-  return glGetAttribLocation(program_shader, name.c_str());
+  return GLCapture::attribLocation(program_shader, name);
 }
 
 GLint Program::uniform(const std::string &name) const
 {
-  return glGetUniformLocation(program_shader, name.c_str());
+  return GLCapture::uniformLocation(program_shader, name);
 }
 
 GLint Program::bindVertexAttribArray(
@@ -136,12 +351,12 @@ GLint Program::bindVertexAttribArray(
     return id;
   if (VBO.id == 0)
   {
-    glDisableVertexAttribArray(id);
+    GLCapture::disableVertexAttribArray(id);
     return id;
   }
   VBO.bind();
-  glEnableVertexAttribArray(id);
-  glVertexAttribPointer(id, VBO.rows, GL_FLOAT, GL_FALSE, 0, 0);
+  GLCapture::enableVertexAttribArray(id);
+  GLCapture::vertexAttribPointer(id, VBO.rows, GL_FLOAT, GL_FALSE, 0, 0);
   check_gl_error();
 
   return id;
@@ -155,12 +370,12 @@ GLint Program::bindIndexAttribArray(
         return id;
     if (IBO.id == 0)
     {
-        glDisableVertexAttribArray(id);
+        GLCapture::disableVertexAttribArray(id);
         return id;
     }
     IBO.bind();
-    glEnableVertexAttribArray(id);
-    glVertexAttribPointer(id, IBO.size, GL_UNSIGNED_INT, GL_FALSE, 0, 0);
+    GLCapture::enableVertexAttribArray(id);
+    GLCapture::vertexAttribPointer(id, IBO.size, GL_UNSIGNED_INT, GL_FALSE, 0, 0);
     check_gl_error();
     
     return id;
@@ -170,7 +385,7 @@ void Program::free()
 {
   if (program_shader)
   {
-    glDeleteProgram(program_shader);
+    GLCapture::deleteProgram(program_shader);
     program_shader = 0;
   }
   if (vertex_shader)
@@ -197,6 +412,16 @@ GLuint Program::create_shader_helper(GLint type, const std::string &shader_strin
   glShaderSource(id, 1, &shader_string_const, NULL);
   glCompileShader(id);
 
+  if (!check_shader(id, type, shader_string))
+    return (GLuint) 0;
+  check_gl_error();
+
+  return id;
+}
+
+bool Program::check_shader(GLuint id, GLint type, const std::string &shader_string)
+{
+  using namespace std;
   GLint status;
   glGetShaderiv(id, GL_COMPILE_STATUS, &status);
 
@@ -212,15 +437,195 @@ GLuint Program::create_shader_helper(GLint type, const std::string &shader_strin
     cerr << shader_string << endl << endl;
     glGetShaderInfoLog(id, 512, NULL, buffer);
     cerr << "Error: " << endl << buffer << endl;
-    return (GLuint) 0;
+    return false;
   }
-  check_gl_error();
+  return true;
+}
 
-  return id;
+bool has_gl_extension(const std::string &name)
+{
+  if (GLCapture::backend != GLCapture::NATIVE_BACKEND)
+    return false;
+  GLint count = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+  for (GLint i = 0; i < count; i++)
+  {
+    const GLubyte *extension = glGetStringi(GL_EXTENSIONS, (GLuint) i);
+    if (extension && name == (const char *) extension)
+      return true;
+  }
+  return false;
+}
+
+bool GpuTimer::init()
+{
+#ifdef __APPLE__
+  available = true;
+#else
+  available = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+#endif
+  if (available)
+  {
+    glGenQueries(QUERIES, queries);
+    check_gl_error();
+  }
+  return available;
+}
+
+void GpuTimer::begin()
+{
+  timing = available && begun - read < QUERIES;
+  if (timing)
+    glBeginQuery(GL_TIME_ELAPSED, queries[begun % QUERIES]);
+}
+
+void GpuTimer::end()
+{
+  if (!timing)
+    return;
+  glEndQuery(GL_TIME_ELAPSED);
+  begun++;
+  timing = false;
+}
+
+bool GpuTimer::result(double &ms)
+{
+  if (read == begun)
+    return false;
+  GLuint query = queries[read % QUERIES];
+  GLint ready = 0;
+  glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &ready);
+  if (!ready)
+    return false;
+  GLuint64 nanoseconds = 0;
+  glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+  read++;
+  ms = nanoseconds / 1e6;
+  return true;
+}
+
+void GpuTimer::free()
+{
+  if (available)
+    glDeleteQueries(QUERIES, queries);
+  available = false;
+  begun = read = 0;
+}
+
+static GLErrorReporting error_reporting = GL_ERRORS_POLL;
+
+// Last checked location, printed by the debug callback to locate a message.
+// Only meaningful with synchronous output and the checks compiled in.
+static const char *last_check_file = "(no check yet)";
+static int last_check_line = 0;
+static bool report_check_location = false;
+
+#ifndef __APPLE__
+static const char *gl_debug_severity_name(GLenum severity)
+{
+  switch (severity)
+  {
+    case GL_DEBUG_SEVERITY_HIGH:         return "HIGH";
+    case GL_DEBUG_SEVERITY_MEDIUM:       return "MEDIUM";
+    case GL_DEBUG_SEVERITY_LOW:          return "LOW";
+    case GL_DEBUG_SEVERITY_NOTIFICATION: return "NOTIFICATION";
+  }
+  return "UNKNOWN";
+}
+
+static const char *gl_debug_source_name(GLenum source)
+{
+  switch (source)
+  {
+    case GL_DEBUG_SOURCE_API:             return "api";
+    case GL_DEBUG_SOURCE_WINDOW_SYSTEM:   return "window system";
+    case GL_DEBUG_SOURCE_SHADER_COMPILER: return "shader compiler";
+    case GL_DEBUG_SOURCE_THIRD_PARTY:     return "third party";
+    case GL_DEBUG_SOURCE_APPLICATION:     return "application";
+  }
+  return "other";
+}
+
+static const char *gl_debug_type_name(GLenum type)
+{
+  switch (type)
+  {
+    case GL_DEBUG_TYPE_ERROR:               return "error";
+    case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR: return "deprecated";
+    case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR:  return "undefined behavior";
+    case GL_DEBUG_TYPE_PORTABILITY:         return "portability";
+    case GL_DEBUG_TYPE_PERFORMANCE:         return "performance";
+  }
+  return "other";
+}
+
+static void GLAPIENTRY gl_debug_callback(GLenum source, GLenum type, GLuint id, GLenum severity,
+  GLsizei /*length*/, const GLchar *message, const void * /*user_param*/)
+{
+  std::cerr << "GL_DEBUG [" << gl_debug_severity_name(severity) << "] " << gl_debug_source_name(source)
+            << " " << gl_debug_type_name(type) << " " << id << ": " << message;
+  if (report_check_location)
+    std::cerr << " - after " << last_check_file << ":" << last_check_line;
+  std::cerr << std::endl;
+}
+#endif
+
+bool enable_gl_debug_output(const std::string &min_severity, bool synchronous)
+{
+#ifdef __APPLE__
+  std::cerr << "KHR_debug is not available, keeping glGetError checks" << std::endl;
+  return false;
+#else
+  if (!GLEW_KHR_debug && !GLEW_VERSION_4_3)
+  {
+    std::cerr << "KHR_debug is not available, keeping glGetError checks" << std::endl;
+    return false;
+  }
+
+  // Severities are listed from the most to the least important
+  const GLenum severities[] = {GL_DEBUG_SEVERITY_HIGH, GL_DEBUG_SEVERITY_MEDIUM,
+    GL_DEBUG_SEVERITY_LOW, GL_DEBUG_SEVERITY_NOTIFICATION};
+  const char *names[] = {"high", "medium", "low", "notification"};
+  int threshold = 1;
+  for (int i = 0; i < 4; i++)
+    if (min_severity == names[i])
+      threshold = i;
+
+  glEnable(GL_DEBUG_OUTPUT);
+  if (synchronous)
+    glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+  else
+    glDisable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+  // Asynchronous messages arrive long after the checked call before them
+  report_check_location = synchronous && GL_ERROR_CHECKS;
+  glDebugMessageCallback(gl_debug_callback, NULL);
+  for (int i = 0; i < 4; i++)
+    glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, severities[i], 0, NULL, i <= threshold ? GL_TRUE : GL_FALSE);
+
+  // Errors raised before the callback existed are still in the queue
+  while (glGetError() != GL_NO_ERROR) {}
+  error_reporting = GL_ERRORS_DEBUG_CALLBACK;
+  return true;
+#endif
+}
+
+GLErrorReporting gl_error_reporting()
+{
+  return error_reporting;
 }
 
 void _check_gl_error(const char *file, int line)
 {
+  if (GLCapture::backend == GLCapture::NULL_BACKEND)
+    return;
+
+  if (error_reporting == GL_ERRORS_DEBUG_CALLBACK)
+  {
+    last_check_file = file;
+    last_check_line = line;
+    return;
+  }
+
   GLenum err (glGetError());
 
   while(err!=GL_NO_ERROR)
@@ -1,6 +1,9 @@
 #ifndef SHADER_H
 #define SHADER_H
 
+// Must come before Eigen to count its heap allocations
+#include "AllocTracker.h"
+
 #include <string>
 #include <vector>
 #include <Eigen/Core>
@@ -53,8 +56,10 @@ public:
     GLuint id;
     GLuint rows;
     GLuint cols;
+    // Size of the GPU allocation
+    size_t bytes;
 
-    VertexBufferObject() : id(0), rows(0), cols(0) {}
+    VertexBufferObject() : id(0), rows(0), cols(0), bytes(0) {}
 
     // Create a new empty VBO
     void init();
@@ -62,6 +67,22 @@ public:
     // Updates the VBO with a matrix M
     void update(const Eigen::MatrixXf& M);
 
+    // Updates the VBO with a column-major rows x cols float matrix
+    void update(const float *data, GLuint rows, GLuint cols);
+
+    // Overwrite cols columns starting at column first, keeping the others.
+    // The buffer grows geometrically on the GPU when needed, which replaces
+    // its id: returns true in that case, attributes must then be bound again.
+    bool updateRange(const float *data, GLuint rows, GLuint first, GLuint cols);
+
+    // Copy cols columns from column from to column to on the GPU, the two
+    // ranges must not overlap
+    void copyRange(GLuint from, GLuint to, GLuint cols);
+
+    // Reallocate the buffer with room for capacity columns, keeping the
+    // first min(cols, capacity) ones. The id changes like in updateRange.
+    void reallocate(GLuint capacity);
+
     // Select this VBO for subsequent draw calls
     void bind();
 
@@ -77,14 +98,23 @@ public:
     
     GLuint id;
     GLuint size;
+    // Size of the GPU allocation
+    size_t bytes;
     
-    IndexBufferObject() : id(0), size(0) {}
+    IndexBufferObject() : id(0), size(0), bytes(0) {}
     
     // Create a new empty VBO
     void init();
     
     // Updates the VBO with a matrix M
-    void update(std::vector<unsigned int> I);
+    void update(const std::vector<unsigned int> &I);
+
+    // Overwrite count indices starting at first, growing like VertexBufferObject::updateRange
+    bool updateRange(const unsigned int *data, GLuint first, GLuint count);
+
+    // Same as VertexBufferObject::copyRange and reallocate, in indices
+    void copyRange(GLuint from, GLuint to, GLuint count);
+    void reallocate(GLuint capacity);
     
     // Select this VBO for subsequent draw calls
     void bind();
@@ -103,13 +133,44 @@ public:
   GLuint vertex_shader;
   GLuint fragment_shader;
   GLuint program_shader;
+  // Ask the driver to keep the linked binary for getBinary (ARB_get_program_binary)
+  bool retrievable;
 
-  Program() : vertex_shader(0), fragment_shader(0), program_shader(0) { }
+  Program() : vertex_shader(0), fragment_shader(0), program_shader(0), retrievable(false) { }
 
-  // Create a new shader from the specified source strings
+  // Create a new shader from the specified source strings. The attributes
+  // listed in attribute_names get the locations 0, 1, ... in that order.
   bool init(const std::string &vertex_shader_string,
   const std::string &fragment_shader_string,
-  const std::string &fragment_data_name);
+  const std::string &fragment_data_name,
+  const std::vector<std::string> &attribute_names = std::vector<std::string>());
+
+  // init in two steps: start only queues the compilation and the link,
+  // finish waits for them and reports the errors. With
+  // KHR_parallel_shader_compile the driver builds several programs between
+  // the two calls. finish takes the same arguments as start.
+  void start(const std::string &vertex_shader_string,
+  const std::string &fragment_shader_string,
+  const std::string &fragment_data_name,
+  const std::vector<std::string> &attribute_names);
+  bool finish(const std::string &vertex_shader_string,
+  const std::string &fragment_shader_string,
+  const std::string &fragment_data_name,
+  const std::vector<std::string> &attribute_names);
+
+  // Program from a binary returned by getBinary, false if the driver rejects
+  // it (another driver or version). The sources are only recorded for captures.
+  bool loadBinary(GLenum format, const std::vector<char> &binary,
+  const std::string &vertex_shader_string,
+  const std::string &fragment_shader_string,
+  const std::string &fragment_data_name,
+  const std::vector<std::string> &attribute_names);
+
+  // Binary of the linked program, false if the driver does not provide one
+  bool getBinary(GLenum &format, std::vector<char> &binary) const;
+
+  // Whether the context can save and load program binaries
+  static bool binariesSupported();
 
   // Select this shader for subsequent draw calls
   void bind();
@@ -131,16 +192,85 @@ public:
 
   GLuint create_shader_helper(GLint type, const std::string &shader_string);
 
+  // Print the log of a shader that failed to compile, false in that case
+  static bool check_shader(GLuint id, GLint type, const std::string &shader_string);
+
+};
+
+// GPU time of the commands between begin() and end(), from GL_TIME_ELAPSED
+// queries (GL 3.3 or ARB_timer_query). Results are read a few frames later
+// so that measuring does not wait for the GPU.
+class GpuTimer
+{
+public:
+  static const unsigned int QUERIES = 4;
+
+  GLuint queries[QUERIES];
+  // Queries begun and read so far, the ones in between are in flight
+  unsigned int begun;
+  unsigned int read;
+  bool available;
+  // Whether the current begin() got a query, all of them can be in flight
+  bool timing;
+
+  GpuTimer() : begun(0), read(0), available(false), timing(false) { }
+
+  // Create the queries, returns false when the context cannot time the GPU
+  bool init();
+
+  void begin();
+  void end();
+
+  // Oldest finished measurement in milliseconds, false when none is ready
+  bool result(double &ms);
+
+  // Release the queries
+  void free();
+};
+
+// How OpenGL errors are reported at runtime
+enum GLErrorReporting
+{
+  // glGetError after every checked call, a synchronous round-trip (default)
+  GL_ERRORS_POLL,
+  // KHR_debug message callback, checked calls only remember their location
+  GL_ERRORS_DEBUG_CALLBACK
 };
 
+// Replace glGetError polling with a KHR_debug message callback reporting
+// messages of at least min_severity ("high", "medium", "low" or "notification").
+// With synchronous output the message is delivered inside the offending call,
+// and builds with GL_ERROR_CHECKS also print the last checked location.
+// Returns false, keeping the polling, when the context has no KHR_debug.
+bool enable_gl_debug_output(const std::string &min_severity, bool synchronous);
+
+GLErrorReporting gl_error_reporting();
+
+// Whether the context lists an extension, including the ones GLEW does not know
+bool has_gl_extension(const std::string &name);
+
 // From: https://blog.nobel-joergensen.com/2013/01/29/debugging-opengl-using-glgeterror/
 void _check_gl_error(const char *file, int line);
 
+// Per-call checks are compiled out of release builds unless GL_ERROR_CHECKS
+// is defined to 1; the debug callback still works there.
+#ifndef GL_ERROR_CHECKS
+#  ifdef NDEBUG
+#    define GL_ERROR_CHECKS 0
+#  else
+#    define GL_ERROR_CHECKS 1
+#  endif
+#endif
+
 ///
 /// Usage
 /// [... some opengl calls]
 /// glCheckError();
 ///
-#define check_gl_error() _check_gl_error(__FILE__,__LINE__)
+#if GL_ERROR_CHECKS
+#  define check_gl_error() _check_gl_error(__FILE__,__LINE__)
+#else
+#  define check_gl_error() ((void) 0)
+#endif
 
 #endif
@@ -0,0 +1,161 @@
+#include "IdPicker.h"
+#include "GLCapture.h"
+#include "MemoryStats.h"
+
+#include <iostream>
+
+// Longest single wait for a result that is waited for
+static const GLuint64 FENCE_TIMEOUT_NS = 1000000000ULL;
+
+// R32UI ids and a 24 bit depth, padded to 32 bits
+static const size_t BYTES_PER_PIXEL = 8;
+
+IdPicker::IdPicker()
+    : region(16), passes(0), results(0), latencyFrames(0), waits(0),
+      framebuffer(0), ids(0), depth(0), pixels(0), fence(0), width(0), height(0), targetWidth(0), targetHeight(0),
+      requested(false), x(0), y(0), tag(0), reading(false), readingTag(0), frame(0), requestFrame(0), readingFrame(0)
+{
+}
+
+bool IdPicker::supported()
+{
+    return GLCapture::backend == GLCapture::NATIVE_BACKEND;
+}
+
+void IdPicker::resize(int width, int height)
+{
+    targetWidth = width;
+    targetHeight = height;
+}
+
+void IdPicker::request(int x, int y, int tag)
+{
+    // Nothing to pick outside of the window
+    if (!supported() || x < 0 || y < 0 || x >= targetWidth || y >= targetHeight)
+        return;
+    requested = true;
+    this->x = x;
+    this->y = y;
+    this->tag = tag;
+    requestFrame = frame;
+}
+
+bool IdPicker::pending() const
+{
+    return requested && !reading && !GLCapture::capturing();
+}
+
+void IdPicker::begin()
+{
+    if (width != targetWidth || height != targetHeight)
+        allocate();
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    if (region > 0)
+    {
+        glEnable(GL_SCISSOR_TEST);
+        glScissor(x - region / 2, y - region / 2, region, region);
+    }
+    // The clears are scissored as well
+    const GLuint background[4] = {0, 0, 0, 0};
+    const GLfloat farthest = 1.0f;
+    glClearBufferuiv(GL_COLOR, 0, background);
+    glClearBufferfv(GL_DEPTH, 0, &farthest);
+    check_gl_error();
+}
+
+void IdPicker::end()
+{
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pixels);
+    // Into the buffer, the call returns without waiting for the draws
+    glReadPixels(x, y, 1, 1, GL_RED_INTEGER, GL_UNSIGNED_INT, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glDisable(GL_SCISSOR_TEST);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    check_gl_error();
+    requested = false;
+    reading = true;
+    readingTag = tag;
+    readingFrame = requestFrame;
+    passes++;
+}
+
+bool IdPicker::poll(bool wait, GLuint &id, int &tag)
+{
+    if (!reading)
+        return false;
+    if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+    {
+        if (!wait)
+            return false;
+        GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+        while (glClientWaitSync(fence, flags, FENCE_TIMEOUT_NS) == GL_TIMEOUT_EXPIRED)
+            flags = 0;
+        waits++;
+    }
+    glDeleteSync(fence);
+    fence = 0;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pixels);
+    const GLuint *value = static_cast<const GLuint *>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, sizeof(GLuint), GL_MAP_READ_BIT));
+    id = value ? *value : 0;
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    check_gl_error();
+    tag = readingTag;
+    reading = false;
+    results++;
+    latencyFrames += frame - readingFrame;
+    return true;
+}
+
+void IdPicker::endFrame()
+{
+    frame++;
+}
+
+void IdPicker::free()
+{
+    if (fence)
+        glDeleteSync(fence);
+    fence = 0;
+    reading = false;
+    if (!framebuffer)
+        return;
+    glDeleteFramebuffers(1, &framebuffer);
+    glDeleteRenderbuffers(1, &ids);
+    glDeleteRenderbuffers(1, &depth);
+    glDeleteBuffers(1, &pixels);
+    framebuffer = ids = depth = pixels = 0;
+    memoryStats.resize(GPU_RENDER_TARGETS, BYTES_PER_PIXEL * width * height, 0);
+    width = height = 0;
+}
+
+void IdPicker::allocate()
+{
+    if (!framebuffer)
+    {
+        glGenFramebuffers(1, &framebuffer);
+        glGenRenderbuffers(1, &ids);
+        glGenRenderbuffers(1, &depth);
+        glGenBuffers(1, &pixels);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pixels);
+        glBufferData(GL_PIXEL_PACK_BUFFER, sizeof(GLuint), NULL, GL_STREAM_READ);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+    memoryStats.resize(GPU_RENDER_TARGETS, BYTES_PER_PIXEL * width * height, BYTES_PER_PIXEL * targetWidth * targetHeight);
+    width = targetWidth;
+    height = targetHeight;
+    glBindRenderbuffer(GL_RENDERBUFFER, ids);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_R32UI, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, ids);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cerr << "The picking target is incomplete" << std::endl;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    check_gl_error();
+}
@@ -0,0 +1,90 @@
+#ifndef ID_PICKER_H
+#define ID_PICKER_H
+
+#include "Helpers.h"
+
+#include <cstddef>
+
+// Picking through an id pass: on the frames a pick was requested, the
+// instance ids are drawn into an R32UI target, scissored to a small square
+// around the cursor. The pixel under the cursor is copied into a pixel
+// buffer object behind a fence and read once the GPU is done with it, a
+// frame or more later, so the render loop never waits for the readback.
+//
+// The target and the readback use raw OpenGL: they only exist on the
+// native backend, and no pass is drawn while a GL capture is recorded.
+class IdPicker
+{
+public:
+    // Side in pixels of the square the pass is scissored to, 0 for the
+    // whole window
+    int region;
+
+    // Passes drawn, results read, and frames from the requests to their results
+    size_t passes;
+    size_t results;
+    size_t latencyFrames;
+    // Results that had to be waited for
+    size_t waits;
+
+    IdPicker();
+
+    // Whether picking works with the current backend
+    static bool supported();
+
+    // Size of the target, the storage follows on the next pass
+    void resize(int width, int height);
+
+    // Ask for the id at (x, y), in pixels from the bottom left corner. A
+    // newer request replaces one that was not drawn yet. tag comes back
+    // with the result.
+    void request(int x, int y, int tag);
+
+    // Whether the id pass has to be drawn this frame
+    bool pending() const;
+
+    // Bind and clear the target around the request. The caller then draws
+    // the ids as unsigned values, 0 is the background.
+    void begin();
+
+    // Queue the readback of the requested pixel and bind the default
+    // framebuffer again
+    void end();
+
+    // The id read back and the tag of its request, true once they are
+    // there. wait blocks until the GPU is done, to keep replays
+    // deterministic.
+    bool poll(bool wait, GLuint &id, int &tag);
+
+    // Count the frames a readback takes
+    void endFrame();
+
+    void free();
+
+private:
+    GLuint framebuffer;
+    GLuint ids;
+    GLuint depth;
+    GLuint pixels;
+    GLsync fence;
+    // Size of the storage, and the one asked for
+    int width;
+    int height;
+    int targetWidth;
+    int targetHeight;
+
+    bool requested;
+    int x;
+    int y;
+    int tag;
+    // The readback in flight
+    bool reading;
+    int readingTag;
+    size_t frame;
+    size_t requestFrame;
+    size_t readingFrame;
+
+    void allocate();
+};
+
+#endif
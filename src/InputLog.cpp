@@ -0,0 +1,193 @@
+#include "InputLog.h"
+
+#include <iostream>
+
+static const char INPUT_LOG_MAGIC[4] = {'S', 'E', 'I', 'L'};
+static const uint32_t INPUT_LOG_VERSION = 2;
+
+template <typename T>
+static void writeValue(FILE *file, T value)
+{
+    fwrite(&value, sizeof(T), 1, file);
+}
+
+template <typename T>
+static bool readValue(FILE *file, T &value)
+{
+    return fread(&value, sizeof(T), 1, file) == 1;
+}
+
+bool InputRecorder::open(const std::string &path, const InputLogHeader &header)
+{
+    file = fopen(path.c_str(), "wb");
+    if (!file)
+    {
+        std::cerr << "Could not create input log " << path << std::endl;
+        return false;
+    }
+    fwrite(INPUT_LOG_MAGIC, 1, 4, file);
+    writeValue<uint32_t>(file, INPUT_LOG_VERSION);
+    writeValue<uint32_t>(file, header.seed);
+    writeValue<int32_t>(file, header.width);
+    writeValue<int32_t>(file, header.height);
+    frame = 0;
+    events = 0;
+    return true;
+}
+
+void InputRecorder::beginEvent(double time, InputEventType type)
+{
+    writeValue<uint32_t>(file, frame);
+    writeValue<float>(file, (float) time);
+    writeValue<uint8_t>(file, (uint8_t) type);
+    events++;
+}
+
+void InputRecorder::key(double time, int key, int scancode, int action, int mods)
+{
+    if (!file)
+        return;
+    beginEvent(time, KEY_EVENT);
+    writeValue<int16_t>(file, (int16_t) key);
+    writeValue<int32_t>(file, (int32_t) scancode);
+    writeValue<uint8_t>(file, (uint8_t) action);
+    writeValue<uint8_t>(file, (uint8_t) mods);
+}
+
+void InputRecorder::mouseButton(double time, int button, int action, int mods)
+{
+    if (!file)
+        return;
+    beginEvent(time, MOUSE_BUTTON_EVENT);
+    writeValue<uint8_t>(file, (uint8_t) button);
+    writeValue<uint8_t>(file, (uint8_t) action);
+    writeValue<uint8_t>(file, (uint8_t) mods);
+}
+
+void InputRecorder::cursorPosition(double time, double x, double y)
+{
+    if (!file)
+        return;
+    beginEvent(time, CURSOR_POSITION_EVENT);
+    writeValue<double>(file, x);
+    writeValue<double>(file, y);
+}
+
+void InputRecorder::windowSize(double time, int width, int height)
+{
+    if (!file)
+        return;
+    beginEvent(time, WINDOW_SIZE_EVENT);
+    writeValue<int32_t>(file, (int32_t) width);
+    writeValue<int32_t>(file, (int32_t) height);
+}
+
+void InputRecorder::pick(double time, unsigned int id, int tag)
+{
+    if (!file)
+        return;
+    beginEvent(time, PICK_EVENT);
+    writeValue<uint32_t>(file, (uint32_t) id);
+    writeValue<uint8_t>(file, (uint8_t) tag);
+}
+
+void InputRecorder::close()
+{
+    if (file)
+    {
+        fclose(file);
+        file = NULL;
+    }
+}
+
+bool InputPlayer::load(const std::string &path)
+{
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file)
+    {
+        std::cerr << "Could not open input log " << path << std::endl;
+        return false;
+    }
+
+    char magic[4];
+    version = 0;
+    if (fread(magic, 1, 4, file) != 4 || std::string(magic, 4) != std::string(INPUT_LOG_MAGIC, 4)
+        || !readValue(file, version) || version < 1 || version > INPUT_LOG_VERSION
+        || !readValue(file, header.seed) || !readValue(file, header.width) || !readValue(file, header.height))
+    {
+        std::cerr << "Not an input log: " << path << std::endl;
+        fclose(file);
+        return false;
+    }
+
+    events.clear();
+    next = 0;
+    while (true)
+    {
+        InputEvent event;
+        float time;
+        uint8_t type;
+        if (!readValue(file, event.frame) || !readValue(file, time) || !readValue(file, type))
+            break;
+        event.time = time;
+        event.type = (InputEventType) type;
+
+        bool complete = true;
+        switch (event.type)
+        {
+            case KEY_EVENT:
+            {
+                int16_t key;
+                uint8_t action, mods;
+                complete = readValue(file, key) && readValue(file, event.b) && readValue(file, action) && readValue(file, mods);
+                event.a = key;
+                event.c = action;
+                event.d = mods;
+                break;
+            }
+            case MOUSE_BUTTON_EVENT:
+            {
+                uint8_t button, action, mods;
+                complete = readValue(file, button) && readValue(file, action) && readValue(file, mods);
+                event.a = button;
+                event.c = action;
+                event.d = mods;
+                break;
+            }
+            case CURSOR_POSITION_EVENT:
+                complete = readValue(file, event.x) && readValue(file, event.y);
+                break;
+            case WINDOW_SIZE_EVENT:
+                complete = readValue(file, event.a) && readValue(file, event.b);
+                break;
+            case PICK_EVENT:
+            {
+                uint32_t id;
+                uint8_t tag;
+                complete = readValue(file, id) && readValue(file, tag);
+                event.a = (int32_t) id;
+                event.c = tag;
+                break;
+            }
+            default:
+                complete = false;
+                break;
+        }
+        if (!complete)
+        {
+            std::cerr << "Input log truncated after " << events.size() << " events" << std::endl;
+            break;
+        }
+        events.push_back(event);
+    }
+    fclose(file);
+    return true;
+}
+
+bool InputPlayer::poll(uint32_t frame, InputEvent &event)
+{
+    if (next >= events.size() || events[next].frame > frame)
+        return false;
+    event = events[next++];
+    return true;
+}
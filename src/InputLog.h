@@ -0,0 +1,113 @@
+#ifndef INPUT_LOG_H
+#define INPUT_LOG_H
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+
+// Kind of GLFW callback an event was captured from, or the pick result
+// that was applied
+enum InputEventType
+{
+    KEY_EVENT = 0,
+    MOUSE_BUTTON_EVENT = 1,
+    CURSOR_POSITION_EVENT = 2,
+    WINDOW_SIZE_EVENT = 3,
+    PICK_EVENT = 4
+};
+
+// One recorded callback invocation. Only the fields of its type are meaningful:
+//   KEY_EVENT             a = key, b = scancode, c = action, d = mods
+//   MOUSE_BUTTON_EVENT    a = button, c = action, d = mods
+//   CURSOR_POSITION_EVENT x, y
+//   WINDOW_SIZE_EVENT     a = width, b = height
+//   PICK_EVENT            a = id read back, c = tag of the request
+class InputEvent
+{
+public:
+    uint32_t frame;
+    double time;
+    InputEventType type;
+    int32_t a;
+    int32_t b;
+    int32_t c;
+    int32_t d;
+    double x;
+    double y;
+
+    InputEvent() : frame(0), time(0.0), type(KEY_EVENT), a(0), b(0), c(0), d(0), x(0.0), y(0.0) {}
+};
+
+// Values needed to start a replay in the same state as the recording
+class InputLogHeader
+{
+public:
+    uint32_t seed;
+    int32_t width;
+    int32_t height;
+
+    InputLogHeader() : seed(1), width(0), height(0) {}
+};
+
+// Writes callbacks to a compact binary log.
+// Layout: "SEIL", u32 version, header, then one record per event made of
+// u32 frame, f32 seconds since start, u8 type and a type dependent payload.
+// Values are stored in the native (little endian) byte order. Version 1
+// logs have no pick events.
+class InputRecorder
+{
+public:
+    FILE *file;
+    uint32_t frame;
+    unsigned int events;
+
+    InputRecorder() : file(NULL), frame(0), events(0) {}
+
+    // Create the log and write its header
+    bool open(const std::string &path, const InputLogHeader &header);
+
+    // Frame index stored with subsequent events
+    void setFrame(uint32_t current) { frame = current; }
+
+    void key(double time, int key, int scancode, int action, int mods);
+    void mouseButton(double time, int button, int action, int mods);
+    void cursorPosition(double time, double x, double y);
+    void windowSize(double time, int width, int height);
+    // The id pass result applied on the current frame, whenever the GPU
+    // delivered it
+    void pick(double time, unsigned int id, int tag);
+
+    bool active() const { return file != NULL; }
+
+    // Flush and close the log
+    void close();
+
+private:
+    void beginEvent(double time, InputEventType type);
+};
+
+// Reads a log back and hands out the events in recorded order
+class InputPlayer
+{
+public:
+    InputLogHeader header;
+    uint32_t version;
+    std::vector<InputEvent> events;
+    size_t next;
+
+    InputPlayer() : version(0), next(0) {}
+
+    // Read the whole log in memory
+    bool load(const std::string &path);
+
+    // Pop the next event recorded on or before the given frame
+    bool poll(uint32_t frame, InputEvent &event);
+
+    bool finished() const { return next >= events.size(); }
+
+    // Whether the log gives the frames the pick results were applied on
+    bool logsPicks() const { return version >= 2; }
+};
+
+#endif
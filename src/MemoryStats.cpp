@@ -0,0 +1,112 @@
+#include "MemoryStats.h"
+
+#include <iomanip>
+
+MemoryStats memoryStats;
+
+static const char *categoryNames[MEMORY_CATEGORY_COUNT] = {
+    "vbo", "ibo", "ubo", "targets", "positions", "normals", "barycenters", "indices", "instances"
+};
+
+static double mebibytes(size_t bytes)
+{
+    return bytes / (1024.0 * 1024.0);
+}
+
+MemoryStats::MemoryStats()
+    : uploadedThisFrame(0), uploadedLastFrame(0), uploadedPeakFrame(0), uploadedTotal(0),
+      gpuBudget(0), cpuBudget(0), gpuPeak(0), cpuPeak(0)
+{
+    for (int i = 0; i < MEMORY_CATEGORY_COUNT; i++)
+    {
+        current[i] = 0;
+        highWater[i] = 0;
+    }
+}
+
+void MemoryStats::set(MemoryCategory category, size_t bytes)
+{
+    current[category] = bytes;
+    if (bytes > highWater[category])
+        highWater[category] = bytes;
+    updatePeaks();
+}
+
+void MemoryStats::resize(MemoryCategory category, size_t old_bytes, size_t new_bytes)
+{
+    size_t bytes = current[category] >= old_bytes ? current[category] - old_bytes : 0;
+    set(category, bytes + new_bytes);
+}
+
+void MemoryStats::uploaded(size_t bytes)
+{
+    uploadedThisFrame += bytes;
+    uploadedTotal += bytes;
+}
+
+void MemoryStats::endFrame()
+{
+    uploadedLastFrame = uploadedThisFrame;
+    if (uploadedThisFrame > uploadedPeakFrame)
+        uploadedPeakFrame = uploadedThisFrame;
+    uploadedThisFrame = 0;
+}
+
+size_t MemoryStats::gpuTotal() const
+{
+    return current[GPU_VERTEX_BUFFERS] + current[GPU_INDEX_BUFFERS] + current[GPU_UNIFORM_BUFFERS] + current[GPU_RENDER_TARGETS];
+}
+
+size_t MemoryStats::cpuTotal() const
+{
+    size_t total = 0;
+    for (int i = CPU_POSITIONS; i < MEMORY_CATEGORY_COUNT; i++)
+        total += current[i];
+    return total;
+}
+
+size_t MemoryStats::gpuHighWater() const
+{
+    return gpuPeak;
+}
+
+size_t MemoryStats::cpuHighWater() const
+{
+    return cpuPeak;
+}
+
+bool MemoryStats::overBudget() const
+{
+    return (gpuBudget > 0 && gpuTotal() > gpuBudget) || (cpuBudget > 0 && cpuTotal() > cpuBudget);
+}
+
+const char *MemoryStats::name(MemoryCategory category)
+{
+    return categoryNames[category];
+}
+
+void MemoryStats::updatePeaks()
+{
+    if (gpuTotal() > gpuPeak)
+        gpuPeak = gpuTotal();
+    if (cpuTotal() > cpuPeak)
+        cpuPeak = cpuTotal();
+}
+
+void MemoryStats::log(std::ostream &out) const
+{
+    std::ios::fmtflags flags = out.flags();
+    out << std::fixed << std::setprecision(2);
+    out << "memory: gpu " << mebibytes(gpuTotal()) << " MiB (peak " << mebibytes(gpuPeak) << ") [";
+    for (int i = GPU_VERTEX_BUFFERS; i <= GPU_RENDER_TARGETS; i++)
+        out << (i > GPU_VERTEX_BUFFERS ? " " : "") << categoryNames[i] << " " << mebibytes(current[i]);
+    out << "] cpu " << mebibytes(cpuTotal()) << " MiB (peak " << mebibytes(cpuPeak) << ") [";
+    for (int i = CPU_POSITIONS; i < MEMORY_CATEGORY_COUNT; i++)
+        out << (i > CPU_POSITIONS ? " " : "") << categoryNames[i] << " " << mebibytes(current[i]);
+    out << "] uploaded " << mebibytes(uploadedLastFrame) << " MiB/frame (peak " << mebibytes(uploadedPeakFrame)
+        << ", total " << mebibytes(uploadedTotal) << ")";
+    if (gpuBudget > 0 || cpuBudget > 0)
+        out << " budget gpu " << mebibytes(gpuBudget) << " cpu " << mebibytes(cpuBudget) << (overBudget() ? " EXCEEDED" : "");
+    out << std::endl;
+    out.flags(flags);
+}
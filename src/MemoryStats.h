@@ -0,0 +1,77 @@
+#ifndef MEMORY_STATS_H
+#define MEMORY_STATS_H
+
+#include <cstddef>
+#include <string>
+#include <ostream>
+
+// Where accounted bytes live
+enum MemoryCategory
+{
+    GPU_VERTEX_BUFFERS,
+    GPU_INDEX_BUFFERS,
+    GPU_UNIFORM_BUFFERS,
+    GPU_RENDER_TARGETS,
+    CPU_POSITIONS,
+    CPU_NORMALS,
+    CPU_BARYCENTERS,
+    CPU_INDICES,
+    CPU_INSTANCES,
+    MEMORY_CATEGORY_COUNT
+};
+
+// Byte counters per category with high-water marks, upload traffic per frame
+// and optional budgets for the GPU and CPU totals
+class MemoryStats
+{
+public:
+    size_t current[MEMORY_CATEGORY_COUNT];
+    size_t highWater[MEMORY_CATEGORY_COUNT];
+
+    size_t uploadedThisFrame;
+    size_t uploadedLastFrame;
+    size_t uploadedPeakFrame;
+    size_t uploadedTotal;
+
+    // 0 means no budget
+    size_t gpuBudget;
+    size_t cpuBudget;
+
+    MemoryStats();
+
+    // Replace the byte count of a category
+    void set(MemoryCategory category, size_t bytes);
+
+    // A buffer of a category was (re)allocated from old_bytes to new_bytes
+    void resize(MemoryCategory category, size_t old_bytes, size_t new_bytes);
+
+    // Bytes sent to the GPU
+    void uploaded(size_t bytes);
+
+    // Close the upload counter of the current frame
+    void endFrame();
+
+    size_t gpuTotal() const;
+    size_t cpuTotal() const;
+    size_t gpuHighWater() const;
+    size_t cpuHighWater() const;
+
+    // True if a total is above its budget
+    bool overBudget() const;
+
+    static const char *name(MemoryCategory category);
+
+    // Write a one line summary
+    void log(std::ostream &out) const;
+
+private:
+    size_t gpuPeak;
+    size_t cpuPeak;
+
+    void updatePeaks();
+};
+
+// Accounting shared by the buffer wrappers and the editor
+extern MemoryStats memoryStats;
+
+#endif
@@ -0,0 +1,72 @@
+#include "MultiDraw.h"
+#include "GLCapture.h"
+#include "MemoryStats.h"
+
+#include <cstring>
+#include <vector>
+
+static_assert(sizeof(DrawElementsIndirectCommand) == 20, "DrawElementsIndirectCommand must match the GL layout");
+
+static const char *submitPathNames[SUBMIT_PATH_COUNT] = {"direct", "instanced", "indirect"};
+
+const char *submitPathName(SubmitPath path)
+{
+    return submitPathNames[path];
+}
+
+bool submitPathFromName(const char *text, SubmitPath &path)
+{
+    for (int i = 0; i < SUBMIT_PATH_COUNT; i++)
+    {
+        if (strcmp(text, submitPathNames[i]) == 0)
+        {
+            path = (SubmitPath) i;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool multiDrawIndirectSupported()
+{
+    if (GLCapture::backend == GLCapture::NULL_BACKEND)
+        return true;
+    // Base instances come with GL 4.2, attribute divisors with GL 3.3
+    return GLEW_VERSION_4_3 || (GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance && GLEW_VERSION_3_3);
+}
+
+void DrawIndexArray::init(GLuint location, GLuint count)
+{
+    std::vector<GLuint> indices(count);
+    for (GLuint i = 0; i < count; i++)
+        indices[i] = i;
+    bytes = sizeof(GLuint) * count;
+    GLCapture::genBuffer(&id);
+    GLCapture::bindBuffer(GL_ARRAY_BUFFER, id);
+    GLCapture::bufferData(GL_ARRAY_BUFFER, bytes, indices.data(), GL_STATIC_DRAW);
+    GLCapture::vertexAttribIPointer(location, 1, GL_UNSIGNED_INT, 0, 0);
+    GLCapture::vertexAttribDivisor(location, 1);
+    this->location = location;
+    memoryStats.resize(GPU_VERTEX_BUFFERS, 0, bytes);
+    check_gl_error();
+}
+
+void DrawIndexArray::enable()
+{
+    GLCapture::enableVertexAttribArray(location);
+}
+
+void DrawIndexArray::disable()
+{
+    GLCapture::disableVertexAttribArray(location);
+}
+
+void DrawIndexArray::free()
+{
+    if (!id)
+        return;
+    GLCapture::deleteBuffer(&id);
+    memoryStats.resize(GPU_VERTEX_BUFFERS, bytes, 0);
+    id = 0;
+    bytes = 0;
+}
@@ -0,0 +1,60 @@
+#ifndef MULTI_DRAW_H
+#define MULTI_DRAW_H
+
+#include "Helpers.h"
+
+// How the draws of a frame reach the GPU
+enum SubmitPath
+{
+    // One glDrawElementsBaseVertex per instance, with its stencil id
+    SUBMIT_DIRECT,
+    // One glDrawElementsInstancedBaseVertex per run of instances of a mesh
+    SUBMIT_INSTANCED,
+    // One glMultiDrawElementsIndirect per program and batch of records
+    SUBMIT_INDIRECT,
+    SUBMIT_PATH_COUNT
+};
+
+// Lower case name, also accepted by submitPathFromName
+const char *submitPathName(SubmitPath path);
+bool submitPathFromName(const char *text, SubmitPath &path);
+
+// Whether glMultiDrawElementsIndirect with base instances and instanced
+// attributes can be used. Always true on the null backend.
+bool multiDrawIndirectSupported();
+
+// Layout of the commands read by glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand
+{
+    GLuint count;
+    GLuint instanceCount;
+    // in indices, not bytes
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+// The numbers 0 to count - 1 as an instanced integer attribute. A draw
+// with base instance k reads k, which is how the indirect commands give
+// each draw its record without gl_DrawID.
+class DrawIndexArray
+{
+public:
+    GLuint id;
+    GLuint location;
+    size_t bytes;
+
+    DrawIndexArray() : id(0), location(0), bytes(0) {}
+
+    // Attach to location in the bound vertex array object, disabled
+    void init(GLuint location, GLuint count);
+
+    // While disabled the attribute has the value of glVertexAttribI1ui,
+    // which is how the other paths give the draw index
+    void enable();
+    void disable();
+
+    void free();
+};
+
+#endif
@@ -0,0 +1,143 @@
+#include "Profiling.h"
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cmath>
+
+#if defined(__APPLE__)
+#  include <mach/mach.h>
+#elif defined(_WIN32)
+#  include <windows.h>
+#  include <psapi.h>
+#  pragma comment(lib, "psapi.lib")
+#else
+#  include <unistd.h>
+#  include <fcntl.h>
+#  include <cstdlib>
+#endif
+
+static size_t maxOf(const std::vector<size_t> &samples)
+{
+    return samples.empty() ? 0 : *std::max_element(samples.begin(), samples.end());
+}
+
+static double meanOf(const std::vector<size_t> &samples)
+{
+    double sum = 0.0;
+    for (size_t i = 0; i < samples.size(); i++)
+        sum += samples[i];
+    return samples.empty() ? 0.0 : sum / samples.size();
+}
+
+double elapsedMs(ProfileClock::time_point start, ProfileClock::time_point end)
+{
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+size_t currentResidentMemory()
+{
+#if defined(__APPLE__)
+    mach_task_basic_info info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t) &info, &count) != KERN_SUCCESS)
+        return 0;
+    return (size_t) info.resident_size;
+#elif defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return 0;
+    return (size_t) counters.WorkingSetSize;
+#else
+    // Read with plain system calls, stdio would allocate a buffer per call
+    char buffer[128];
+    int statm = open("/proc/self/statm", O_RDONLY);
+    if (statm < 0)
+        return 0;
+    ssize_t length = read(statm, buffer, sizeof(buffer) - 1);
+    close(statm);
+    if (length <= 0)
+        return 0;
+    buffer[length] = 0;
+    char *next = NULL;
+    strtol(buffer, &next, 10);
+    long resident = strtol(next, NULL, 10);
+    return (size_t) resident * (size_t) sysconf(_SC_PAGESIZE);
+#endif
+}
+
+void FrameStats::reserve(size_t frames)
+{
+    frameMs.reserve(frames);
+    submitMs.reserve(frames);
+    residentBytes.reserve(frames);
+    allocations.reserve(frames);
+    allocatedBytes.reserve(frames);
+}
+
+void FrameStats::record(double frame, double submit, size_t resident, size_t allocationCount, size_t allocationBytes)
+{
+    frameMs.push_back(frame);
+    submitMs.push_back(submit);
+    residentBytes.push_back(resident);
+    allocations.push_back(allocationCount);
+    allocatedBytes.push_back(allocationBytes);
+}
+
+void FrameStats::clear()
+{
+    frameMs.clear();
+    submitMs.clear();
+    residentBytes.clear();
+    allocations.clear();
+    allocatedBytes.clear();
+}
+
+double FrameStats::percentile(std::vector<double> samples, double p)
+{
+    if (samples.empty())
+        return 0.0;
+    std::sort(samples.begin(), samples.end());
+    size_t rank = (size_t) std::ceil(p / 100.0 * samples.size());
+    if (rank > 0)
+        rank = rank - 1;
+    return samples[std::min(rank, samples.size() - 1)];
+}
+
+void FrameStats::print(const std::string &label) const
+{
+    size_t peak = residentBytes.empty() ? 0 : *std::max_element(residentBytes.begin(), residentBytes.end());
+    std::cout << "[" << label << "] frames: " << frameMs.size() << std::endl;
+    std::cout << "  frame  ms p50/p95/p99: " << percentile(frameMs, 50) << " / " << percentile(frameMs, 95) << " / " << percentile(frameMs, 99) << std::endl;
+    std::cout << "  submit ms p50/p95/p99: " << percentile(submitMs, 50) << " / " << percentile(submitMs, 95) << " / " << percentile(submitMs, 99) << std::endl;
+    std::cout << "  resident peak: " << peak / (1024.0 * 1024.0) << " MiB" << std::endl;
+    std::cout << "  heap allocations per frame avg/max: " << meanOf(allocations) << " / " << maxOf(allocations) << " (" << maxOf(allocatedBytes) << " B)" << std::endl;
+}
+
+bool FrameStats::appendCSV(const std::string &path, const std::string &label, unsigned int instances) const
+{
+    bool exists = std::ifstream(path.c_str()).good();
+    std::ofstream file(path.c_str(), std::ios::app);
+    if (!file.is_open())
+    {
+        std::cerr << "Could not open " << path << " for writing" << std::endl;
+        return false;
+    }
+    if (!exists)
+    {
+        file << "label,instances,frames,"
+             << "frame_p50_ms,frame_p95_ms,frame_p99_ms,"
+             << "submit_p50_ms,submit_p95_ms,submit_p99_ms,"
+             << "resident_start_bytes,resident_end_bytes,resident_peak_bytes,"
+             << "frame_allocations_max,frame_allocated_bytes_max" << std::endl;
+    }
+    size_t start = residentBytes.empty() ? 0 : residentBytes.front();
+    size_t end = residentBytes.empty() ? 0 : residentBytes.back();
+    size_t peak = residentBytes.empty() ? 0 : *std::max_element(residentBytes.begin(), residentBytes.end());
+    file << label << "," << instances << "," << frameMs.size() << ","
+         << percentile(frameMs, 50) << "," << percentile(frameMs, 95) << "," << percentile(frameMs, 99) << ","
+         << percentile(submitMs, 50) << "," << percentile(submitMs, 95) << "," << percentile(submitMs, 99) << ","
+         << start << "," << end << "," << peak << ","
+         << maxOf(allocations) << "," << maxOf(allocatedBytes) << std::endl;
+    return true;
+}
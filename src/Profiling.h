@@ -0,0 +1,47 @@
+#ifndef PROFILING_H
+#define PROFILING_H
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstddef>
+
+// Wall clock used for all frame measurements
+typedef std::chrono::high_resolution_clock ProfileClock;
+
+// Milliseconds elapsed between two time points
+double elapsedMs(ProfileClock::time_point start, ProfileClock::time_point end);
+
+// Resident set size of the current process in bytes (0 if unavailable)
+size_t currentResidentMemory();
+
+// Collects per-frame samples and reports percentiles
+class FrameStats
+{
+public:
+    std::vector<double> frameMs;
+    std::vector<double> submitMs;
+    std::vector<size_t> residentBytes;
+    std::vector<size_t> allocations;
+    std::vector<size_t> allocatedBytes;
+
+    // Preallocate storage so that recording does not allocate inside the loop
+    void reserve(size_t frames);
+
+    // Store the samples of one frame
+    void record(double frame, double submit, size_t resident, size_t allocationCount, size_t allocationBytes);
+
+    // Drop all samples
+    void clear();
+
+    // Return the p-th percentile (0-100) of the samples, nearest rank
+    static double percentile(std::vector<double> samples, double p);
+
+    // Print a short summary on stdout
+    void print(const std::string &label) const;
+
+    // Append a summary row to a csv file, writing the header if the file is new
+    bool appendCSV(const std::string &path, const std::string &label, unsigned int instances) const;
+};
+
+#endif
@@ -0,0 +1,72 @@
+#include "RangeAllocator.h"
+
+#include <algorithm>
+
+unsigned int RangeAllocator::carve(size_t index, unsigned int count)
+{
+    Range &range = freeRanges[index];
+    unsigned int offset = range.offset;
+    range.offset += count;
+    range.count -= count;
+    if (range.count == 0)
+        freeRanges.erase(freeRanges.begin() + index);
+    used += count;
+    return offset;
+}
+
+unsigned int RangeAllocator::allocate(unsigned int count)
+{
+    for (size_t i = 0; i < freeRanges.size(); i++)
+    {
+        if (freeRanges[i].count >= count)
+            return carve(i, count);
+    }
+    unsigned int offset = end;
+    end += count;
+    used += count;
+    return offset;
+}
+
+bool RangeAllocator::allocateBelow(unsigned int offset, unsigned int count, unsigned int &target)
+{
+    for (size_t i = 0; i < freeRanges.size() && freeRanges[i].offset + count <= offset; i++)
+    {
+        if (freeRanges[i].count >= count)
+        {
+            target = carve(i, count);
+            return true;
+        }
+    }
+    return false;
+}
+
+void RangeAllocator::release(unsigned int offset, unsigned int count)
+{
+    if (count == 0)
+        return;
+    used -= count;
+    std::vector<Range>::iterator next = std::lower_bound(freeRanges.begin(), freeRanges.end(), offset,
+        [](const Range &range, unsigned int offset) { return range.offset < offset; });
+    std::vector<Range>::iterator merged;
+    if (next != freeRanges.begin() && (next - 1)->offset + (next - 1)->count == offset)
+    {
+        merged = next - 1;
+        merged->count += count;
+    }
+    else
+    {
+        merged = freeRanges.insert(next, Range(offset, count));
+    }
+    std::vector<Range>::iterator after = merged + 1;
+    if (after != freeRanges.end() && merged->offset + merged->count == after->offset)
+    {
+        merged->count += after->count;
+        freeRanges.erase(after);
+    }
+    // A free range at the end is simply not part of the buffer anymore
+    if (freeRanges.back().offset + freeRanges.back().count == end)
+    {
+        end = freeRanges.back().offset;
+        freeRanges.pop_back();
+    }
+}
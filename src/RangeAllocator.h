@@ -0,0 +1,49 @@
+#ifndef RANGE_ALLOCATOR_H
+#define RANGE_ALLOCATOR_H
+
+#include <cstddef>
+#include <vector>
+
+// Hands out [offset, offset + count) ranges of a buffer that grows at the end.
+// Released ranges go to a free list sorted by offset, where neighbours are
+// merged and a range reaching the end shrinks the buffer. Ranges are reused
+// first fit before the buffer grows.
+class RangeAllocator
+{
+public:
+    class Range
+    {
+    public:
+        unsigned int offset;
+        unsigned int count;
+
+        Range(unsigned int offset, unsigned int count) : offset(offset), count(count) {}
+    };
+
+    std::vector<Range> freeRanges;
+    // One past the highest element handed out
+    unsigned int end;
+    // Elements currently handed out
+    unsigned int used;
+
+    RangeAllocator() : end(0), used(0) {}
+
+    // Offset of a new range of count elements
+    unsigned int allocate(unsigned int count);
+
+    // Reserve the first free range that holds count elements and lies
+    // entirely below offset, to move the range at offset there.
+    // Returns false if there is none.
+    bool allocateBelow(unsigned int offset, unsigned int count, unsigned int &target);
+
+    // Give a range back
+    void release(unsigned int offset, unsigned int count);
+
+    // Elements inside [0, end) that are free
+    unsigned int freeCount() const { return end - used; }
+
+private:
+    unsigned int carve(size_t index, unsigned int count);
+};
+
+#endif
@@ -0,0 +1,391 @@
+#include "SceneGraph.h"
+#include "Profiling.h"
+
+#include <iostream>
+#include <algorithm>
+
+const int SceneGraph::NO_NODE;
+
+SceneGraph::SceneGraph()
+    : parallelThreshold(16384), threads(std::max(1u, std::thread::hardware_concurrency())), updatedNodes(0),
+      generation(0), busyWorkers(0), stopping(false)
+{
+}
+
+SceneGraph::~SceneGraph()
+{
+    stopWorkers();
+}
+
+int SceneGraph::create(const Transform &transform, int parentNode)
+{
+    int handle;
+    if (freeHandles.empty())
+    {
+        handle = (int) indexOf.size();
+        indexOf.push_back(NO_NODE);
+        editedFlag.push_back(0);
+    }
+    else
+    {
+        handle = freeHandles.back();
+        freeHandles.pop_back();
+    }
+    int parentIndex = parentNode == NO_NODE ? NO_NODE : indexOf[parentNode];
+    size_t position = parentIndex == NO_NODE ? size() : parentIndex + subtreeSize[parentIndex];
+    insert(position, transform, parentIndex, handle);
+    markEdited(handle);
+    return handle;
+}
+
+void SceneGraph::destroy(int node)
+{
+    int index = indexOf[node];
+    int parentIndex = parent[index];
+    // The children take the place of the node in the depth-first order,
+    // their local transforms absorb the one of the node
+    const AffineMatrix &removed = local[index].world();
+    size_t end = index + subtreeSize[index];
+    for (size_t child = index + 1; child < end; child += subtreeSize[child])
+    {
+        local[child].setMatrix(Transform::compose(removed, local[child].world()));
+        parent[child] = parentIndex;
+        markEdited(handles[child]);
+    }
+    addToAncestors(parentIndex, -1);
+
+    local.erase(local.begin() + index);
+    world.erase(world.begin() + index);
+    normal.erase(normal.begin() + index);
+    similarity.erase(similarity.begin() + index);
+    parent.erase(parent.begin() + index);
+    subtreeSize.erase(subtreeSize.begin() + index);
+    handles.erase(handles.begin() + index);
+    for (size_t i = index; i < size(); i++)
+    {
+        if (parent[i] > index)
+            parent[i]--;
+    }
+    reindex(index);
+    indexOf[node] = NO_NODE;
+    freeHandles.push_back(node);
+}
+
+bool SceneGraph::setParent(int node, int newParent)
+{
+    int index = indexOf[node];
+    int count = subtreeSize[index];
+    int target = newParent == NO_NODE ? NO_NODE : indexOf[newParent];
+    if (target >= index && target < index + count)
+        return false;
+    if (target == parent[index])
+        return true;
+
+    // The world placement is kept, the local transform becomes relative to the new parent
+    update();
+    AffineMatrix placement = target == NO_NODE ? world[index] : Transform::compose(Transform::inverse(world[target]), world[index]);
+
+    // Take the subtree out, parents inside it are kept relative to its root
+    std::vector<Transform, Eigen::aligned_allocator<Transform> > movedLocal(local.begin() + index, local.begin() + index + count);
+    std::vector<unsigned int> movedSize(subtreeSize.begin() + index, subtreeSize.begin() + index + count);
+    std::vector<int> movedHandles(handles.begin() + index, handles.begin() + index + count);
+    std::vector<int> movedParent(count);
+    for (int i = 1; i < count; i++)
+        movedParent[i] = parent[index + i] - index;
+    addToAncestors(parent[index], -count);
+    local.erase(local.begin() + index, local.begin() + index + count);
+    world.erase(world.begin() + index, world.begin() + index + count);
+    normal.erase(normal.begin() + index, normal.begin() + index + count);
+    similarity.erase(similarity.begin() + index, similarity.begin() + index + count);
+    parent.erase(parent.begin() + index, parent.begin() + index + count);
+    subtreeSize.erase(subtreeSize.begin() + index, subtreeSize.begin() + index + count);
+    handles.erase(handles.begin() + index, handles.begin() + index + count);
+    for (size_t i = index; i < size(); i++)
+    {
+        if (parent[i] >= index)
+            parent[i] -= count;
+    }
+    if (target > index)
+        target -= count;
+
+    // and put it back as the last child of the new parent
+    int position = target == NO_NODE ? (int) size() : target + subtreeSize[target];
+    for (size_t i = position; i < size(); i++)
+    {
+        if (parent[i] >= position)
+            parent[i] += count;
+    }
+    movedParent[0] = target;
+    for (int i = 1; i < count; i++)
+        movedParent[i] += position;
+    local.insert(local.begin() + position, movedLocal.begin(), movedLocal.end());
+    world.insert(world.begin() + position, count, AffineMatrix(AffineMatrix::Identity()));
+    normal.insert(normal.begin() + position, count, Eigen::Matrix3f(Eigen::Matrix3f::Identity()));
+    similarity.insert(similarity.begin() + position, count, 1);
+    parent.insert(parent.begin() + position, movedParent.begin(), movedParent.end());
+    subtreeSize.insert(subtreeSize.begin() + position, movedSize.begin(), movedSize.end());
+    handles.insert(handles.begin() + position, movedHandles.begin(), movedHandles.end());
+    addToAncestors(target, count);
+    reindex(std::min(index, position));
+
+    local[position].setMatrix(placement);
+    markEdited(node);
+    return true;
+}
+
+int SceneGraph::parentOf(int node) const
+{
+    int parentIndex = parent[indexOf[node]];
+    return parentIndex == NO_NODE ? NO_NODE : handles[parentIndex];
+}
+
+Transform &SceneGraph::edit(int node)
+{
+    markEdited(node);
+    return local[indexOf[node]];
+}
+
+AffineMatrix SceneGraph::parentWorld(int node) const
+{
+    int parentIndex = parent[indexOf[node]];
+    return parentIndex == NO_NODE ? AffineMatrix(AffineMatrix::Identity()) : world[parentIndex];
+}
+
+void SceneGraph::update()
+{
+    editedIndices.clear();
+    for (size_t i = 0; i < edited.size(); i++)
+    {
+        editedFlag[edited[i]] = 0;
+        if (indexOf[edited[i]] != NO_NODE)
+            editedIndices.push_back(indexOf[edited[i]]);
+    }
+    edited.clear();
+
+    // In depth-first order a subtree already covered by an edited ancestor is skipped
+    std::sort(editedIndices.begin(), editedIndices.end());
+    size_t covered = 0;
+    for (size_t i = 0; i < editedIndices.size(); i++)
+    {
+        size_t first = editedIndices[i];
+        if (first < covered)
+            continue;
+        updateSubtree(first);
+        covered = first + subtreeSize[first];
+    }
+}
+
+size_t SceneGraph::bytes() const
+{
+    return local.capacity() * sizeof(Transform) + world.capacity() * sizeof(AffineMatrix)
+         + normal.capacity() * sizeof(Eigen::Matrix3f) + similarity.capacity()
+         + (parent.capacity() + handles.capacity() + indexOf.capacity() + freeHandles.capacity()
+            + edited.capacity() + editedIndices.capacity()) * sizeof(int)
+         + subtreeSize.capacity() * sizeof(unsigned int) + editedFlag.capacity();
+}
+
+void SceneGraph::clear()
+{
+    local.clear();
+    world.clear();
+    normal.clear();
+    similarity.clear();
+    parent.clear();
+    subtreeSize.clear();
+    handles.clear();
+    indexOf.clear();
+    freeHandles.clear();
+    edited.clear();
+    editedFlag.clear();
+    editedIndices.clear();
+}
+
+void SceneGraph::markEdited(int node)
+{
+    if (!editedFlag[node])
+    {
+        editedFlag[node] = 1;
+        edited.push_back(node);
+    }
+}
+
+void SceneGraph::updateRange(size_t first, size_t end)
+{
+    // Parents come first, so they are always up to date here
+    for (size_t i = first; i < end; i++)
+    {
+        const AffineMatrix &matrix = local[i].world();
+        world[i] = parent[i] == NO_NODE ? matrix : Transform::compose(world[parent[i]], matrix);
+        similarity[i] = local[i].uniformScale() && (parent[i] == NO_NODE || similarity[parent[i]]);
+        normal[i] = Transform::normalMatrix(world[i], similarity[i] != 0);
+    }
+}
+
+void SceneGraph::updateSubtree(size_t first)
+{
+    size_t end = first + subtreeSize[first];
+    updatedNodes += end - first;
+    if (threads <= 1 || end - first < parallelThreshold)
+    {
+        updateRange(first, end);
+        return;
+    }
+
+    // After the root, the subtrees of its children are independent: they are
+    // cut into one group of consecutive children per thread
+    updateRange(first, first + 1);
+    if (workers.size() != threads - 1)
+        startWorkers(threads - 1);
+    size_t share = (end - first - 1) / threads + 1;
+    size_t start = first + 1;
+    size_t groups = 0;
+    for (size_t child = first + 1; child < end && groups < workers.size(); child += subtreeSize[child])
+    {
+        if (child - start >= share)
+        {
+            workerRanges[groups++] = std::make_pair(start, child);
+            start = child;
+        }
+    }
+    for (size_t i = groups; i < workerRanges.size(); i++)
+        workerRanges[i] = std::make_pair(end, end);
+    {
+        std::lock_guard<std::mutex> lock(workerMutex);
+        busyWorkers = workers.size();
+        generation++;
+    }
+    workStarted.notify_all();
+    updateRange(start, end);
+    std::unique_lock<std::mutex> lock(workerMutex);
+    while (busyWorkers > 0)
+        workDone.wait(lock);
+}
+
+void SceneGraph::startWorkers(unsigned int count)
+{
+    // Once, charged to loading: the frames after it do not allocate
+    AllocScope allocScope(ALLOC_LOADING);
+    stopWorkers();
+    stopping = false;
+    workerRanges.assign(count, std::make_pair(size_t(0), size_t(0)));
+    workers.reserve(count);
+    for (size_t i = 0; i < count; i++)
+        workers.push_back(std::thread(&SceneGraph::workerLoop, this, i, generation));
+}
+
+void SceneGraph::stopWorkers()
+{
+    {
+        std::lock_guard<std::mutex> lock(workerMutex);
+        stopping = true;
+    }
+    workStarted.notify_all();
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+    workers.clear();
+}
+
+void SceneGraph::workerLoop(size_t worker, size_t seen)
+{
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(workerMutex);
+            while (!stopping && generation == seen)
+                workStarted.wait(lock);
+            if (stopping)
+                return;
+            seen = generation;
+        }
+        updateRange(workerRanges[worker].first, workerRanges[worker].second);
+        bool last;
+        {
+            std::lock_guard<std::mutex> lock(workerMutex);
+            last = --busyWorkers == 0;
+        }
+        if (last)
+            workDone.notify_one();
+    }
+}
+
+void SceneGraph::insert(size_t position, const Transform &transform, int parentIndex, int handle)
+{
+    local.insert(local.begin() + position, transform);
+    world.insert(world.begin() + position, AffineMatrix(AffineMatrix::Identity()));
+    normal.insert(normal.begin() + position, Eigen::Matrix3f(Eigen::Matrix3f::Identity()));
+    similarity.insert(similarity.begin() + position, 1);
+    parent.insert(parent.begin() + position, parentIndex);
+    subtreeSize.insert(subtreeSize.begin() + position, 1);
+    handles.insert(handles.begin() + position, handle);
+    for (size_t i = position + 1; i < size(); i++)
+    {
+        if (parent[i] >= (int) position)
+            parent[i]++;
+    }
+    addToAncestors(parentIndex, 1);
+    reindex(position);
+}
+
+void SceneGraph::addToAncestors(int index, int count)
+{
+    while (index != NO_NODE)
+    {
+        subtreeSize[index] += count;
+        index = parent[index];
+    }
+}
+
+void SceneGraph::reindex(size_t first)
+{
+    for (size_t i = first; i < size(); i++)
+        indexOf[handles[i]] = (int) i;
+}
+
+void SceneGraph::benchmark(unsigned int nodes)
+{
+    // A rack: one root holding pairs of a child and a grandchild
+    SceneGraph graph;
+    int root = graph.create(Transform());
+    std::vector<int> leaves;
+    for (unsigned int i = 0; i < nodes / 2; i++)
+    {
+        Transform transform;
+        transform.translation = Eigen::Vector3f::Random();
+        int child = graph.create(transform, root);
+        leaves.push_back(graph.create(Transform(), child));
+    }
+    graph.update();
+
+    const unsigned int leafEdits = 10000;
+    graph.updatedNodes = 0;
+    ProfileClock::time_point start = ProfileClock::now();
+    for (unsigned int i = 0; i < leafEdits; i++)
+    {
+        graph.edit(leaves[i % leaves.size()]).translateBy(Eigen::Vector3f(0.001f, 0, 0));
+        graph.update();
+    }
+    double leafMs = elapsedMs(start, ProfileClock::now());
+    size_t leafNodes = graph.updatedNodes / leafEdits;
+
+    const unsigned int rootEdits = 20;
+    unsigned int available = graph.threads;
+    double rootMs[2];
+    for (int parallel = 0; parallel < 2; parallel++)
+    {
+        graph.threads = parallel ? available : 1;
+        graph.parallelThreshold = 0;
+        graph.updatedNodes = 0;
+        start = ProfileClock::now();
+        for (unsigned int i = 0; i < rootEdits; i++)
+        {
+            graph.edit(root).rotateBy(Eigen::Quaternionf(Eigen::AngleAxisf(0.01f, Eigen::Vector3f::UnitY())));
+            graph.update();
+        }
+        rootMs[parallel] = elapsedMs(start, ProfileClock::now()) / rootEdits;
+    }
+
+    std::cout << "Scene graph benchmark, " << graph.size() << " nodes (" << graph.bytes() << " B)" << std::endl;
+    std::cout << "  leaf edit: " << leafNodes << " nodes updated, " << 1e6 * leafMs / leafEdits << " ns" << std::endl;
+    std::cout << "  root edit: " << graph.updatedNodes / rootEdits << " nodes updated, " << rootMs[0] << " ms on 1 thread, "
+              << rootMs[1] << " ms on " << available << " threads" << std::endl;
+}
@@ -0,0 +1,123 @@
+#ifndef SCENE_GRAPH_H
+#define SCENE_GRAPH_H
+
+#include "Transform.h"
+
+#include <Eigen/StdVector>
+
+#include <vector>
+#include <cstddef>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Parent/child hierarchy of transforms.
+// The nodes live in flat arrays in depth-first order: a parent comes before
+// its children and every subtree is a contiguous range. Edits only mark their
+// node, update() then recomputes the world matrices of the marked subtrees
+// with a linear walk, so the cost follows the number of changed nodes.
+// Nodes are named by handles that stay valid while the arrays are reordered.
+class SceneGraph
+{
+public:
+    static const int NO_NODE = -1;
+
+    // Per node arrays, indexed in depth-first order
+    std::vector<Transform, Eigen::aligned_allocator<Transform> > local;
+    std::vector<AffineMatrix, Eigen::aligned_allocator<AffineMatrix> > world;
+    // Inverse transpose of the linear part of world, updated with it
+    std::vector<Eigen::Matrix3f> normal;
+    // Whether world is a rotation with a uniform scale, along the whole chain of parents
+    std::vector<char> similarity;
+    // Index of the parent, NO_NODE for roots
+    std::vector<int> parent;
+    // Number of nodes in the subtree, the node included
+    std::vector<unsigned int> subtreeSize;
+    std::vector<int> handles;
+
+    // Subtrees with at least this many nodes are updated by several threads
+    size_t parallelThreshold;
+    unsigned int threads;
+    // Nodes recomputed by update(), reset by the caller
+    size_t updatedNodes;
+
+    SceneGraph();
+    ~SceneGraph();
+
+    // New node, the last child of parentNode or a root
+    int create(const Transform &transform, int parentNode = NO_NODE);
+
+    // Remove a node, its children move to its parent without moving in the world
+    void destroy(int node);
+
+    // Move node and its subtree under newParent (or to the roots) without
+    // moving it in the world. Fails if newParent is inside the subtree.
+    bool setParent(int node, int newParent);
+
+    int parentOf(int node) const;
+
+    // Local transform to modify, the subtree is updated with the next update()
+    Transform &edit(int node);
+
+    const Transform &transform(int node) const { return local[indexOf[node]]; }
+
+    // Index of the node in the arrays, valid until the hierarchy changes
+    size_t position(int node) const { return indexOf[node]; }
+
+    // World matrix as of the last update()
+    const AffineMatrix &worldOf(int node) const { return world[indexOf[node]]; }
+
+    // Normal matrix as of the last update()
+    const Eigen::Matrix3f &normalOf(int node) const { return normal[indexOf[node]]; }
+
+    // World matrix of the parent, identity for roots
+    AffineMatrix parentWorld(int node) const;
+
+    // Recompute the world matrices of the edited subtrees
+    void update();
+
+    size_t size() const { return local.size(); }
+
+    // Bytes held by the arrays
+    size_t bytes() const;
+
+    void clear();
+
+    // Time the update after editing a leaf and the root of a wide hierarchy
+    // of about nodes nodes and print the result
+    static void benchmark(unsigned int nodes);
+
+private:
+    // Handle to index, NO_NODE for free handles
+    std::vector<int> indexOf;
+    std::vector<int> freeHandles;
+    // Handles edited since the last update, each once
+    std::vector<int> edited;
+    std::vector<char> editedFlag;
+    // Scratch list of the edited indices
+    std::vector<int> editedIndices;
+
+    // Worker threads of the parallel update, started with the first one
+    // and kept, each takes its [first, end) range once generation changes
+    std::vector<std::thread> workers;
+    std::vector<std::pair<size_t, size_t> > workerRanges;
+    std::mutex workerMutex;
+    std::condition_variable workStarted;
+    std::condition_variable workDone;
+    size_t generation;
+    size_t busyWorkers;
+    bool stopping;
+
+    void startWorkers(unsigned int count);
+    void stopWorkers();
+    void workerLoop(size_t worker, size_t seen);
+
+    void markEdited(int node);
+    void updateRange(size_t first, size_t end);
+    void updateSubtree(size_t first);
+    void insert(size_t position, const Transform &transform, int parentIndex, int handle);
+    void addToAncestors(int index, int count);
+    void reindex(size_t first);
+};
+
+#endif
@@ -0,0 +1,209 @@
+#include "ShaderPermutations.h"
+#include "Profiling.h"
+
+#include <iostream>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+
+static const char PROGRAM_CACHE_MAGIC[4] = {'G', 'L', 'P', 'B'};
+static const uint64_t FNV_OFFSET_BASIS = 14695981039346656037ULL;
+static const uint64_t FNV_PRIME = 1099511628211ULL;
+
+static void hashString(uint64_t &hash, const std::string &text)
+{
+    // The terminating zero separates consecutive strings
+    for (size_t i = 0; i <= text.size(); i++)
+    {
+        hash ^= (unsigned char) text.c_str()[i];
+        hash *= FNV_PRIME;
+    }
+}
+
+static std::string glString(GLenum name)
+{
+    const GLubyte *value = glGetString(name);
+    return value ? std::string((const char *) value) : std::string();
+}
+
+ShaderPermutations::ShaderPermutations()
+    : parallel(false), cacheHits(0), cacheMisses(0), loadMs(0.0), compileMs(0.0), cachedCompileMs(0.0)
+{
+}
+
+void ShaderPermutations::init(const std::string &version, const std::string &vertexSource, const std::string &fragmentSource,
+                              const std::string &fragmentDataName, const std::vector<std::string> &attributes)
+{
+    this->version = version;
+    this->vertexSource = vertexSource;
+    this->fragmentSource = fragmentSource;
+    this->fragmentDataName = fragmentDataName;
+    this->attributes = attributes;
+}
+
+void ShaderPermutations::prepare(const std::vector<std::string> &defineLists)
+{
+    for (size_t i = 0; i < defineLists.size(); i++)
+    {
+        const std::string &defines = defineLists[i];
+        if (programs.count(defines) || pending.count(defines))
+            continue;
+        Program program;
+        if (loadCached(defines, program))
+        {
+            programs[defines] = program;
+        }
+        else if (parallel)
+        {
+            std::string prefix = header(defines);
+            program.retrievable = !cacheDirectory.empty();
+            program.start(prefix + vertexSource, prefix + fragmentSource, fragmentDataName, attributes);
+            pending[defines] = program;
+        }
+    }
+}
+
+Program *ShaderPermutations::get(const std::string &defines)
+{
+    std::map<std::string, Program>::iterator found = programs.find(defines);
+    if (found == programs.end())
+    {
+        Program program;
+        std::map<std::string, Program>::iterator started = pending.find(defines);
+        if (started != pending.end())
+        {
+            program = started->second;
+            pending.erase(started);
+            finish(defines, program, 0.0);
+        }
+        else if (!loadCached(defines, program))
+        {
+            ProfileClock::time_point start = ProfileClock::now();
+            std::string prefix = header(defines);
+            program.retrievable = !cacheDirectory.empty();
+            program.start(prefix + vertexSource, prefix + fragmentSource, fragmentDataName, attributes);
+            finish(defines, program, elapsedMs(start, ProfileClock::now()));
+        }
+        found = programs.insert(std::make_pair(defines, program)).first;
+    }
+    return found->second.program_shader ? &found->second : NULL;
+}
+
+void ShaderPermutations::printStats() const
+{
+    std::cout << "Shaders: " << cacheHits << " programs loaded from the cache in " << loadMs << " ms";
+    if (cacheHits > 0)
+        std::cout << " (" << cachedCompileMs << " ms to compile, " << cachedCompileMs - loadMs << " ms saved)";
+    std::cout << ", " << cacheMisses << " compiled in " << compileMs << " ms"
+              << (parallel ? " by parallel compilation" : "") << std::endl;
+}
+
+void ShaderPermutations::free()
+{
+    for (std::map<std::string, Program>::iterator it = pending.begin(); it != pending.end(); ++it)
+        it->second.free();
+    for (std::map<std::string, Program>::iterator it = programs.begin(); it != programs.end(); ++it)
+        it->second.free();
+    pending.clear();
+    programs.clear();
+}
+
+std::string ShaderPermutations::header(const std::string &defines) const
+{
+    std::string result = version + "\n";
+    std::istringstream names(defines);
+    std::string name;
+    while (names >> name)
+        result += "#define " + name + "\n";
+    return result;
+}
+
+std::string ShaderPermutations::cachePath(const std::string &defines) const
+{
+    // A binary only loads in the driver that produced it
+    uint64_t hash = FNV_OFFSET_BASIS;
+    hashString(hash, glString(GL_VENDOR));
+    hashString(hash, glString(GL_RENDERER));
+    hashString(hash, glString(GL_VERSION));
+    std::string prefix = header(defines);
+    hashString(hash, prefix + vertexSource);
+    hashString(hash, prefix + fragmentSource);
+    hashString(hash, fragmentDataName);
+    for (size_t i = 0; i < attributes.size(); i++)
+        hashString(hash, attributes[i]);
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx", (unsigned long long) hash);
+    return cacheDirectory + "/program_" + name + ".bin";
+}
+
+bool ShaderPermutations::loadCached(const std::string &defines, Program &program)
+{
+    if (cacheDirectory.empty() || !Program::binariesSupported())
+        return false;
+    ProfileClock::time_point start = ProfileClock::now();
+    FILE *file = fopen(cachePath(defines).c_str(), "rb");
+    if (!file)
+        return false;
+    char magic[4];
+    uint32_t format = 0;
+    uint32_t size = 0;
+    double ms = 0.0;
+    std::vector<char> binary;
+    bool complete = fread(magic, 1, 4, file) == 4 && memcmp(magic, PROGRAM_CACHE_MAGIC, 4) == 0
+        && fread(&format, sizeof(format), 1, file) == 1 && fread(&ms, sizeof(ms), 1, file) == 1
+        && fread(&size, sizeof(size), 1, file) == 1;
+    if (complete)
+    {
+        binary.resize(size);
+        complete = size > 0 && fread(binary.data(), 1, size, file) == size;
+    }
+    fclose(file);
+
+    std::string prefix = header(defines);
+    if (!complete || !program.loadBinary(format, binary, prefix + vertexSource, prefix + fragmentSource, fragmentDataName, attributes))
+        return false;
+    loadMs += elapsedMs(start, ProfileClock::now());
+    cachedCompileMs += ms;
+    cacheHits++;
+    return true;
+}
+
+void ShaderPermutations::saveCached(const std::string &defines, const Program &program, double ms) const
+{
+    GLenum format;
+    std::vector<char> binary;
+    if (cacheDirectory.empty() || !program.getBinary(format, binary))
+        return;
+    std::string path = cachePath(defines);
+    FILE *file = fopen(path.c_str(), "wb");
+    if (!file)
+    {
+        std::cerr << "Could not write the program binary " << path << std::endl;
+        return;
+    }
+    // magic, binary format, compile time, size, binary
+    uint32_t formatValue = (uint32_t) format;
+    uint32_t size = (uint32_t) binary.size();
+    fwrite(PROGRAM_CACHE_MAGIC, 1, 4, file);
+    fwrite(&formatValue, sizeof(formatValue), 1, file);
+    fwrite(&ms, sizeof(ms), 1, file);
+    fwrite(&size, sizeof(size), 1, file);
+    fwrite(binary.data(), 1, binary.size(), file);
+    bool written = !ferror(file);
+    fclose(file);
+    if (!written)
+        remove(path.c_str());
+}
+
+bool ShaderPermutations::finish(const std::string &defines, Program &program, double startMs)
+{
+    ProfileClock::time_point start = ProfileClock::now();
+    std::string prefix = header(defines);
+    bool linked = program.finish(prefix + vertexSource, prefix + fragmentSource, fragmentDataName, attributes);
+    double ms = startMs + elapsedMs(start, ProfileClock::now());
+    compileMs += ms;
+    cacheMisses++;
+    if (linked)
+        saveCached(defines, program, ms);
+    return linked;
+}
@@ -0,0 +1,81 @@
+#ifndef SHADER_PERMUTATIONS_H
+#define SHADER_PERMUTATIONS_H
+
+#include "Helpers.h"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdint>
+
+// Variants of one vertex/fragment shader pair selected with #define.
+// The sources put every optional feature in #ifdef blocks, so each
+// permutation only runs the instructions it needs instead of branching on
+// a uniform. Permutations are compiled on first use and kept until free().
+//
+// Linked programs can be saved to a cache directory (ARB_get_program_binary)
+// keyed by a hash of their sources and of the driver, later launches load
+// them instead of compiling. With KHR_parallel_shader_compile, prepare()
+// queues every permutation so that the driver compiles them together.
+class ShaderPermutations
+{
+public:
+    // First line of both shaders, e.g. "#version 150 core"
+    std::string version;
+    // Sources without the version line
+    std::string vertexSource;
+    std::string fragmentSource;
+    std::string fragmentDataName;
+    // Bound to the same locations in every permutation, so that one
+    // vertex array works with all of them
+    std::vector<std::string> attributes;
+    // Compiled permutations by their list of defines
+    std::map<std::string, Program> programs;
+
+    // Directory of the program binaries, empty to always compile
+    std::string cacheDirectory;
+    // The driver compiles in the background (KHR_parallel_shader_compile)
+    bool parallel;
+
+    // Programs loaded from the cache and compiled from the sources
+    unsigned int cacheHits;
+    unsigned int cacheMisses;
+    // Time spent loading binaries and waiting for compilations
+    double loadMs;
+    double compileMs;
+    // What the loaded programs took to compile when they were cached
+    double cachedCompileMs;
+
+    ShaderPermutations();
+
+    void init(const std::string &version, const std::string &vertexSource, const std::string &fragmentSource,
+              const std::string &fragmentDataName, const std::vector<std::string> &attributes);
+
+    // Load the cached permutations among defineLists and, with parallel
+    // compilation, start compiling the other ones. get() finishes them.
+    void prepare(const std::vector<std::string> &defineLists);
+
+    // Program built with the defines, names separated by spaces.
+    // NULL if it does not compile, the failure is cached too.
+    Program *get(const std::string &defines);
+
+    // Print the cache hits and the time saved
+    void printStats() const;
+
+    // Release every compiled program
+    void free();
+
+private:
+    // Started by prepare() and not finished yet
+    std::map<std::string, Program> pending;
+
+    // version, then one #define line per name
+    std::string header(const std::string &defines) const;
+    std::string cachePath(const std::string &defines) const;
+    bool loadCached(const std::string &defines, Program &program);
+    void saveCached(const std::string &defines, const Program &program, double ms) const;
+    // Wait for a started program, time it and cache it
+    bool finish(const std::string &defines, Program &program, double startMs);
+};
+
+#endif
@@ -0,0 +1,447 @@
+#include "StaticBatching.h"
+#include "GLCapture.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+StaticBatcher::StaticBatcher()
+    : enabled(false), cellSize(2.0f), settleFrames(60), vertexBudget(64 * 1024), maxBatchVertices(64 * 1024),
+      rebuilds(0), unmerges(0), positionLocation(0), normalLocation(1), colorLocation(2), idLocation(3), current(-1), next(0), rebuildMembers(0)
+{
+}
+
+void StaticBatcher::init(GLuint positionLocation, GLuint normalLocation, GLuint colorLocation, GLuint idLocation)
+{
+    this->positionLocation = positionLocation;
+    this->normalLocation = normalLocation;
+    this->colorLocation = colorLocation;
+    this->idLocation = idLocation;
+}
+
+// 21 bits per axis, cells wrap around far from the origin
+unsigned long long StaticBatcher::cellOf(const BatchInstance &instance) const
+{
+    const AffineMatrix &world = *instance.world;
+    Eigen::Vector3f center = world.leftCols<3>() * *instance.center + world.col(3);
+    unsigned long long key = 0;
+    for (int k = 0; k < 3; k++)
+    {
+        long long cell = (long long) std::floor(center[k] / cellSize);
+        key = (key << 21) | ((unsigned long long) cell & 0x1FFFFF);
+    }
+    return key;
+}
+
+std::vector<StaticBatcher::Cell>::iterator StaticBatcher::findCell(unsigned long long key)
+{
+    return std::lower_bound(cells.begin(), cells.end(), key, [](const Cell &cell, unsigned long long key) { return cell.key < key; });
+}
+
+bool StaticBatcher::track(const BatchInstance &instance)
+{
+    if (instance.id >= tracks.size())
+    {
+        Track fresh = Track();
+        fresh.batch = fresh.member = -1;
+        tracks.resize(instance.id + 1, fresh);
+        // Every cell holds at least one instance
+        cells.reserve(tracks.size());
+        freeBatches.reserve(tracks.size());
+    }
+    Track &track = tracks[instance.id];
+    const float *world = instance.world->data();
+    if (memcmp(track.world, world, sizeof(track.world)) != 0 || memcmp(track.color, instance.color, sizeof(track.color)) != 0)
+    {
+        unmerge(instance.id);
+        memcpy(track.world, world, sizeof(track.world));
+        memcpy(track.color, instance.color, sizeof(track.color));
+        track.still = 0;
+        return false;
+    }
+    if (track.batch >= 0)
+    {
+        if (!instance.canMerge)
+        {
+            unmerge(instance.id);
+            return false;
+        }
+        return batches[track.batch].members[track.member].onGpu;
+    }
+    if (track.still < settleFrames)
+        track.still++;
+    if (track.still >= settleFrames && instance.canMerge)
+        join(instance);
+    return false;
+}
+
+bool StaticBatcher::join(const BatchInstance &instance)
+{
+    unsigned long long key = cellOf(instance);
+    std::vector<Cell>::iterator found = findCell(key);
+    int index;
+    if (found == cells.end() || found->key != key)
+    {
+        if (freeBatches.empty())
+        {
+            index = (int) batches.size();
+            batches.push_back(Batch());
+        }
+        else
+        {
+            index = freeBatches.back();
+            freeBatches.pop_back();
+        }
+        Batch &batch = batches[index];
+        batch.members.clear();
+        batch.cell = key;
+        batch.liveVertices = 0;
+        batch.indexCount = 0;
+        batch.hasNormals = false;
+        batch.dirty = false;
+        batch.everBuilt = false;
+        cells.insert(found, Cell(key, index));
+    }
+    else
+        index = found->batch;
+    Batch &batch = batches[index];
+    if (batch.liveVertices + instance.vertexCount > maxBatchVertices)
+        return false;
+
+    Member member;
+    member.instance = instance.id;
+    member.object = instance.object;
+    memcpy(member.world, instance.world->data(), sizeof(member.world));
+    memcpy(member.normal, instance.normal->data(), sizeof(member.normal));
+    memcpy(member.color, instance.color, sizeof(member.color));
+    member.vertexCount = instance.vertexCount;
+    member.firstIndex = 0;
+    member.indexCount = 0;
+    member.firstEdge = 0;
+    member.edgeCount = 0;
+    member.live = true;
+    member.onGpu = false;
+    member.built = false;
+    Track &track = tracks[instance.id];
+    track.batch = index;
+    track.member = (int) batch.members.size();
+    batch.members.push_back(member);
+    batch.liveVertices += instance.vertexCount;
+    batch.dirty = true;
+    return true;
+}
+
+void StaticBatcher::unmerge(unsigned int instance)
+{
+    if (instance >= tracks.size() || tracks[instance].batch < 0)
+        return;
+    Track &track = tracks[instance];
+    Batch &batch = batches[track.batch];
+    Member &member = batch.members[track.member];
+    member.live = false;
+    batch.liveVertices -= member.vertexCount;
+    batch.dirty = true;
+    track.batch = track.member = -1;
+    track.still = 0;
+    unmerges++;
+}
+
+void StaticBatcher::forget(unsigned int instance)
+{
+    unmerge(instance);
+    if (instance < tracks.size())
+    {
+        Track fresh = Track();
+        fresh.batch = fresh.member = -1;
+        tracks[instance] = fresh;
+    }
+}
+
+void StaticBatcher::append(Member &member, const BatchMesh &mesh)
+{
+    Eigen::Map<const AffineMatrix> world(member.world);
+    Eigen::Map<const Eigen::Matrix3f> normal(member.normal);
+    unsigned int base = (unsigned int) (stagedPositions.size() / 3);
+    for (unsigned int v = 0; v < mesh.vertexCount; v++)
+    {
+        Eigen::Vector3f position = world.leftCols<3>() * Eigen::Map<const Eigen::Vector3f>(mesh.positions + 3 * v) + world.col(3);
+        for (int k = 0; k < 3; k++)
+        {
+            stagedPositions.push_back(position[k]);
+            stagedColors.push_back(member.color[k]);
+        }
+        if (mesh.normals)
+        {
+            Eigen::Vector3f direction = normal * Eigen::Map<const Eigen::Vector3f>(mesh.normals + 3 * v);
+            for (int k = 0; k < 3; k++)
+                stagedNormals.push_back(direction[k]);
+        }
+    }
+    member.firstIndex = (unsigned int) stagedIndices.size();
+    member.indexCount = mesh.indexCount;
+    for (unsigned int i = 0; i < mesh.indexCount; i++)
+        stagedIndices.push_back(base + mesh.indices[i]);
+    member.firstEdge = (unsigned int) stagedEdges.size();
+    member.edgeCount = mesh.edgeCount;
+    for (unsigned int i = 0; i < mesh.edgeCount; i++)
+        stagedEdges.push_back(base + mesh.edges[i]);
+    member.built = true;
+}
+
+void StaticBatcher::step(MeshLookup lookup)
+{
+    size_t budget = vertexBudget;
+    while (budget > 0)
+    {
+        if (current < 0)
+        {
+            // Round robin from the last batch built
+            for (size_t i = 0; i < batches.size() && current < 0; i++)
+            {
+                size_t candidate = (rebuilds + i) % batches.size();
+                if (batches[candidate].dirty)
+                    current = (int) candidate;
+            }
+            if (current < 0)
+                return;
+            Batch &batch = batches[current];
+            batch.dirty = false;
+            next = 0;
+            rebuildMembers = batch.members.size();
+            stagedPositions.clear();
+            stagedNormals.clear();
+            stagedColors.clear();
+            stagedIndices.clear();
+            stagedEdges.clear();
+            for (size_t m = 0; m < batch.members.size(); m++)
+                batch.members[m].built = false;
+        }
+        Batch &batch = batches[current];
+        // Members that join during the rebuild wait for the next one
+        while (next < rebuildMembers && budget > 0)
+        {
+            Member &member = batch.members[next++];
+            if (!member.live)
+                continue;
+            BatchMesh mesh;
+            if (!lookup(member.object, mesh))
+            {
+                // The mesh lost its CPU copy, the instance stays dynamic
+                unmerge(member.instance);
+                continue;
+            }
+            append(member, mesh);
+            budget -= mesh.vertexCount < budget ? mesh.vertexCount : budget;
+        }
+        if (next == rebuildMembers)
+        {
+            finish(batch);
+            if (batch.members.empty() && !batch.dirty)
+                release(current);
+            current = -1;
+        }
+    }
+}
+
+void StaticBatcher::finish(Batch &batch)
+{
+    if (!batch.everBuilt)
+    {
+        batch.vertexArray.init();
+        batch.positions.init();
+        batch.normals.init();
+        batch.colors.init();
+        batch.indices.init();
+        batch.everBuilt = true;
+    }
+    // One element buffer, the edges follow the triangles
+    unsigned int edgeBase = (unsigned int) stagedIndices.size();
+    stagedIndices.insert(stagedIndices.end(), stagedEdges.begin(), stagedEdges.end());
+    unsigned int vertices = (unsigned int) (stagedPositions.size() / 3);
+    if (vertices > 0)
+    {
+        // The element buffer and the attributes are state of the vertex array
+        batch.vertexArray.bind();
+        batch.positions.update(stagedPositions.data(), 3, vertices);
+        GLCapture::enableVertexAttribArray(positionLocation);
+        GLCapture::vertexAttribPointer(positionLocation, 3, GL_FLOAT, GL_FALSE, 0, 0);
+        if (stagedNormals.size() == stagedPositions.size())
+        {
+            batch.normals.update(stagedNormals.data(), 3, vertices);
+            GLCapture::enableVertexAttribArray(normalLocation);
+            GLCapture::vertexAttribPointer(normalLocation, 3, GL_FLOAT, GL_FALSE, 0, 0);
+        }
+        else
+            GLCapture::disableVertexAttribArray(normalLocation);
+        batch.colors.update(stagedColors.data(), 3, vertices);
+        GLCapture::enableVertexAttribArray(colorLocation);
+        GLCapture::vertexAttribPointer(colorLocation, 3, GL_FLOAT, GL_FALSE, 0, 0);
+        batch.indices.update(stagedIndices);
+    }
+    batch.indexCount = (unsigned int) stagedIndices.size();
+    batch.hasNormals = stagedNormals.size() == stagedPositions.size();
+
+    // Members that left are dropped, the other ones keep their order which
+    // is also the order of their ranges
+    size_t kept = 0;
+    for (size_t m = 0; m < batch.members.size(); m++)
+    {
+        Member &member = batch.members[m];
+        if (!member.live)
+        {
+            // its vertices were uploaded but are never drawn
+            if (member.built)
+                batch.dirty = true;
+            continue;
+        }
+        member.onGpu = member.built;
+        if (member.built)
+            member.firstEdge += edgeBase;
+        if (!member.onGpu)
+            batch.dirty = true;
+        tracks[member.instance].member = (int) kept;
+        batch.members[kept++] = member;
+    }
+    batch.members.resize(kept);
+    rebuilds++;
+}
+
+void StaticBatcher::release(int index)
+{
+    Batch &batch = batches[index];
+    if (batch.everBuilt)
+    {
+        batch.vertexArray.free();
+        batch.positions.free();
+        batch.normals.free();
+        batch.colors.free();
+        batch.indices.free();
+        batch.everBuilt = false;
+    }
+    batch.indexCount = 0;
+    batch.hasNormals = false;
+    cells.erase(findCell(batch.cell));
+    freeBatches.push_back(index);
+}
+
+size_t StaticBatcher::draw(GLenum mode, bool perInstance)
+{
+    size_t calls = 0;
+    bool edges = mode == GL_LINES;
+    for (size_t b = 0; b < batches.size(); b++)
+    {
+        Batch &batch = batches[b];
+        if (batch.indexCount == 0)
+            continue;
+        bool bound = false;
+        size_t m = 0;
+        while (m < batch.members.size())
+        {
+            const Member &first = batch.members[m++];
+            if (!first.live || !first.onGpu)
+                continue;
+            unsigned int start = edges ? first.firstEdge : first.firstIndex;
+            unsigned int count = edges ? first.edgeCount : first.indexCount;
+            if (perInstance)
+                GLCapture::vertexAttribI1ui(idLocation, first.instance);
+            else
+            {
+                // Pending members have no range, removed ones leave a hole
+                while (m < batch.members.size())
+                {
+                    const Member &member = batch.members[m];
+                    if (member.onGpu && (!member.live || (edges ? member.firstEdge : member.firstIndex) != start + count))
+                        break;
+                    if (member.onGpu)
+                        count += edges ? member.edgeCount : member.indexCount;
+                    m++;
+                }
+            }
+            if (!bound)
+            {
+                batch.vertexArray.bind();
+                bound = true;
+            }
+            GLCapture::drawElements(mode, count, GL_UNSIGNED_INT, sizeof(unsigned int) * start);
+            calls++;
+        }
+    }
+    return calls;
+}
+
+void StaticBatcher::addNormals(MeshLookup lookup)
+{
+    // The rebuild in progress staged no normals, it starts over
+    if (current >= 0)
+    {
+        batches[current].dirty = true;
+        current = -1;
+    }
+    for (size_t b = 0; b < batches.size(); b++)
+    {
+        if (batches[b].everBuilt && !batches[b].hasNormals)
+            batches[b].dirty = true;
+    }
+    size_t budget = vertexBudget;
+    vertexBudget = (size_t) -1;
+    step(lookup);
+    vertexBudget = budget;
+}
+
+bool StaticBatcher::building() const
+{
+    for (size_t b = 0; b < batches.size(); b++)
+    {
+        if (batches[b].dirty && !batches[b].everBuilt)
+            return true;
+    }
+    return current >= 0 && !batches[current].everBuilt;
+}
+
+size_t StaticBatcher::mergedInstances() const
+{
+    size_t merged = 0;
+    for (size_t b = 0; b < batches.size(); b++)
+    {
+        for (size_t m = 0; m < batches[b].members.size(); m++)
+        {
+            if (batches[b].members[m].live && batches[b].members[m].onGpu)
+                merged++;
+        }
+    }
+    return merged;
+}
+
+void StaticBatcher::log(std::ostream &out) const
+{
+    size_t bytes = 0;
+    size_t members = 0;
+    for (size_t b = 0; b < batches.size(); b++)
+    {
+        bytes += batches[b].positions.bytes + batches[b].normals.bytes + batches[b].colors.bytes + batches[b].indices.bytes;
+        members += batches[b].members.size();
+    }
+    size_t merged = mergedInstances();
+    out << "Static batches: " << cells.size() << " cells, " << merged << " instances merged, " << members - merged
+        << " pending or leaving, " << rebuilds << " rebuilds, " << unmerges << " unmerges, " << bytes << " B on the GPU" << std::endl;
+}
+
+void StaticBatcher::free()
+{
+    for (size_t b = 0; b < batches.size(); b++)
+    {
+        Batch &batch = batches[b];
+        if (!batch.everBuilt)
+            continue;
+        batch.vertexArray.free();
+        batch.positions.free();
+        batch.normals.free();
+        batch.colors.free();
+        batch.indices.free();
+    }
+    batches.clear();
+    cells.clear();
+    freeBatches.clear();
+    tracks.clear();
+    current = -1;
+}
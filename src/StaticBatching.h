@@ -0,0 +1,205 @@
+#ifndef STATIC_BATCHING_H
+#define STATIC_BATCHING_H
+
+#include "Helpers.h"
+#include "Transform.h"
+
+#include <cstddef>
+#include <ostream>
+#include <vector>
+
+// CPU geometry of one mesh, the indices are numbered from its first vertex
+struct BatchMesh
+{
+    const float *positions;
+    // NULL while no program reads the normals
+    const float *normals;
+    const unsigned int *indices;
+    unsigned int vertexCount;
+    unsigned int indexCount;
+    // Unique edges for the wireframe, two indices each
+    const unsigned int *edges;
+    unsigned int edgeCount;
+};
+
+// What the batcher needs to know about an instance every frame
+struct BatchInstance
+{
+    unsigned int id;
+    unsigned int object;
+    unsigned int vertexCount;
+    const AffineMatrix *world;
+    const Eigen::Matrix3f *normal;
+    const float *color;
+    // Center of the mesh in model space, places the instance in a cell
+    const Eigen::Vector3f *center;
+    // False while selected or when the mesh has no CPU copy
+    bool canMerge;
+};
+
+// Instances that stopped moving, merged per cell of a uniform grid into
+// one geometry already transformed to world space. A cell costs one draw
+// per contiguous run of merged instances instead of one per instance, and
+// no record of its own: the batches share an identity one.
+//
+// An instance is
+//  - dynamic: drawn on its own. After settleFrames frames without moving
+//    it joins the batch of its cell as pending.
+//  - pending: still drawn on its own until the rebuild of its batch, done
+//    vertexBudget vertices per frame, uploads it.
+//  - merged: drawn by its batch. Moving, selecting or deleting it takes it
+//    out right away by skipping its index range, the batch is then
+//    rebuilt without it in the background.
+// A batch left without members frees its buffers and its cell, the slot
+// is reused by the next new cell.
+class StaticBatcher
+{
+public:
+    // CPU geometry of an object, false if it has none
+    typedef bool (*MeshLookup)(unsigned int object, BatchMesh &mesh);
+
+    bool enabled;
+    float cellSize;
+    unsigned int settleFrames;
+    // Vertices transformed per frame by the rebuilds
+    size_t vertexBudget;
+    // Instances stay dynamic once their batch would exceed this
+    unsigned int maxBatchVertices;
+
+    size_t rebuilds;
+    size_t unmerges;
+
+    StaticBatcher();
+
+    // Attribute locations of the programs the batches are drawn with,
+    // idLocation is the integer attribute of the id pass
+    void init(GLuint positionLocation, GLuint normalLocation, GLuint colorLocation, GLuint idLocation);
+
+    // Report an instance once per frame, returns true when its batch draws it
+    bool track(const BatchInstance &instance);
+
+    // Take an instance out of its batch, it has to settle again to come back
+    void unmerge(unsigned int instance);
+
+    // Unmerge a deleted instance and forget it, its id may be reused
+    void forget(unsigned int instance);
+
+    // Advance the rebuilds by vertexBudget vertices. Binds the vertex
+    // arrays of the batches it uploads.
+    void step(MeshLookup lookup);
+
+    // Draw the merged instances with the bound program and Draw record,
+    // GL_LINES draws their edges. perInstance draws them one by one with
+    // their id as the value of the attribute idLocation.
+    // Binds the vertex arrays of the batches, returns the draw calls.
+    size_t draw(GLenum mode, bool perInstance);
+
+    // The lookup now gives normals: rebuild the batches built without
+    // them right away, whatever vertexBudget says. Binds the vertex arrays
+    // of the batches.
+    void addNormals(MeshLookup lookup);
+
+    // Whether some batch still waits for its first build
+    bool building() const;
+
+    size_t mergedInstances() const;
+
+    void log(std::ostream &out) const;
+
+    void free();
+
+private:
+    struct Member
+    {
+        unsigned int instance;
+        unsigned int object;
+        float world[12];
+        float normal[9];
+        float color[3];
+        unsigned int vertexCount;
+        // Range in the indices of the batch, while onGpu
+        unsigned int firstIndex;
+        unsigned int indexCount;
+        // Range of the edges, after the triangles of all the members
+        unsigned int firstEdge;
+        unsigned int edgeCount;
+        // Still in the batch, a member leaves at the next rebuild
+        bool live;
+        bool onGpu;
+        // Written by the rebuild in progress
+        bool built;
+    };
+
+    struct Batch
+    {
+        std::vector<Member> members;
+        VertexArrayObject vertexArray;
+        VertexBufferObject positions;
+        VertexBufferObject normals;
+        VertexBufferObject colors;
+        IndexBufferObject indices;
+        // Vertices of the live members, bounded by maxBatchVertices
+        unsigned int liveVertices;
+        // Indices uploaded, 0 before the first build
+        unsigned int indexCount;
+        // Whether the last build had normals
+        bool hasNormals;
+        bool dirty;
+        bool everBuilt;
+        // Key of its cell
+        unsigned long long cell;
+    };
+
+    struct Cell
+    {
+        unsigned long long key;
+        int batch;
+
+        Cell(unsigned long long key, int batch) : key(key), batch(batch) {}
+    };
+
+    struct Track
+    {
+        float world[12];
+        float color[3];
+        unsigned int still;
+        // Batch and member, -1 while dynamic
+        int batch;
+        int member;
+    };
+
+    GLuint positionLocation;
+    GLuint normalLocation;
+    GLuint colorLocation;
+    GLuint idLocation;
+    std::vector<Batch> batches;
+    // Sorted by key, reserved with the tracks so that a new cell does not
+    // allocate once the scene is loaded
+    std::vector<Cell> cells;
+    // Slots of the batches released once empty
+    std::vector<int> freeBatches;
+    // Indexed by instance id
+    std::vector<Track> tracks;
+
+    // Rebuild in progress, -1 if none, its next member and the number of
+    // members it started with
+    int current;
+    size_t next;
+    size_t rebuildMembers;
+    // Geometry of the rebuild, kept between rebuilds
+    std::vector<float> stagedPositions;
+    std::vector<float> stagedNormals;
+    std::vector<float> stagedColors;
+    std::vector<unsigned int> stagedIndices;
+    std::vector<unsigned int> stagedEdges;
+
+    unsigned long long cellOf(const BatchInstance &instance) const;
+    // First cell with a key not below key
+    std::vector<Cell>::iterator findCell(unsigned long long key);
+    bool join(const BatchInstance &instance);
+    void append(Member &member, const BatchMesh &mesh);
+    void finish(Batch &batch);
+    void release(int index);
+};
+
+#endif
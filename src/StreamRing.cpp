@@ -0,0 +1,162 @@
+#include "StreamRing.h"
+#include "GLCapture.h"
+#include "Profiling.h"
+
+#include <iostream>
+
+// Longest single wait for a fence, waits are repeated until it is signaled
+static const GLuint64 FENCE_TIMEOUT_NS = 1000000000ULL;
+
+StreamRing::StreamRing()
+    : mode(ORPHANING), target(GL_ARRAY_BUFFER), id(0), sections(0), sectionBytes(0), section(0), category(GPU_VERTEX_BUFFERS),
+      stalls(0), stallMs(0.0), streamedThisFrame(0), streamedPeakFrame(0), streamedTotal(0), frames(0), mapped(NULL)
+{
+    for (unsigned int i = 0; i < MAX_SECTIONS; i++)
+        fences[i] = 0;
+}
+
+bool StreamRing::persistentSupported()
+{
+#ifdef __APPLE__
+    return false;
+#else
+    return GLCapture::backend == GLCapture::NATIVE_BACKEND && !GLCapture::capturing()
+        && (GLEW_ARB_buffer_storage || GLEW_VERSION_4_4);
+#endif
+}
+
+void StreamRing::init(GLenum target, size_t sectionBytes, unsigned int sections, MemoryCategory category)
+{
+    this->target = target;
+    this->sections = sections < MAX_SECTIONS ? sections : MAX_SECTIONS;
+    this->category = category;
+    mode = persistentSupported() ? PERSISTENT : ORPHANING;
+    section = 0;
+    allocate(sectionBytes);
+}
+
+void *StreamRing::begin(size_t bytes)
+{
+    if (bytes > sectionBytes)
+    {
+        // The old buffer stays alive on the GPU until the draws reading it are done
+        release();
+        allocate(bytes > 2 * sectionBytes ? bytes : 2 * sectionBytes);
+    }
+    section = (section + 1) % sections;
+    if (mode == ORPHANING)
+        return staging.data();
+
+    GLsync &sync = fences[section];
+    if (sync)
+    {
+        if (glClientWaitSync(sync, 0, 0) == GL_TIMEOUT_EXPIRED)
+        {
+            // The GPU is more than sections - 1 frames behind
+            ProfileClock::time_point start = ProfileClock::now();
+            GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+            while (glClientWaitSync(sync, flags, FENCE_TIMEOUT_NS) == GL_TIMEOUT_EXPIRED)
+                flags = 0;
+            stalls++;
+            stallMs += elapsedMs(start, ProfileClock::now());
+        }
+        glDeleteSync(sync);
+        sync = 0;
+    }
+    return mapped + section * sectionBytes;
+}
+
+size_t StreamRing::end(size_t bytes)
+{
+    streamedThisFrame += bytes;
+    memoryStats.uploaded(bytes);
+    if (mode == PERSISTENT)
+        return section * sectionBytes;
+
+    // A new store for the buffer, the one the GPU reads is left alone
+    GLCapture::bindBuffer(target, id);
+    GLCapture::bufferData(target, sectionBytes, NULL, GL_STREAM_DRAW);
+    if (bytes > 0)
+        GLCapture::bufferSubData(target, 0, bytes, staging.data());
+    check_gl_error();
+    return 0;
+}
+
+void StreamRing::fence()
+{
+    if (mode == PERSISTENT)
+        fences[section] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void StreamRing::endFrame()
+{
+    if (streamedThisFrame > streamedPeakFrame)
+        streamedPeakFrame = streamedThisFrame;
+    streamedTotal += streamedThisFrame;
+    streamedThisFrame = 0;
+    frames++;
+}
+
+void StreamRing::free()
+{
+    release();
+    sectionBytes = 0;
+}
+
+void StreamRing::allocate(size_t sectionBytes)
+{
+    this->sectionBytes = sectionBytes;
+    // Orphaning re-specifies one section at a time, the driver keeps the older stores
+    size_t size = mode == PERSISTENT ? sections * sectionBytes : sectionBytes;
+    GLCapture::genBuffer(&id);
+    GLCapture::bindBuffer(target, id);
+    if (mode == PERSISTENT)
+    {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(target, size, NULL, flags);
+        // A failed glBufferStorage leaves the buffer empty
+        GLint64 stored = 0;
+        glGetBufferParameteri64v(target, GL_BUFFER_SIZE, &stored);
+        if (stored == (GLint64) size)
+            mapped = static_cast<char *>(glMapBufferRange(target, 0, size, flags));
+        if (!mapped)
+        {
+            // Out of memory or refused by the driver: the storage is
+            // immutable, so orphaning starts over with a new buffer
+            std::cerr << "Could not map the stream buffer, falling back to orphaning" << std::endl;
+            GLCapture::deleteBuffer(&id);
+            mode = ORPHANING;
+            size = sectionBytes;
+            GLCapture::genBuffer(&id);
+            GLCapture::bindBuffer(target, id);
+        }
+    }
+    if (mode == ORPHANING)
+    {
+        GLCapture::bufferData(target, size, NULL, GL_STREAM_DRAW);
+        staging.resize(sectionBytes);
+    }
+    memoryStats.resize(category, 0, size);
+    check_gl_error();
+}
+
+void StreamRing::release()
+{
+    for (unsigned int i = 0; i < MAX_SECTIONS; i++)
+    {
+        if (fences[i])
+            glDeleteSync(fences[i]);
+        fences[i] = 0;
+    }
+    if (!id)
+        return;
+    if (mapped)
+    {
+        GLCapture::bindBuffer(target, id);
+        glUnmapBuffer(target);
+        mapped = NULL;
+    }
+    GLCapture::deleteBuffer(&id);
+    memoryStats.resize(category, mode == PERSISTENT ? sections * sectionBytes : sectionBytes, 0);
+    id = 0;
+}
@@ -0,0 +1,84 @@
+#ifndef STREAM_RING_H
+#define STREAM_RING_H
+
+#include "Helpers.h"
+#include "MemoryStats.h"
+
+#include <cstddef>
+#include <vector>
+
+// Buffer streaming data that changes every frame. The buffer is cut into
+// sections used in turn: the CPU writes one while the GPU still reads the
+// older ones, a fence placed after the draws of a section tells when it can
+// be written again.
+//
+// With ARB_buffer_storage the buffer is mapped once, persistently and
+// coherently, and written in place. Otherwise (GL 3.2, null backend, or a
+// GL capture, which cannot see writes through a mapping) the data is
+// staged on the CPU and uploaded after orphaning the buffer, the driver
+// then handles the synchronization.
+class StreamRing
+{
+public:
+    enum Mode
+    {
+        PERSISTENT,
+        ORPHANING
+    };
+
+    static const unsigned int MAX_SECTIONS = 4;
+
+    Mode mode;
+    GLenum target;
+    GLuint id;
+    unsigned int sections;
+    size_t sectionBytes;
+    // Section written since the last begin()
+    unsigned int section;
+    // Category the buffer is accounted in
+    MemoryCategory category;
+
+    // Waits for the GPU in begin(), and their total duration
+    unsigned long long stalls;
+    double stallMs;
+    // Bytes written per frame
+    size_t streamedThisFrame;
+    size_t streamedPeakFrame;
+    size_t streamedTotal;
+    unsigned int frames;
+
+    StreamRing();
+
+    // Sections of at least sectionBytes, grown by begin() when needed
+    void init(GLenum target, size_t sectionBytes, unsigned int sections, MemoryCategory category);
+
+    // Memory to write bytes into, in the next section. Waits if the GPU
+    // still reads that section.
+    void *begin(size_t bytes);
+
+    // The bytes written since begin() are complete, returns their offset
+    // in the buffer
+    size_t end(size_t bytes);
+
+    // Put after the commands reading the section of the last begin()
+    void fence();
+
+    // Close the counters of the current frame
+    void endFrame();
+
+    // Whether the context supports the persistent mapping
+    static bool persistentSupported();
+
+    void free();
+
+private:
+    char *mapped;
+    GLsync fences[MAX_SECTIONS];
+    // CPU copy of a section in ORPHANING mode
+    std::vector<char> staging;
+
+    void allocate(size_t sectionBytes);
+    void release();
+};
+
+#endif
@@ -0,0 +1,224 @@
+#include "Transform.h"
+#include "Profiling.h"
+
+#include <Eigen/StdVector>
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+Transform::Transform()
+    : translation(Eigen::Vector3f::Zero()), rotation(Eigen::Quaternionf::Identity()),
+      scale(Eigen::Vector3f::Ones()), pivot(Eigen::Vector3f::Zero()), dirty(true)
+{
+}
+
+void Transform::translateBy(const Eigen::Vector3f &offset)
+{
+    translation += offset;
+    dirty = true;
+}
+
+void Transform::rotateBy(const Eigen::Quaternionf &change)
+{
+    // Renormalizing keeps the rotation exact after many edits
+    rotation = (change * rotation).normalized();
+    dirty = true;
+}
+
+void Transform::scaleBy(float factor)
+{
+    scale *= factor;
+    dirty = true;
+}
+
+void Transform::setMatrix(const AffineMatrix &matrix)
+{
+    Eigen::Matrix3f linear = matrix.leftCols<3>();
+    for (int k = 0; k < 3; k++)
+        scale[k] = linear.col(k).norm();
+    // A mirror is kept in the scale so that the rest is a rotation
+    if (linear.determinant() < 0)
+        scale[0] = -scale[0];
+    Eigen::Matrix3f orientation = linear * scale.cwiseInverse().asDiagonal();
+    rotation = Eigen::Quaternionf(orientation).normalized();
+    translation = matrix.col(3) + linear * pivot;
+    dirty = true;
+}
+
+AffineMatrix Transform::compose(const AffineMatrix &a, const AffineMatrix &b)
+{
+    AffineMatrix result;
+    result.leftCols<3>().noalias() = a.leftCols<3>() * b.leftCols<3>();
+    result.col(3).noalias() = a.leftCols<3>() * b.col(3);
+    result.col(3) += a.col(3);
+    return result;
+}
+
+AffineMatrix Transform::inverse(const AffineMatrix &matrix)
+{
+    AffineMatrix result;
+    Eigen::Matrix3f linear = matrix.leftCols<3>().inverse();
+    result.leftCols<3>() = linear;
+    result.col(3) = -linear * matrix.col(3);
+    return result;
+}
+
+Eigen::Matrix3f Transform::normalMatrix(const AffineMatrix &world, bool similarity)
+{
+    // (s R)^-T = R / s = (s R) / s^2
+    if (similarity)
+        return world.leftCols<3>() / world.col(0).squaredNorm();
+
+    // The inverse transpose is the cofactor matrix divided by the determinant
+    Eigen::Vector3f c0 = world.col(0);
+    Eigen::Vector3f c1 = world.col(1);
+    Eigen::Vector3f c2 = world.col(2);
+    Eigen::Matrix3f result;
+    result.col(0) = c1.cross(c2);
+    result.col(1) = c2.cross(c0);
+    result.col(2) = c0.cross(c1);
+    return result / c0.dot(result.col(0));
+}
+
+void Transform::rebuild()
+{
+    Eigen::Matrix3f linear = rotation.toRotationMatrix() * scale.asDiagonal();
+    cached.leftCols<3>() = linear;
+    cached.col(3) = translation - linear * pivot;
+    dirty = false;
+}
+
+Eigen::Matrix4f Transform::model()
+{
+    Eigen::Matrix4f model;
+    model.topRows<3>() = world();
+    model.row(3) << 0, 0, 0, 1;
+    return model;
+}
+
+Eigen::Matrix4f Transform::mvp(const Eigen::Matrix4f &viewProjection, const AffineMatrix &world)
+{
+    // Column by column, each one a combination of the first three columns of
+    // viewProjection, the implicit row only adds the last one to the translation
+    Eigen::Matrix4f mvp;
+    for (int j = 0; j < 4; j++)
+        mvp.col(j) = viewProjection.col(0) * world(0, j) + viewProjection.col(1) * world(1, j) + viewProjection.col(2) * world(2, j);
+    mvp.col(3) += viewProjection.col(3);
+    return mvp;
+}
+
+// The previous instance layout: base and accumulated matrices for the
+// model and the MVP, every edit multiplied into both
+class MatrixTransform
+{
+public:
+    Eigen::Matrix4f baseMVP;
+    Eigen::Matrix4f transformationMVP;
+    Eigen::Matrix4f baseModel;
+    Eigen::Matrix4f transformationModel;
+};
+
+// change applied around pivot instead of the origin
+static Eigen::Matrix4f pivoted(const Eigen::Matrix4f &change, const Eigen::Vector3f &pivot)
+{
+    Eigen::Affine3f around = Eigen::Translation3f(pivot) * Eigen::Affine3f(change) * Eigen::Translation3f(-pivot);
+    return around.matrix();
+}
+
+void Transform::benchmark(unsigned int updates)
+{
+    const unsigned int instances = 1024;
+    // Every instance turns a multiple of 36 times 10 degrees, back to where it started
+    unsigned int rounds = std::max(1u, updates / (36 * instances)) * 36;
+    Eigen::Matrix4f viewProjection = Eigen::Matrix4f::Identity();
+    viewProjection(3, 2) = -1;
+    viewProjection(2, 3) = -0.2f;
+    Eigen::Quaternionf step(Eigen::AngleAxisf(10 * M_PI / 180, Eigen::Vector3f::UnitZ()));
+
+    std::vector<MatrixTransform, Eigen::aligned_allocator<MatrixTransform> > matrices;
+    std::vector<Transform, Eigen::aligned_allocator<Transform> > transforms(instances);
+    std::vector<Eigen::Matrix4f, Eigen::aligned_allocator<Eigen::Matrix4f> > steps(instances, Eigen::Matrix4f::Identity());
+    for (unsigned int i = 0; i < instances; i++)
+    {
+        Eigen::Vector3f position = Eigen::Vector3f::Random();
+        transforms[i].translation = position;
+        transforms[i].pivot = position;
+        transforms[i].scale.setConstant(0.5f + i % 4);
+        MatrixTransform initial;
+        initial.baseModel = transforms[i].model();
+        initial.baseMVP = viewProjection * initial.baseModel;
+        initial.transformationModel = Eigen::Matrix4f::Identity();
+        initial.transformationMVP = Eigen::Matrix4f::Identity();
+        matrices.push_back(initial);
+        steps[i] = pivoted(Eigen::Affine3f(step).matrix(), position);
+    }
+    Eigen::Matrix4f sink = Eigen::Matrix4f::Zero();
+
+    // Edits: the old layout multiplies into both accumulated matrices,
+    // the new one composes the rotation and rebuilds the cached matrix
+    ProfileClock::time_point start = ProfileClock::now();
+    for (unsigned int round = 0; round < rounds; round++)
+    {
+        for (unsigned int i = 0; i < instances; i++)
+        {
+            matrices[i].transformationMVP = steps[i] * matrices[i].transformationMVP;
+            matrices[i].transformationModel = steps[i] * matrices[i].transformationModel;
+        }
+    }
+    double matrixEditMs = elapsedMs(start, ProfileClock::now());
+    start = ProfileClock::now();
+    for (unsigned int round = 0; round < rounds; round++)
+    {
+        for (unsigned int i = 0; i < instances; i++)
+        {
+            transforms[i].rotateBy(step);
+            sink(0, 0) += transforms[i].world()(0, 0);
+        }
+    }
+    double transformEditMs = elapsedMs(start, ProfileClock::now());
+
+    // Draws: the MVP and model matrices uploaded for every instance
+    start = ProfileClock::now();
+    for (unsigned int round = 0; round < rounds; round++)
+    {
+        for (unsigned int i = 0; i < instances; i++)
+        {
+            sink += matrices[i].transformationMVP * matrices[i].baseMVP;
+            sink += matrices[i].transformationModel * matrices[i].baseModel;
+        }
+    }
+    double matrixDrawMs = elapsedMs(start, ProfileClock::now());
+    start = ProfileClock::now();
+    for (unsigned int round = 0; round < rounds; round++)
+    {
+        for (unsigned int i = 0; i < instances; i++)
+        {
+            sink += mvp(viewProjection, transforms[i].world());
+            sink += transforms[i].model();
+        }
+    }
+    double transformDrawMs = elapsedMs(start, ProfileClock::now());
+
+    float matrixDrift = 0.0f;
+    float transformDrift = 0.0f;
+    for (unsigned int i = 0; i < instances; i++)
+    {
+        Eigen::Matrix4f model = matrices[i].transformationModel * matrices[i].baseModel;
+        matrixDrift = std::max(matrixDrift, (model - matrices[i].baseModel).cwiseAbs().maxCoeff());
+        transformDrift = std::max(transformDrift, (transforms[i].model() - matrices[i].baseModel).cwiseAbs().maxCoeff());
+    }
+
+    double count = (double) rounds * instances;
+    std::cout << "Transform benchmark, " << instances << " instances rotated " << rounds << " times" << std::endl;
+    std::cout << "  4x4 matrices: " << sizeof(MatrixTransform) << " B per instance, "
+              << 1e6 * matrixEditMs / count << " ns per edit, " << 1e6 * matrixDrawMs / count
+              << " ns per draw, drift " << matrixDrift << std::endl;
+    std::cout << "  TRS + cached 3x4: " << sizeof(Transform) << " B per instance, "
+              << 1e6 * transformEditMs / count << " ns per edit, " << 1e6 * transformDrawMs / count
+              << " ns per draw, drift " << transformDrift << std::endl;
+    // Keep the results alive
+    if (sink(0, 0) == 12345.0f)
+        std::cout << std::endl;
+}
@@ -0,0 +1,77 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+// Must come before Eigen, see AllocTracker.h
+#include "AllocTracker.h"
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+// 3x4 affine matrix, the last row (0 0 0 1) is implicit
+typedef Eigen::Matrix<float, 3, 4> AffineMatrix;
+
+// Placement of an instance as translation, rotation and scale.
+// The world matrix T * R * S * T(-pivot) is cached and only rebuilt after a
+// change. Edits compose on the components, so no error accumulates in a
+// matrix over long editing sessions.
+class Transform
+{
+public:
+    Eigen::Vector3f translation;
+    Eigen::Quaternionf rotation;
+    Eigen::Vector3f scale;
+    // Point of the mesh that lands on translation, rotations and scales keep it in place
+    Eigen::Vector3f pivot;
+
+    Transform();
+
+    // Move by offset in world space
+    void translateBy(const Eigen::Vector3f &offset);
+
+    // Apply a world space rotation around translation
+    void rotateBy(const Eigen::Quaternionf &change);
+
+    // Scale every axis by factor around translation
+    void scaleBy(float factor);
+
+    // Closest translation, rotation and scale giving matrix around the
+    // current pivot, a shear (from a non uniform scale under a rotation) is lost
+    void setMatrix(const AffineMatrix &matrix);
+
+    // Cached world matrix
+    const AffineMatrix &world() { if (dirty) rebuild(); return cached; }
+
+    // World matrix as the 4x4 expected by the shader
+    Eigen::Matrix4f model();
+
+    // a * b, both affine
+    static AffineMatrix compose(const AffineMatrix &a, const AffineMatrix &b);
+
+    // Inverse of an affine matrix
+    static AffineMatrix inverse(const AffineMatrix &matrix);
+
+    // Same scale on every axis, rotations then keep angles
+    bool uniformScale() const { return scale.x() == scale.y() && scale.y() == scale.z(); }
+
+    // Inverse transpose of the linear part, transforms the normals of the mesh.
+    // A rotation with a uniform scale (similarity) only needs a division,
+    // otherwise it comes from the cofactors.
+    static Eigen::Matrix3f normalMatrix(const AffineMatrix &world, bool similarity);
+
+    // viewProjection * world, without the products with the implicit row
+    static Eigen::Matrix4f mvp(const Eigen::Matrix4f &viewProjection, const AffineMatrix &world);
+
+    // Time the update and upload of this layout against accumulated 4x4
+    // matrices and print the result
+    static void benchmark(unsigned int updates);
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+private:
+    AffineMatrix cached;
+    bool dirty;
+
+    void rebuild();
+};
+
+#endif
@@ -0,0 +1,379 @@
+#include "TransformKernels.h"
+#include "Transform.h"
+#include "Profiling.h"
+
+#include <Eigen/StdVector>
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+#ifdef TRANSFORM_KERNELS_X86
+#  if defined(_MSC_VER)
+#    include <intrin.h>
+#    include <immintrin.h>
+#  else
+#    include <cpuid.h>
+#  endif
+#endif
+
+namespace TransformKernels
+{
+    static const MultiplyAffineFunction multiplyAffineFunctions[ISA_COUNT] =
+    {
+        multiplyAffineScalar, multiplyAffineSSE4, multiplyAffineAVX2, multiplyAffineAVX512
+    };
+    static const TransformBoundsFunction transformBoundsFunctions[ISA_COUNT] =
+    {
+        transformBoundsScalar, transformBoundsSSE4, transformBoundsAVX2, transformBoundsAVX512
+    };
+    static const char *names[ISA_COUNT] = {"scalar", "sse4", "avx2", "avx512"};
+
+    static Isa current = detect();
+}
+
+#ifdef TRANSFORM_KERNELS_X86
+
+static void cpuid(unsigned int leaf, unsigned int subleaf, unsigned int registers[4])
+{
+#if defined(_MSC_VER)
+    int values[4];
+    __cpuidex(values, (int) leaf, (int) subleaf);
+    for (int i = 0; i < 4; i++)
+        registers[i] = (unsigned int) values[i];
+#else
+    registers[0] = registers[1] = registers[2] = registers[3] = 0;
+    __get_cpuid_count(leaf, subleaf, &registers[0], &registers[1], &registers[2], &registers[3]);
+#endif
+}
+
+// Register state the OS saves on context switches (XCR0)
+static unsigned long long enabledState()
+{
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    unsigned int low, high;
+    __asm__ volatile("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+    return ((unsigned long long) high << 32) | low;
+#endif
+}
+
+bool TransformKernels::supported(Isa isa)
+{
+    unsigned int leaf1[4];
+    unsigned int leaf7[4];
+    cpuid(0, 0, leaf1);
+    unsigned int maxLeaf = leaf1[0];
+    cpuid(1, 0, leaf1);
+    if (maxLeaf >= 7)
+        cpuid(7, 0, leaf7);
+    else
+        leaf7[0] = leaf7[1] = leaf7[2] = leaf7[3] = 0;
+
+    bool sse41 = (leaf1[2] >> 19) & 1;
+    bool osxsave = (leaf1[2] >> 27) & 1;
+    unsigned long long state = osxsave ? enabledState() : 0;
+    // SSE and AVX registers, then the AVX-512 mask and upper registers
+    bool avxState = (state & 0x6) == 0x6;
+    bool avx512State = (state & 0xE6) == 0xE6;
+    bool avx2 = avxState && ((leaf1[2] >> 28) & 1) && ((leaf1[2] >> 12) & 1) && ((leaf7[1] >> 5) & 1);
+    bool avx512 = avx512State && ((leaf7[1] >> 16) & 1);
+    switch (isa)
+    {
+        case SCALAR:
+            return true;
+        case SSE4:
+            return sse41;
+        case AVX2:
+            return sse41 && avx2;
+        case AVX512:
+            return sse41 && avx2 && avx512;
+        default:
+            return false;
+    }
+}
+
+#else
+
+bool TransformKernels::supported(Isa isa)
+{
+    return isa == SCALAR;
+}
+
+#endif
+
+TransformKernels::Isa TransformKernels::detect()
+{
+    for (int isa = ISA_COUNT - 1; isa > SCALAR; isa--)
+    {
+        if (supported((Isa) isa))
+            return (Isa) isa;
+    }
+    return SCALAR;
+}
+
+TransformKernels::Isa TransformKernels::selected()
+{
+    return current;
+}
+
+bool TransformKernels::select(Isa isa)
+{
+    if (!supported(isa))
+        return false;
+    current = isa;
+    return true;
+}
+
+const char *TransformKernels::name(Isa isa)
+{
+    return names[isa];
+}
+
+bool TransformKernels::fromName(const char *text, Isa &isa)
+{
+    for (int i = 0; i < ISA_COUNT; i++)
+    {
+        if (strcmp(text, names[i]) == 0)
+        {
+            isa = (Isa) i;
+            return true;
+        }
+    }
+    return false;
+}
+
+void TransformKernels::multiplyAffine(const float *viewProjection, const float *worlds, size_t count, float *out)
+{
+    multiplyAffineFunctions[current](viewProjection, worlds, count, out);
+}
+
+void TransformKernels::transformBounds(const float *worlds, const float *boxes, size_t count, float *out)
+{
+    transformBoundsFunctions[current](worlds, boxes, count, out);
+}
+
+void TransformKernels::multiplyAffineScalar(const float *viewProjection, const float *worlds, size_t count, float *out)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        const float *w = worlds + 12 * i;
+        float *o = out + 16 * i;
+        for (int j = 0; j < 4; j++)
+        {
+            for (int r = 0; r < 4; r++)
+            {
+                float value = viewProjection[r] * w[3 * j] + viewProjection[4 + r] * w[3 * j + 1] + viewProjection[8 + r] * w[3 * j + 2];
+                o[4 * j + r] = j == 3 ? value + viewProjection[12 + r] : value;
+            }
+        }
+    }
+}
+
+void TransformKernels::transformBoundsScalar(const float *worlds, const float *boxes, size_t count, float *out)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        const float *w = worlds + 12 * i;
+        const float *b = boxes + 8 * i;
+        float *o = out + 8 * i;
+        float center[3], extent[3];
+        for (int k = 0; k < 3; k++)
+        {
+            center[k] = 0.5f * (b[k] + b[4 + k]);
+            extent[k] = 0.5f * (b[4 + k] - b[k]);
+        }
+        for (int r = 0; r < 3; r++)
+        {
+            float newCenter = w[9 + r] + w[r] * center[0] + w[3 + r] * center[1] + w[6 + r] * center[2];
+            float newExtent = std::fabs(w[r]) * extent[0] + std::fabs(w[3 + r]) * extent[1] + std::fabs(w[6 + r]) * extent[2];
+            o[r] = newCenter - newExtent;
+            o[4 + r] = newCenter + newExtent;
+        }
+        o[3] = 0.0f;
+        o[7] = 0.0f;
+    }
+}
+
+typedef std::vector<AffineMatrix, Eigen::aligned_allocator<AffineMatrix> > AffineVector;
+typedef std::vector<Eigen::Matrix4f, Eigen::aligned_allocator<Eigen::Matrix4f> > MatrixVector;
+
+// Largest difference with the results of Eigen, relative to their magnitude
+static float compare(const float *result, const float *reference, size_t count)
+{
+    float error = 0.0f;
+    for (size_t i = 0; i < count; i++)
+        error = std::max(error, std::fabs(result[i] - reference[i]) / (1.0f + std::fabs(reference[i])));
+    return error;
+}
+
+// Random world matrices and boxes, and the results of Eigen for them
+struct TransformCase
+{
+    Eigen::Matrix4f viewProjection;
+    AffineVector worlds;
+    std::vector<float> boxes;
+    // Generic Eigen products, and the eight corners of every box
+    MatrixVector referenceMVP;
+    std::vector<float> referenceBounds;
+
+    explicit TransformCase(size_t count);
+};
+
+TransformCase::TransformCase(size_t count)
+    : viewProjection(Eigen::Matrix4f::Random()), boxes(8 * count, 0.0f),
+      referenceMVP(count, Eigen::Matrix4f::Zero()), referenceBounds(8 * count, 0.0f)
+{
+    worlds.reserve(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        Transform transform;
+        transform.translation = Eigen::Vector3f::Random();
+        transform.rotation = Eigen::Quaternionf(Eigen::Vector4f::Random()).normalized();
+        transform.scale = Eigen::Vector3f::Random().cwiseAbs() + Eigen::Vector3f::Constant(0.1f);
+        transform.pivot = Eigen::Vector3f::Random();
+        worlds.push_back(transform.world());
+        Eigen::Vector3f corner = Eigen::Vector3f::Random();
+        Eigen::Vector3f size = Eigen::Vector3f::Random().cwiseAbs();
+        for (int k = 0; k < 3; k++)
+        {
+            boxes[8 * i + k] = corner[k];
+            boxes[8 * i + 4 + k] = corner[k] + size[k];
+        }
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        Eigen::Matrix4f model = Eigen::Matrix4f::Identity();
+        model.topRows<3>() = worlds[i];
+        referenceMVP[i] = viewProjection * model;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        Eigen::Vector3f low = Eigen::Vector3f::Constant(INFINITY);
+        Eigen::Vector3f high = Eigen::Vector3f::Constant(-INFINITY);
+        for (int corner = 0; corner < 8; corner++)
+        {
+            Eigen::Vector3f point;
+            for (int k = 0; k < 3; k++)
+                point[k] = boxes[8 * i + ((corner >> k) & 1) * 4 + k];
+            Eigen::Vector3f transformed = worlds[i].leftCols<3>() * point + worlds[i].col(3);
+            low = low.cwiseMin(transformed);
+            high = high.cwiseMax(transformed);
+        }
+        for (int k = 0; k < 3; k++)
+        {
+            referenceBounds[8 * i + k] = low[k];
+            referenceBounds[8 * i + 4 + k] = high[k];
+        }
+    }
+}
+
+bool TransformKernels::check(size_t count)
+{
+    // Every tail a 16 wide kernel can leave, then a large batch
+    std::vector<size_t> counts;
+    for (size_t tail = 0; tail <= 33; tail++)
+        counts.push_back(tail);
+    counts.push_back(count);
+    TransformCase data(std::max(count, (size_t) 33));
+    const float *worldData = data.worlds[0].data();
+    // One guard matrix and box after the outputs, nothing may write there
+    const float GUARD = 12345.0f;
+    std::vector<float> mvp(16 * (data.worlds.size() + 1)), bounds(8 * (data.worlds.size() + 1));
+
+    bool correct = true;
+    std::cout << "Transform kernels against Eigen, batches of 0 to 33 and " << count << " matrices" << std::endl;
+    for (int isa = SCALAR; isa < ISA_COUNT; isa++)
+    {
+        if (!supported((Isa) isa))
+        {
+            std::cout << "  " << names[isa] << ": not supported" << std::endl;
+            continue;
+        }
+        float mvpError = 0.0f;
+        float boundsError = 0.0f;
+        size_t overruns = 0;
+        for (size_t c = 0; c < counts.size(); c++)
+        {
+            std::fill(mvp.begin(), mvp.end(), GUARD);
+            std::fill(bounds.begin(), bounds.end(), GUARD);
+            multiplyAffineFunctions[isa](data.viewProjection.data(), worldData, counts[c], &mvp[0]);
+            transformBoundsFunctions[isa](worldData, &data.boxes[0], counts[c], &bounds[0]);
+            mvpError = std::max(mvpError, compare(&mvp[0], data.referenceMVP[0].data(), 16 * counts[c]));
+            boundsError = std::max(boundsError, compare(&bounds[0], &data.referenceBounds[0], 8 * counts[c]));
+            for (int k = 0; k < 16; k++)
+                overruns += mvp[16 * counts[c] + k] != GUARD;
+            for (int k = 0; k < 8; k++)
+                overruns += bounds[8 * counts[c] + k] != GUARD;
+        }
+        bool ok = mvpError < 1e-5f && boundsError < 1e-5f && overruns == 0;
+        correct = correct && ok;
+        std::cout << "  " << names[isa] << ": error " << mvpError << " / " << boundsError << ", " << overruns
+                  << " floats written past the end" << (ok ? "" : " MISMATCH") << std::endl;
+    }
+    return correct;
+}
+
+bool TransformKernels::benchmark(size_t maxCount)
+{
+    bool correct = check(maxCount);
+
+    std::vector<size_t> counts;
+    for (size_t count = 10000; count < maxCount; count *= 10)
+        counts.push_back(count);
+    counts.push_back(maxCount);
+    TransformCase data(maxCount);
+    const Eigen::Matrix4f &viewProjection = data.viewProjection;
+    const AffineVector &worlds = data.worlds;
+
+    // The outputs are touched once so that page faults stay out of the timings
+    MatrixVector mvp(maxCount, Eigen::Matrix4f::Zero());
+    std::vector<float> bounds(8 * maxCount, 0.0f);
+    std::cout << "Transform kernels (selected: " << name(current) << ")" << std::endl;
+    std::cout << "  eigen, one product per instance:" << std::endl;
+    for (size_t c = 0; c < counts.size(); c++)
+    {
+        double best = INFINITY;
+        for (int run = 0; run < 3; run++)
+        {
+            ProfileClock::time_point start = ProfileClock::now();
+            for (size_t i = 0; i < counts[c]; i++)
+            {
+                Eigen::Matrix4f model;
+                model.topRows<3>() = worlds[i];
+                model.row(3) << 0, 0, 0, 1;
+                mvp[i].noalias() = viewProjection * model;
+            }
+            best = std::min(best, elapsedMs(start, ProfileClock::now()));
+        }
+        std::cout << "    " << counts[c] << ": " << 1e6 * best / counts[c] << " ns per MVP" << std::endl;
+    }
+    const float *worldData = worlds[0].data();
+    for (int isa = SCALAR; isa < ISA_COUNT; isa++)
+    {
+        if (!supported((Isa) isa))
+            continue;
+        std::cout << "  " << names[isa] << ":" << std::endl;
+        for (size_t c = 0; c < counts.size(); c++)
+        {
+            // Best of a few calls, ns per matrix
+            double bestMVP = INFINITY;
+            double bestBounds = INFINITY;
+            for (int run = 0; run < 3; run++)
+            {
+                ProfileClock::time_point start = ProfileClock::now();
+                multiplyAffineFunctions[isa](viewProjection.data(), worldData, counts[c], mvp[0].data());
+                ProfileClock::time_point middle = ProfileClock::now();
+                transformBoundsFunctions[isa](worldData, &data.boxes[0], counts[c], &bounds[0]);
+                bestMVP = std::min(bestMVP, elapsedMs(start, middle));
+                bestBounds = std::min(bestBounds, elapsedMs(middle, ProfileClock::now()));
+            }
+            std::cout << "    " << counts[c] << ": " << 1e6 * bestMVP / counts[c] << " ns per MVP, "
+                      << 1e6 * bestBounds / counts[c] << " ns per box" << std::endl;
+        }
+    }
+    return correct;
+}
@@ -0,0 +1,79 @@
+#ifndef TRANSFORM_KERNELS_H
+#define TRANSFORM_KERNELS_H
+
+#include <cstddef>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#  define TRANSFORM_KERNELS_X86
+#endif
+
+// Batched products of one view-projection with many affine world matrices,
+// and transformation of many bounding boxes.
+// Each instruction set has its own translation unit compiled with the
+// matching flags, the implementation is picked at runtime from cpuid.
+//
+// Layouts, all column-major floats:
+//  - view-projection: 16 floats
+//  - world matrices: 12 floats each (3x4, the row 0 0 0 1 is implicit),
+//    exactly the storage of a std::vector<AffineMatrix>
+//  - MVP matrices: 16 floats each
+//  - boxes: 8 floats each, min x y z and max x y z, each followed by one
+//    float of padding
+namespace TransformKernels
+{
+    enum Isa
+    {
+        SCALAR,
+        SSE4,
+        AVX2,
+        AVX512,
+        ISA_COUNT
+    };
+
+    // out[i] = viewProjection * worlds[i]
+    typedef void (*MultiplyAffineFunction)(const float *viewProjection, const float *worlds, size_t count, float *out);
+    // out[i] = axis aligned box around worlds[i] * boxes[i]
+    typedef void (*TransformBoundsFunction)(const float *worlds, const float *boxes, size_t count, float *out);
+
+    // Whether the CPU and the OS support the instruction set
+    bool supported(Isa isa);
+
+    // Best supported instruction set
+    Isa detect();
+
+    // Instruction set used by the functions below (detect() by default)
+    Isa selected();
+
+    // Use another instruction set, returns false if it is not supported
+    bool select(Isa isa);
+
+    // Lower case name, also accepted by fromName
+    const char *name(Isa isa);
+    bool fromName(const char *text, Isa &isa);
+
+    void multiplyAffine(const float *viewProjection, const float *worlds, size_t count, float *out);
+    void transformBounds(const float *worlds, const float *boxes, size_t count, float *out);
+
+    // Check every supported instruction set against Eigen on batches of 0
+    // to 33 matrices and of count, printing the errors. Returns false if a
+    // kernel disagrees with Eigen or writes past the end of its outputs.
+    bool check(size_t count);
+
+    // check(maxCount), then time every supported instruction set for
+    // batches from 10k matrices up to maxCount, printing the results.
+    // Returns false if a kernel disagrees with Eigen.
+    bool benchmark(size_t maxCount);
+
+    // Implementations, the SIMD ones are defined in TransformKernels<ISA>.cpp
+    // and fall back to the scalar ones outside of x86
+    void multiplyAffineScalar(const float *viewProjection, const float *worlds, size_t count, float *out);
+    void transformBoundsScalar(const float *worlds, const float *boxes, size_t count, float *out);
+    void multiplyAffineSSE4(const float *viewProjection, const float *worlds, size_t count, float *out);
+    void multiplyAffineAVX2(const float *viewProjection, const float *worlds, size_t count, float *out);
+    void multiplyAffineAVX512(const float *viewProjection, const float *worlds, size_t count, float *out);
+    void transformBoundsSSE4(const float *worlds, const float *boxes, size_t count, float *out);
+    void transformBoundsAVX2(const float *worlds, const float *boxes, size_t count, float *out);
+    void transformBoundsAVX512(const float *worlds, const float *boxes, size_t count, float *out);
+}
+
+#endif
@@ -0,0 +1,99 @@
+// Compiled with -mavx2 -mfma
+#include "TransformKernels.h"
+
+#ifdef TRANSFORM_KERNELS_X86
+
+#include <immintrin.h>
+
+static inline __m256 pair(__m128 low, __m128 high)
+{
+    return _mm256_insertf128_ps(_mm256_castps128_ps256(low), high, 1);
+}
+
+// Two columns of the MVP per register: the world coefficients are spread
+// over each half with a permutation of the loaded matrix
+void TransformKernels::multiplyAffineAVX2(const float *viewProjection, const float *worlds, size_t count, float *out)
+{
+    __m128 c3 = _mm_loadu_ps(viewProjection + 12);
+    __m256 c0 = _mm256_broadcast_ps((const __m128 *) viewProjection);
+    __m256 c1 = _mm256_broadcast_ps((const __m128 *) (viewProjection + 4));
+    __m256 c2 = _mm256_broadcast_ps((const __m128 *) (viewProjection + 8));
+    __m256 translation = pair(_mm_setzero_ps(), c3);
+    // Columns 0 and 1 come from w[0..7], columns 2 and 3 from w[4..11]
+    const __m256i row0 = _mm256_setr_epi32(0, 0, 0, 0, 3, 3, 3, 3);
+    const __m256i row1 = _mm256_setr_epi32(1, 1, 1, 1, 4, 4, 4, 4);
+    const __m256i row2 = _mm256_setr_epi32(2, 2, 2, 2, 5, 5, 5, 5);
+    const __m256i row0High = _mm256_setr_epi32(2, 2, 2, 2, 5, 5, 5, 5);
+    const __m256i row1High = _mm256_setr_epi32(3, 3, 3, 3, 6, 6, 6, 6);
+    const __m256i row2High = _mm256_setr_epi32(4, 4, 4, 4, 7, 7, 7, 7);
+    for (size_t i = 0; i < count; i++)
+    {
+        const float *w = worlds + 12 * i;
+        float *o = out + 16 * i;
+        __m256 first = _mm256_loadu_ps(w);
+        __m256 second = _mm256_loadu_ps(w + 4);
+
+        __m256 columns = _mm256_mul_ps(c0, _mm256_permutevar8x32_ps(first, row0));
+        columns = _mm256_fmadd_ps(c1, _mm256_permutevar8x32_ps(first, row1), columns);
+        columns = _mm256_fmadd_ps(c2, _mm256_permutevar8x32_ps(first, row2), columns);
+        _mm256_storeu_ps(o, columns);
+
+        columns = _mm256_fmadd_ps(c0, _mm256_permutevar8x32_ps(second, row0High), translation);
+        columns = _mm256_fmadd_ps(c1, _mm256_permutevar8x32_ps(second, row1High), columns);
+        columns = _mm256_fmadd_ps(c2, _mm256_permutevar8x32_ps(second, row2High), columns);
+        _mm256_storeu_ps(o + 8, columns);
+    }
+}
+
+// Two boxes per register, the remaining one goes through the SSE4 kernel
+void TransformKernels::transformBoundsAVX2(const float *worlds, const float *boxes, size_t count, float *out)
+{
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    const __m256 zero = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2)
+    {
+        const float *w = worlds + 12 * i;
+        const float *b = boxes + 8 * i;
+        float *o = out + 8 * i;
+        __m256 col0 = pair(_mm_loadu_ps(w), _mm_loadu_ps(w + 12));
+        __m256 col1 = pair(_mm_loadu_ps(w + 3), _mm_loadu_ps(w + 15));
+        __m256 col2 = pair(_mm_loadu_ps(w + 6), _mm_loadu_ps(w + 18));
+        __m256 translation = pair(_mm_loadu_ps(w + 8), _mm_loadu_ps(w + 20));
+        translation = _mm256_permute_ps(translation, _MM_SHUFFLE(3, 3, 2, 1));
+        __m256 low = pair(_mm_loadu_ps(b), _mm_loadu_ps(b + 8));
+        __m256 high = pair(_mm_loadu_ps(b + 4), _mm_loadu_ps(b + 12));
+        __m256 center = _mm256_mul_ps(_mm256_add_ps(low, high), half);
+        __m256 extent = _mm256_mul_ps(_mm256_sub_ps(high, low), half);
+
+        __m256 newCenter = _mm256_fmadd_ps(col0, _mm256_permute_ps(center, _MM_SHUFFLE(0, 0, 0, 0)), translation);
+        newCenter = _mm256_fmadd_ps(col1, _mm256_permute_ps(center, _MM_SHUFFLE(1, 1, 1, 1)), newCenter);
+        newCenter = _mm256_fmadd_ps(col2, _mm256_permute_ps(center, _MM_SHUFFLE(2, 2, 2, 2)), newCenter);
+        __m256 newExtent = _mm256_mul_ps(_mm256_and_ps(col0, absMask), _mm256_permute_ps(extent, _MM_SHUFFLE(0, 0, 0, 0)));
+        newExtent = _mm256_fmadd_ps(_mm256_and_ps(col1, absMask), _mm256_permute_ps(extent, _MM_SHUFFLE(1, 1, 1, 1)), newExtent);
+        newExtent = _mm256_fmadd_ps(_mm256_and_ps(col2, absMask), _mm256_permute_ps(extent, _MM_SHUFFLE(2, 2, 2, 2)), newExtent);
+
+        // The halves are the two boxes: min of the first, max of the first, ...
+        __m256 boxMin = _mm256_blend_ps(_mm256_sub_ps(newCenter, newExtent), zero, 0x88);
+        __m256 boxMax = _mm256_blend_ps(_mm256_add_ps(newCenter, newExtent), zero, 0x88);
+        _mm256_storeu_ps(o, _mm256_permute2f128_ps(boxMin, boxMax, 0x20));
+        _mm256_storeu_ps(o + 8, _mm256_permute2f128_ps(boxMin, boxMax, 0x31));
+    }
+    if (i < count)
+        transformBoundsSSE4(worlds + 12 * i, boxes + 8 * i, count - i, out + 8 * i);
+}
+
+#else
+
+void TransformKernels::multiplyAffineAVX2(const float *viewProjection, const float *worlds, size_t count, float *out)
+{
+    multiplyAffineScalar(viewProjection, worlds, count, out);
+}
+
+void TransformKernels::transformBoundsAVX2(const float *worlds, const float *boxes, size_t count, float *out)
+{
+    transformBoundsScalar(worlds, boxes, count, out);
+}
+
+#endif
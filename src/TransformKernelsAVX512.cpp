@@ -0,0 +1,94 @@
+// Compiled with -mavx512f
+#include "TransformKernels.h"
+
+#ifdef TRANSFORM_KERNELS_X86
+
+#include <immintrin.h>
+
+static inline __m512 quad(const float *a, const float *b, const float *c, const float *d)
+{
+    __m512 result = _mm512_castps128_ps512(_mm_loadu_ps(a));
+    result = _mm512_insertf32x4(result, _mm_loadu_ps(b), 1);
+    result = _mm512_insertf32x4(result, _mm_loadu_ps(c), 2);
+    return _mm512_insertf32x4(result, _mm_loadu_ps(d), 3);
+}
+
+// The whole MVP in one register: every 128 bit lane is a column, the world
+// coefficients of a row are spread over the lanes with one permutation
+void TransformKernels::multiplyAffineAVX512(const float *viewProjection, const float *worlds, size_t count, float *out)
+{
+    __m512 c0 = _mm512_broadcast_f32x4(_mm_loadu_ps(viewProjection));
+    __m512 c1 = _mm512_broadcast_f32x4(_mm_loadu_ps(viewProjection + 4));
+    __m512 c2 = _mm512_broadcast_f32x4(_mm_loadu_ps(viewProjection + 8));
+    __m512 translation = _mm512_insertf32x4(_mm512_setzero_ps(), _mm_loadu_ps(viewProjection + 12), 3);
+    const __m512i row0 = _mm512_setr_epi32(0, 0, 0, 0, 3, 3, 3, 3, 6, 6, 6, 6, 9, 9, 9, 9);
+    const __m512i row1 = _mm512_setr_epi32(1, 1, 1, 1, 4, 4, 4, 4, 7, 7, 7, 7, 10, 10, 10, 10);
+    const __m512i row2 = _mm512_setr_epi32(2, 2, 2, 2, 5, 5, 5, 5, 8, 8, 8, 8, 11, 11, 11, 11);
+    for (size_t i = 0; i < count; i++)
+    {
+        // 12 floats, the load does not touch the next matrix
+        __m512 w = _mm512_maskz_loadu_ps(0x0FFF, worlds + 12 * i);
+        __m512 mvp = _mm512_fmadd_ps(c0, _mm512_permutexvar_ps(row0, w), translation);
+        mvp = _mm512_fmadd_ps(c1, _mm512_permutexvar_ps(row1, w), mvp);
+        mvp = _mm512_fmadd_ps(c2, _mm512_permutexvar_ps(row2, w), mvp);
+        _mm512_storeu_ps(out + 16 * i, mvp);
+    }
+}
+
+// Four boxes per register, the remaining ones go through the SSE4 kernel
+void TransformKernels::transformBoundsAVX512(const float *worlds, const float *boxes, size_t count, float *out)
+{
+    const __m512 half = _mm512_set1_ps(0.5f);
+    const __m512i absMask = _mm512_set1_epi32(0x7fffffff);
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512i minLanes = _mm512_setr_epi32(0, 1, 2, 3, 16, 17, 18, 19, 4, 5, 6, 7, 20, 21, 22, 23);
+    const __m512i maxLanes = _mm512_setr_epi32(8, 9, 10, 11, 24, 25, 26, 27, 12, 13, 14, 15, 28, 29, 30, 31);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        const float *w = worlds + 12 * i;
+        const float *b = boxes + 8 * i;
+        float *o = out + 8 * i;
+        __m512 col0 = quad(w, w + 12, w + 24, w + 36);
+        __m512 col1 = quad(w + 3, w + 15, w + 27, w + 39);
+        __m512 col2 = quad(w + 6, w + 18, w + 30, w + 42);
+        __m512 translation = quad(w + 8, w + 20, w + 32, w + 44);
+        translation = _mm512_permute_ps(translation, _MM_SHUFFLE(3, 3, 2, 1));
+        __m512 low = quad(b, b + 8, b + 16, b + 24);
+        __m512 high = quad(b + 4, b + 12, b + 20, b + 28);
+        __m512 center = _mm512_mul_ps(_mm512_add_ps(low, high), half);
+        __m512 extent = _mm512_mul_ps(_mm512_sub_ps(high, low), half);
+        __m512 abs0 = _mm512_castsi512_ps(_mm512_and_epi32(_mm512_castps_si512(col0), absMask));
+        __m512 abs1 = _mm512_castsi512_ps(_mm512_and_epi32(_mm512_castps_si512(col1), absMask));
+        __m512 abs2 = _mm512_castsi512_ps(_mm512_and_epi32(_mm512_castps_si512(col2), absMask));
+
+        __m512 newCenter = _mm512_fmadd_ps(col0, _mm512_permute_ps(center, _MM_SHUFFLE(0, 0, 0, 0)), translation);
+        newCenter = _mm512_fmadd_ps(col1, _mm512_permute_ps(center, _MM_SHUFFLE(1, 1, 1, 1)), newCenter);
+        newCenter = _mm512_fmadd_ps(col2, _mm512_permute_ps(center, _MM_SHUFFLE(2, 2, 2, 2)), newCenter);
+        __m512 newExtent = _mm512_mul_ps(abs0, _mm512_permute_ps(extent, _MM_SHUFFLE(0, 0, 0, 0)));
+        newExtent = _mm512_fmadd_ps(abs1, _mm512_permute_ps(extent, _MM_SHUFFLE(1, 1, 1, 1)), newExtent);
+        newExtent = _mm512_fmadd_ps(abs2, _mm512_permute_ps(extent, _MM_SHUFFLE(2, 2, 2, 2)), newExtent);
+
+        // Lane k holds box k, interleave the minima and maxima back per box
+        __m512 boxMin = _mm512_mask_blend_ps(0x8888, _mm512_sub_ps(newCenter, newExtent), zero);
+        __m512 boxMax = _mm512_mask_blend_ps(0x8888, _mm512_add_ps(newCenter, newExtent), zero);
+        _mm512_storeu_ps(o, _mm512_permutex2var_ps(boxMin, minLanes, boxMax));
+        _mm512_storeu_ps(o + 16, _mm512_permutex2var_ps(boxMin, maxLanes, boxMax));
+    }
+    if (i < count)
+        transformBoundsSSE4(worlds + 12 * i, boxes + 8 * i, count - i, out + 8 * i);
+}
+
+#else
+
+void TransformKernels::multiplyAffineAVX512(const float *viewProjection, const float *worlds, size_t count, float *out)
+{
+    multiplyAffineScalar(viewProjection, worlds, count, out);
+}
+
+void TransformKernels::transformBoundsAVX512(const float *worlds, const float *boxes, size_t count, float *out)
+{
+    transformBoundsScalar(worlds, boxes, count, out);
+}
+
+#endif
@@ -0,0 +1,77 @@
+// Compiled with -msse4.1
+#include "TransformKernels.h"
+
+#ifdef TRANSFORM_KERNELS_X86
+
+#include <smmintrin.h>
+
+// One column of the MVP per register
+void TransformKernels::multiplyAffineSSE4(const float *viewProjection, const float *worlds, size_t count, float *out)
+{
+    __m128 c0 = _mm_loadu_ps(viewProjection);
+    __m128 c1 = _mm_loadu_ps(viewProjection + 4);
+    __m128 c2 = _mm_loadu_ps(viewProjection + 8);
+    __m128 c3 = _mm_loadu_ps(viewProjection + 12);
+    for (size_t i = 0; i < count; i++)
+    {
+        const float *w = worlds + 12 * i;
+        float *o = out + 16 * i;
+        for (int j = 0; j < 4; j++)
+        {
+            __m128 column = _mm_mul_ps(c0, _mm_set1_ps(w[3 * j]));
+            column = _mm_add_ps(column, _mm_mul_ps(c1, _mm_set1_ps(w[3 * j + 1])));
+            column = _mm_add_ps(column, _mm_mul_ps(c2, _mm_set1_ps(w[3 * j + 2])));
+            if (j == 3)
+                column = _mm_add_ps(column, c3);
+            _mm_storeu_ps(o + 4 * j, column);
+        }
+    }
+}
+
+// Center and half extent of the box, the extent is transformed by the
+// absolute value of the linear part (Arvo). One box per register.
+void TransformKernels::transformBoundsSSE4(const float *worlds, const float *boxes, size_t count, float *out)
+{
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    const __m128 zero = _mm_setzero_ps();
+    for (size_t i = 0; i < count; i++)
+    {
+        const float *w = worlds + 12 * i;
+        const float *b = boxes + 8 * i;
+        float *o = out + 8 * i;
+        __m128 col0 = _mm_loadu_ps(w);
+        __m128 col1 = _mm_loadu_ps(w + 3);
+        __m128 col2 = _mm_loadu_ps(w + 6);
+        __m128 translation = _mm_loadu_ps(w + 8);
+        translation = _mm_shuffle_ps(translation, translation, _MM_SHUFFLE(3, 3, 2, 1));
+        __m128 low = _mm_loadu_ps(b);
+        __m128 high = _mm_loadu_ps(b + 4);
+        __m128 center = _mm_mul_ps(_mm_add_ps(low, high), half);
+        __m128 extent = _mm_mul_ps(_mm_sub_ps(high, low), half);
+
+        __m128 newCenter = _mm_add_ps(translation, _mm_mul_ps(col0, _mm_shuffle_ps(center, center, _MM_SHUFFLE(0, 0, 0, 0))));
+        newCenter = _mm_add_ps(newCenter, _mm_mul_ps(col1, _mm_shuffle_ps(center, center, _MM_SHUFFLE(1, 1, 1, 1))));
+        newCenter = _mm_add_ps(newCenter, _mm_mul_ps(col2, _mm_shuffle_ps(center, center, _MM_SHUFFLE(2, 2, 2, 2))));
+        __m128 newExtent = _mm_mul_ps(_mm_and_ps(col0, absMask), _mm_shuffle_ps(extent, extent, _MM_SHUFFLE(0, 0, 0, 0)));
+        newExtent = _mm_add_ps(newExtent, _mm_mul_ps(_mm_and_ps(col1, absMask), _mm_shuffle_ps(extent, extent, _MM_SHUFFLE(1, 1, 1, 1))));
+        newExtent = _mm_add_ps(newExtent, _mm_mul_ps(_mm_and_ps(col2, absMask), _mm_shuffle_ps(extent, extent, _MM_SHUFFLE(2, 2, 2, 2))));
+
+        _mm_storeu_ps(o, _mm_blend_ps(_mm_sub_ps(newCenter, newExtent), zero, 8));
+        _mm_storeu_ps(o + 4, _mm_blend_ps(_mm_add_ps(newCenter, newExtent), zero, 8));
+    }
+}
+
+#else
+
+void TransformKernels::multiplyAffineSSE4(const float *viewProjection, const float *worlds, size_t count, float *out)
+{
+    multiplyAffineScalar(viewProjection, worlds, count, out);
+}
+
+void TransformKernels::transformBoundsSSE4(const float *worlds, const float *boxes, size_t count, float *out)
+{
+    transformBoundsScalar(worlds, boxes, count, out);
+}
+
+#endif
@@ -0,0 +1,491 @@
+#include "TriangleKernels.h"
+#include "Profiling.h"
+
+#include <iostream>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace TriangleKernels
+{
+    static const IntersectRayFunction intersectRayFunctions[TransformKernels::ISA_COUNT] =
+    {
+        intersectRayScalar, intersectRaySSE4, intersectRayAVX2, intersectRayAVX512
+    };
+    static const ContainsPointFunction containsPointFunctions[TransformKernels::ISA_COUNT] =
+    {
+        containsPointScalar, containsPointSSE4, containsPointAVX2, containsPointAVX512
+    };
+    static const unsigned int widths[TransformKernels::ISA_COUNT] = {4, 4, 8, 16};
+}
+
+TriangleKernels::TrianglePackets::TrianglePackets(unsigned int width)
+    : width(width), count(0), filled(0)
+{
+}
+
+void TriangleKernels::TrianglePackets::clear()
+{
+    count = 0;
+    filled = 0;
+    lanes.clear();
+    ids.clear();
+}
+
+void TriangleKernels::TrianglePackets::add(const float *v0, const float *v1, const float *v2, unsigned int id)
+{
+    if (count == 0 || filled == width)
+    {
+        // The new lanes stay zero until used, which makes them degenerate
+        count++;
+        lanes.resize(9 * width * count, 0.0f);
+        ids.resize(width * count, NO_TRIANGLE);
+        filled = 0;
+    }
+    float *p = &lanes[9 * width * (count - 1)];
+    for (int k = 0; k < 3; k++)
+    {
+        p[k * width + filled] = v0[k];
+        p[(3 + k) * width + filled] = v1[k] - v0[k];
+        p[(6 + k) * width + filled] = v2[k] - v0[k];
+    }
+    ids[width * (count - 1) + filled] = id;
+    filled++;
+}
+
+void TriangleKernels::TrianglePackets::endLeaf()
+{
+    if (count > 0)
+        filled = width;
+}
+
+void TriangleKernels::TrianglePackets::build(const float *triangles, size_t triangleCount, unsigned int width)
+{
+    clear();
+    this->width = width;
+    for (size_t i = 0; i < triangleCount; i++)
+        add(triangles + 9 * i, triangles + 9 * i + 3, triangles + 9 * i + 6, (unsigned int) i);
+    endLeaf();
+}
+
+unsigned int TriangleKernels::packetWidth(TransformKernels::Isa isa)
+{
+    return widths[isa];
+}
+
+bool TriangleKernels::intersectRay(const TrianglePackets &packets, size_t first, size_t count,
+                                   const float *origin, const float *direction, RayHit &hit)
+{
+    TransformKernels::Isa isa = TransformKernels::selected();
+    if (packets.width != widths[isa])
+        isa = TransformKernels::SCALAR;
+    return intersectRayFunctions[isa](packets, first, count, origin, direction, hit);
+}
+
+size_t TriangleKernels::containsPoint(const TrianglePackets &packets, size_t first, size_t count,
+                                      float x, float y, unsigned int *inside)
+{
+    TransformKernels::Isa isa = TransformKernels::selected();
+    if (packets.width != widths[isa])
+        isa = TransformKernels::SCALAR;
+    return containsPointFunctions[isa](packets, first, count, x, y, inside);
+}
+
+// The SIMD kernels do the same operations in the same order, lane by lane
+bool TriangleKernels::intersectRayScalar(const TrianglePackets &packets, size_t first, size_t count,
+                                         const float *origin, const float *direction, RayHit &hit)
+{
+    const unsigned int w = packets.width;
+    bool found = false;
+    for (size_t packet = first; packet < first + count; packet++)
+    {
+        const float *p = packets.packet(packet);
+        for (unsigned int lane = 0; lane < w; lane++)
+        {
+            float e1x = p[3 * w + lane], e1y = p[4 * w + lane], e1z = p[5 * w + lane];
+            float e2x = p[6 * w + lane], e2y = p[7 * w + lane], e2z = p[8 * w + lane];
+            // pvec = direction x e2
+            float px = direction[1] * e2z - direction[2] * e2y;
+            float py = direction[2] * e2x - direction[0] * e2z;
+            float pz = direction[0] * e2y - direction[1] * e2x;
+            float det = e1x * px + e1y * py + e1z * pz;
+            if (!(std::fabs(det) > DETERMINANT_EPSILON))
+                continue;
+            float inverse = 1.0f / det;
+            float tx = origin[0] - p[lane];
+            float ty = origin[1] - p[w + lane];
+            float tz = origin[2] - p[2 * w + lane];
+            float u = (tx * px + ty * py + tz * pz) * inverse;
+            // qvec = tvec x e1
+            float qx = ty * e1z - tz * e1y;
+            float qy = tz * e1x - tx * e1z;
+            float qz = tx * e1y - ty * e1x;
+            float v = (direction[0] * qx + direction[1] * qy + direction[2] * qz) * inverse;
+            float t = (e2x * qx + e2y * qy + e2z * qz) * inverse;
+            if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t > 0.0f && t < hit.t)
+            {
+                hit.t = t;
+                hit.u = u;
+                hit.v = v;
+                hit.triangle = packets.ids[w * packet + lane];
+                found = true;
+            }
+        }
+    }
+    return found;
+}
+
+// (x, y) - v0 = s / D e1 + t / D e2, with the signs of the three flipped
+// so that D is positive
+size_t TriangleKernels::containsPointScalar(const TrianglePackets &packets, size_t first, size_t count,
+                                           float x, float y, unsigned int *inside)
+{
+    const unsigned int w = packets.width;
+    size_t found = 0;
+    for (size_t packet = first; packet < first + count; packet++)
+    {
+        const float *p = packets.packet(packet);
+        for (unsigned int lane = 0; lane < w; lane++)
+        {
+            float e1x = p[3 * w + lane], e1y = p[4 * w + lane];
+            float e2x = p[6 * w + lane], e2y = p[7 * w + lane];
+            float dx = x - p[lane];
+            float dy = y - p[w + lane];
+            float d = e1x * e2y - e1y * e2x;
+            float s = dx * e2y - dy * e2x;
+            float t = e1x * dy - e1y * dx;
+            if (d < 0.0f)
+            {
+                d = -d;
+                s = -s;
+                t = -t;
+            }
+            if (d > 0.0f && s >= 0.0f && t >= 0.0f && s + t <= d)
+                inside[found++] = packets.ids[w * packet + lane];
+        }
+    }
+    return found;
+}
+
+// Whether rounding may move the ray across an edge of the triangle
+static bool rayNearEdge(const float *triangle, const float *origin, const float *direction)
+{
+    double e1[3], e2[3], t[3];
+    for (int k = 0; k < 3; k++)
+    {
+        e1[k] = triangle[3 + k] - triangle[k];
+        e2[k] = triangle[6 + k] - triangle[k];
+        t[k] = origin[k] - triangle[k];
+    }
+    double p[3] = {direction[1] * e2[2] - direction[2] * e2[1], direction[2] * e2[0] - direction[0] * e2[2], direction[0] * e2[1] - direction[1] * e2[0]};
+    double q[3] = {t[1] * e1[2] - t[2] * e1[1], t[2] * e1[0] - t[0] * e1[2], t[0] * e1[1] - t[1] * e1[0]};
+    double det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+    if (std::fabs(det) < 1e-6)
+        return true;
+    double u = (t[0] * p[0] + t[1] * p[1] + t[2] * p[2]) / det;
+    double v = (direction[0] * q[0] + direction[1] * q[1] + direction[2] * q[2]) / det;
+    double distance = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) / det;
+    return std::min(std::min(std::fabs(u), std::fabs(v)), std::fabs(1.0 - u - v)) < 1e-4 || std::fabs(distance) < 1e-4;
+}
+
+// Whether rounding may move the point across an edge of the triangle
+static bool pointNearEdge(const float *triangle, float x, float y)
+{
+    double e1x = triangle[3] - triangle[0], e1y = triangle[4] - triangle[1];
+    double e2x = triangle[6] - triangle[0], e2y = triangle[7] - triangle[1];
+    double dx = x - triangle[0], dy = y - triangle[1];
+    double d = e1x * e2y - e1y * e2x;
+    if (std::fabs(d) < 1e-9)
+        return true;
+    double s = (dx * e2y - dy * e2x) / d;
+    double t = (e1x * dy - e1y * dx) / d;
+    return std::min(std::min(std::fabs(s), std::fabs(t)), std::fabs(1.0 - s - t)) < 1e-4;
+}
+
+// Random triangles and queries aimed at them, the same for every call
+struct TriangleCase
+{
+    std::vector<float> triangles;
+    // Rays and points, as many of each
+    size_t queries;
+    std::vector<float> origins;
+    std::vector<float> directions;
+    std::vector<float> points;
+
+    explicit TriangleCase(size_t count);
+};
+
+TriangleCase::TriangleCase(size_t count)
+    : triangles(9 * count), queries(256), origins(3 * queries), directions(3 * queries), points(2 * queries)
+{
+    // Random triangles, with degenerate, tiny and shared vertex ones mixed in
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> coordinate(-1.0f, 1.0f);
+    for (size_t i = 0; i < count; i++)
+    {
+        float *triangle = &triangles[9 * i];
+        for (int k = 0; k < 9; k++)
+            triangle[k] = coordinate(random);
+        switch (i % 16)
+        {
+            case 3:
+                // collinear
+                for (int k = 0; k < 3; k++)
+                    triangle[6 + k] = 2.0f * triangle[3 + k] - triangle[k];
+                break;
+            case 7:
+                for (int k = 3; k < 9; k++)
+                    triangle[k] = triangle[k % 3] + 1e-3f * (triangle[k] - triangle[k % 3]);
+                break;
+            case 11:
+                if (i > 0)
+                    for (int k = 0; k < 3; k++)
+                        triangle[k] = triangles[9 * (i - 1) + 3 + k];
+                break;
+            default:
+                break;
+        }
+    }
+
+    // Rays at the centroids, vertices and edges of random triangles, and
+    // points likewise, the others are random
+    std::uniform_int_distribution<size_t> pick(0, count - 1);
+    for (size_t i = 0; i < queries; i++)
+    {
+        const float *triangle = &triangles[9 * pick(random)];
+        float target[3];
+        for (int k = 0; k < 3; k++)
+        {
+            switch (i % 4)
+            {
+                case 0:
+                    target[k] = (triangle[k] + triangle[3 + k] + triangle[6 + k]) / 3.0f;
+                    break;
+                case 1:
+                    target[k] = triangle[3 + k];
+                    break;
+                case 2:
+                    target[k] = 0.5f * (triangle[k] + triangle[6 + k]);
+                    break;
+                default:
+                    target[k] = coordinate(random);
+                    break;
+            }
+            origins[3 * i + k] = 2.0f * coordinate(random);
+            directions[3 * i + k] = target[k] - origins[3 * i + k];
+        }
+        points[2 * i] = target[0];
+        points[2 * i + 1] = target[1];
+    }
+}
+
+// Triangles and queries with known answers: rays parallel to a triangle,
+// hitting its back face or starting behind it, NaN coordinates, degenerate
+// triangles and a closer hit already found. Returns the cases the kernels
+// of isa get wrong, printing them.
+static size_t checkEdgeCases(TransformKernels::Isa isa)
+{
+    using namespace TriangleKernels;
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    // 0 is the unit right triangle in z = 0, counterclockwise seen from +z.
+    // 1 and 2 are that triangle with a NaN coordinate, 3 is collinear, 4
+    // is triangle 0 moved to z = -2 and 5 is clockwise, at z = -3.
+    const float triangles[6][9] = {
+        {0, 0, 0, 1, 0, 0, 0, 1, 0},
+        {nan, 0, 0, 1, 0, 0, 0, 1, 0},
+        {0, 0, 0, 1, 0, 0, 0, nan, 0},
+        {0, 0, 0, 1, 1, 0, 2, 2, 0},
+        {0, 0, -2, 1, 0, -2, 0, 1, -2},
+        {0, 0, -3, 0, 1, -3, 1, 0, -3}};
+    TrianglePackets packets(packetWidth(isa));
+    for (unsigned int i = 0; i < 6; i++)
+        packets.add(triangles[i], triangles[i] + 3, triangles[i] + 6, i);
+    packets.endLeaf();
+
+    // The hits are all on triangle 0 at t = 1, u = v = 0.25
+    struct RayCase
+    {
+        const char *name;
+        float origin[3];
+        float direction[3];
+        // Distance of a hit already found
+        float limit;
+        unsigned int triangle;
+    };
+    const RayCase rays[] = {
+        {"front face", {0.25f, 0.25f, 1}, {0, 0, -1}, INFINITY, 0},
+        {"back face", {0.25f, 0.25f, -1}, {0, 0, 1}, INFINITY, 0},
+        {"parallel ray in the plane", {-1, 0.25f, 0}, {1, 0, 0}, INFINITY, NO_TRIANGLE},
+        {"parallel ray above the plane", {-1, 0.25f, 0.5f}, {1, 0, 0}, INFINITY, NO_TRIANGLE},
+        {"triangle behind the origin", {0.25f, 0.25f, 1}, {0, 0, 1}, INFINITY, NO_TRIANGLE},
+        {"NaN origin", {nan, 0.25f, 1}, {0, 0, -1}, INFINITY, NO_TRIANGLE},
+        {"NaN direction", {0.25f, 0.25f, 1}, {0, nan, -1}, INFINITY, NO_TRIANGLE},
+        {"closer hit already found", {0.25f, 0.25f, 1}, {0, 0, -1}, 0.5f, NO_TRIANGLE}};
+    // Triangles 0, 4 and 5 share their xy projection, both windings count
+    struct PointCase
+    {
+        const char *name;
+        float x;
+        float y;
+        size_t count;
+    };
+    const PointCase points[] = {
+        {"point inside", 0.25f, 0.25f, 3},
+        {"point on the collinear triangle", 1.5f, 1.5f, 0},
+        {"NaN point", nan, 0.25f, 0}};
+    const unsigned int inside[] = {0, 4, 5};
+
+    size_t failures = 0;
+    for (size_t i = 0; i < sizeof(rays) / sizeof(rays[0]); i++)
+    {
+        const RayCase &ray = rays[i];
+        RayHit hit = {ray.limit, 0.0f, 0.0f, NO_TRIANGLE};
+        bool found = intersectRayFunctions[isa](packets, 0, packets.count, ray.origin, ray.direction, hit);
+        bool ok = found == (ray.triangle != NO_TRIANGLE) && hit.triangle == ray.triangle;
+        if (ok && found)
+            ok = std::fabs(hit.t - 1.0f) < 1e-5f && std::fabs(hit.u - 0.25f) < 1e-5f && std::fabs(hit.v - 0.25f) < 1e-5f;
+        if (!ok)
+        {
+            std::cout << "    " << TransformKernels::name(isa) << ", " << ray.name << ": triangle " << (int) hit.triangle << " at t = " << hit.t << std::endl;
+            failures++;
+        }
+    }
+    unsigned int found[16 * 2];
+    for (size_t i = 0; i < sizeof(points) / sizeof(points[0]); i++)
+    {
+        const PointCase &point = points[i];
+        size_t count = containsPointFunctions[isa](packets, 0, packets.count, point.x, point.y, found);
+        bool ok = count == point.count;
+        for (size_t k = 0; ok && k < count; k++)
+            ok = found[k] == inside[k];
+        if (!ok)
+        {
+            std::cout << "    " << TransformKernels::name(isa) << ", " << point.name << ": " << count << " containing triangles" << std::endl;
+            failures++;
+        }
+    }
+    return failures;
+}
+
+bool TriangleKernels::check(size_t count)
+{
+    using TransformKernels::Isa;
+    TriangleCase data(count);
+    bool correct = true;
+    std::vector<unsigned int> reference(count), inside(count + 16);
+    std::cout << "Triangle kernels against the scalar ones, " << count << " triangles, and edge cases" << std::endl;
+    for (int isa = TransformKernels::SCALAR; isa < TransformKernels::ISA_COUNT; isa++)
+    {
+        if (!TransformKernels::supported((Isa) isa))
+        {
+            std::cout << "  " << TransformKernels::name((Isa) isa) << ": not supported" << std::endl;
+            continue;
+        }
+        TrianglePackets packets;
+        packets.build(&data.triangles[0], count, widths[isa]);
+
+        // Every query against every triangle, compared with the scalar kernels
+        size_t rayMismatches = 0, pointMismatches = 0, hits = 0, contained = 0;
+        for (size_t i = 0; i < data.queries; i++)
+        {
+            const float *origin = &data.origins[3 * i];
+            const float *direction = &data.directions[3 * i];
+            RayHit expected = {INFINITY, 0.0f, 0.0f, NO_TRIANGLE};
+            RayHit result = expected;
+            intersectRayScalar(packets, 0, packets.count, origin, direction, expected);
+            intersectRayFunctions[isa](packets, 0, packets.count, origin, direction, result);
+            hits += expected.triangle != NO_TRIANGLE;
+            if (expected.triangle != result.triangle)
+            {
+                bool tie = expected.triangle != NO_TRIANGLE && result.triangle != NO_TRIANGLE
+                    && std::fabs(expected.t - result.t) <= 1e-4f * (1.0f + expected.t);
+                bool edge = (expected.triangle != NO_TRIANGLE && rayNearEdge(&data.triangles[9 * expected.triangle], origin, direction))
+                    || (result.triangle != NO_TRIANGLE && rayNearEdge(&data.triangles[9 * result.triangle], origin, direction));
+                rayMismatches += !tie && !edge;
+            }
+            else if (expected.triangle != NO_TRIANGLE && std::fabs(expected.t - result.t) > 1e-4f * (1.0f + expected.t))
+                rayMismatches++;
+
+            // Both lists are in id order
+            size_t expectedCount = containsPointScalar(packets, 0, packets.count, data.points[2 * i], data.points[2 * i + 1], &reference[0]);
+            size_t resultCount = containsPointFunctions[isa](packets, 0, packets.count, data.points[2 * i], data.points[2 * i + 1], &inside[0]);
+            contained += expectedCount;
+            size_t a = 0, b = 0;
+            while (a < expectedCount || b < resultCount)
+            {
+                if (a < expectedCount && b < resultCount && reference[a] == inside[b])
+                {
+                    a++;
+                    b++;
+                    continue;
+                }
+                unsigned int only = b == resultCount || (a < expectedCount && reference[a] < inside[b]) ? reference[a++] : inside[b++];
+                pointMismatches += !pointNearEdge(&data.triangles[9 * only], data.points[2 * i], data.points[2 * i + 1]);
+            }
+        }
+        size_t edgeFailures = checkEdgeCases((Isa) isa);
+        bool ok = rayMismatches == 0 && pointMismatches == 0 && edgeFailures == 0;
+        correct = correct && ok;
+        std::cout << "  " << TransformKernels::name((Isa) isa) << " (" << widths[isa] << " wide): " << hits << " hits, " << contained
+                  << " containing triangles, " << rayMismatches << " / " << pointMismatches << " mismatches, " << edgeFailures
+                  << " edge cases failed" << (ok ? "" : " MISMATCH") << std::endl;
+    }
+    return correct;
+}
+
+bool TriangleKernels::benchmark(size_t maxCount)
+{
+    using TransformKernels::Isa;
+    bool correct = check(maxCount);
+
+    TriangleCase data(maxCount);
+    std::vector<unsigned int> inside(maxCount + 16);
+    std::cout << "Triangle kernels (selected: " << TransformKernels::name(TransformKernels::selected()) << ")" << std::endl;
+    for (int isa = TransformKernels::SCALAR; isa < TransformKernels::ISA_COUNT; isa++)
+    {
+        if (!TransformKernels::supported((Isa) isa))
+            continue;
+        TrianglePackets packets;
+        packets.build(&data.triangles[0], maxCount, widths[isa]);
+
+        // Best of a few runs, the whole list in one call and leaves of 16
+        // triangles in one call each, as a BVH traversal would
+        const size_t leafPackets = 16 / widths[isa];
+        double best[4] = {INFINITY, INFINITY, INFINITY, INFINITY};
+        for (int run = 0; run < 3; run++)
+        {
+            ProfileClock::time_point start = ProfileClock::now();
+            for (size_t i = 0; i < data.queries; i++)
+            {
+                RayHit hit = {INFINITY, 0.0f, 0.0f, NO_TRIANGLE};
+                intersectRayFunctions[isa](packets, 0, packets.count, &data.origins[3 * i], &data.directions[3 * i], hit);
+            }
+            ProfileClock::time_point rays = ProfileClock::now();
+            for (size_t i = 0; i < data.queries; i++)
+            {
+                RayHit hit = {INFINITY, 0.0f, 0.0f, NO_TRIANGLE};
+                for (size_t leaf = 0; leaf < packets.count; leaf += leafPackets)
+                    intersectRayFunctions[isa](packets, leaf, std::min(leafPackets, packets.count - leaf), &data.origins[3 * i], &data.directions[3 * i], hit);
+            }
+            ProfileClock::time_point leafRays = ProfileClock::now();
+            for (size_t i = 0; i < data.queries; i++)
+                containsPointFunctions[isa](packets, 0, packets.count, data.points[2 * i], data.points[2 * i + 1], &inside[0]);
+            ProfileClock::time_point pointsDone = ProfileClock::now();
+            for (size_t i = 0; i < data.queries; i++)
+                for (size_t leaf = 0; leaf < packets.count; leaf += leafPackets)
+                    containsPointFunctions[isa](packets, leaf, std::min(leafPackets, packets.count - leaf), data.points[2 * i], data.points[2 * i + 1], &inside[0]);
+            ProfileClock::time_point end = ProfileClock::now();
+            best[0] = std::min(best[0], elapsedMs(start, rays));
+            best[1] = std::min(best[1], elapsedMs(rays, leafRays));
+            best[2] = std::min(best[2], elapsedMs(leafRays, pointsDone));
+            best[3] = std::min(best[3], elapsedMs(pointsDone, end));
+        }
+        // millions of triangles per second on one core
+        double tests = (double) data.queries * maxCount;
+        std::cout << "  " << TransformKernels::name((Isa) isa) << " rays: " << tests / best[0] * 1e-3 << " M/s, in leaves of 16: " << tests / best[1] * 1e-3
+                  << " M/s; points: " << tests / best[2] * 1e-3 << " M/s, in leaves of 16: " << tests / best[3] * 1e-3 << " M/s" << std::endl;
+    }
+    return correct;
+}
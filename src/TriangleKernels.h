@@ -0,0 +1,121 @@
+#ifndef TRIANGLE_KERNELS_H
+#define TRIANGLE_KERNELS_H
+
+#include "TransformKernels.h"
+
+#include <cstddef>
+#include <vector>
+
+// Ray-triangle (Moller-Trumbore) and 2D point-in-triangle tests over
+// packets of triangles, 4, 8 or 16 at a time. Like the transform kernels
+// each instruction set has its own translation unit, the one used is
+// TransformKernels::selected().
+namespace TriangleKernels
+{
+    static const unsigned int NO_TRIANGLE = 0xffffffffu;
+    // Rays closer to parallel to a triangle miss it
+    static const float DETERMINANT_EPSILON = 1e-12f;
+
+    // Triangles in packets of width lanes, structure of arrays. A packet
+    // holds 9 * width floats: v0 x, y, z, then the edges e1 = v1 - v0 and
+    // e2 = v2 - v0, width floats each, and width ids.
+    //
+    // The leaves of a BVH are runs of whole packets: add the triangles of
+    // a leaf, then endLeaf() pads its last packet, so a leaf is one
+    // contiguous block tested with a single call. Padding lanes are
+    // degenerate and never hit.
+    class TrianglePackets
+    {
+    public:
+        unsigned int width;
+        size_t count;
+        std::vector<float> lanes;
+        // NO_TRIANGLE in the padding lanes
+        std::vector<unsigned int> ids;
+
+        explicit TrianglePackets(unsigned int width = 4);
+
+        void clear();
+
+        // v0, v1 and v2 are xyz
+        void add(const float *v0, const float *v1, const float *v2, unsigned int id);
+
+        // Pad the last packet, the next triangle starts a new one
+        void endLeaf();
+
+        // Packets of triangles given as 9 floats each, ids are their indices
+        void build(const float *triangles, size_t triangleCount, unsigned int width);
+
+        const float *packet(size_t p) const { return &lanes[9 * width * p]; }
+
+    private:
+        // Triangles in the last packet
+        unsigned int filled;
+    };
+
+    struct RayHit
+    {
+        // Distance along the direction, and barycentrics of v1 and v2
+        float t;
+        float u;
+        float v;
+        unsigned int triangle;
+    };
+
+    // Closest hit of the ray with the packets [first, first + count) that
+    // is nearer than hit.t, both faces count. Returns true if hit changed.
+    typedef bool (*IntersectRayFunction)(const TrianglePackets &packets, size_t first, size_t count,
+                                         const float *origin, const float *direction, RayHit &hit);
+    // Ids of the triangles of the packets [first, first + count) whose xy
+    // projection contains (x, y), edges included, in packet order. inside
+    // holds count * width ids, returns how many were written. Degenerate
+    // triangles contain nothing.
+    typedef size_t (*ContainsPointFunction)(const TrianglePackets &packets, size_t first, size_t count,
+                                            float x, float y, unsigned int *inside);
+
+    // Packet width of the kernels of an instruction set: 4 for scalar and
+    // SSE4, 8 for AVX2, 16 for AVX512
+    unsigned int packetWidth(TransformKernels::Isa isa);
+
+    // With the selected instruction set. Packets of another width go
+    // through the scalar kernels.
+    bool intersectRay(const TrianglePackets &packets, size_t first, size_t count,
+                      const float *origin, const float *direction, RayHit &hit);
+    size_t containsPoint(const TrianglePackets &packets, size_t first, size_t count,
+                         float x, float y, unsigned int *inside);
+
+    // Check every supported instruction set against the scalar kernels
+    // with rays and points tested against all of count triangles, and on
+    // edge cases with known results: parallel rays, back faces, triangles
+    // behind the origin, NaN coordinates and degenerate triangles.
+    // Returns false if a kernel gets an edge case wrong or disagrees with
+    // the scalar one away from the rounding band around edges and equal
+    // distances.
+    bool check(size_t count);
+
+    // check(maxCount), then time every supported instruction set, printing
+    // triangles tested per second on one core. Returns what check did.
+    bool benchmark(size_t maxCount);
+
+    // Implementations, the SIMD ones are defined in TriangleKernels<ISA>.cpp
+    // and fall back to the scalar ones outside of x86. The scalar ones take
+    // any width.
+    bool intersectRayScalar(const TrianglePackets &packets, size_t first, size_t count,
+                            const float *origin, const float *direction, RayHit &hit);
+    bool intersectRaySSE4(const TrianglePackets &packets, size_t first, size_t count,
+                          const float *origin, const float *direction, RayHit &hit);
+    bool intersectRayAVX2(const TrianglePackets &packets, size_t first, size_t count,
+                          const float *origin, const float *direction, RayHit &hit);
+    bool intersectRayAVX512(const TrianglePackets &packets, size_t first, size_t count,
+                            const float *origin, const float *direction, RayHit &hit);
+    size_t containsPointScalar(const TrianglePackets &packets, size_t first, size_t count,
+                               float x, float y, unsigned int *inside);
+    size_t containsPointSSE4(const TrianglePackets &packets, size_t first, size_t count,
+                             float x, float y, unsigned int *inside);
+    size_t containsPointAVX2(const TrianglePackets &packets, size_t first, size_t count,
+                             float x, float y, unsigned int *inside);
+    size_t containsPointAVX512(const TrianglePackets &packets, size_t first, size_t count,
+                               float x, float y, unsigned int *inside);
+}
+
+#endif
@@ -0,0 +1,115 @@
+// Compiled with -mavx2 -mfma
+#include "TriangleKernels.h"
+
+#ifdef TRANSFORM_KERNELS_X86
+
+#include <immintrin.h>
+
+// Eight triangles per register, the lanes that pass every test are then
+// taken in order so the closest one wins as in the scalar kernel
+bool TriangleKernels::intersectRayAVX2(const TrianglePackets &packets, size_t first, size_t count,
+                                       const float *origin, const float *direction, RayHit &hit)
+{
+    const __m256 ox = _mm256_set1_ps(origin[0]), oy = _mm256_set1_ps(origin[1]), oz = _mm256_set1_ps(origin[2]);
+    const __m256 dx = _mm256_set1_ps(direction[0]), dy = _mm256_set1_ps(direction[1]), dz = _mm256_set1_ps(direction[2]);
+    const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+    const __m256 epsilon = _mm256_set1_ps(DETERMINANT_EPSILON);
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    bool found = false;
+    for (size_t packet = first; packet < first + count; packet++)
+    {
+        const float *p = packets.packet(packet);
+        __m256 e1x = _mm256_loadu_ps(p + 24), e1y = _mm256_loadu_ps(p + 32), e1z = _mm256_loadu_ps(p + 40);
+        __m256 e2x = _mm256_loadu_ps(p + 48), e2y = _mm256_loadu_ps(p + 56), e2z = _mm256_loadu_ps(p + 64);
+        __m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+        __m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+        __m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+        __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+        __m256 mask = _mm256_cmp_ps(_mm256_andnot_ps(sign, det), epsilon, _CMP_GT_OQ);
+        if (_mm256_movemask_ps(mask) == 0)
+            continue;
+        __m256 inverse = _mm256_div_ps(one, det);
+        __m256 tx = _mm256_sub_ps(ox, _mm256_loadu_ps(p));
+        __m256 ty = _mm256_sub_ps(oy, _mm256_loadu_ps(p + 8));
+        __m256 tz = _mm256_sub_ps(oz, _mm256_loadu_ps(p + 16));
+        __m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tx, px), _mm256_mul_ps(ty, py)), _mm256_mul_ps(tz, pz)), inverse);
+        __m256 qx = _mm256_sub_ps(_mm256_mul_ps(ty, e1z), _mm256_mul_ps(tz, e1y));
+        __m256 qy = _mm256_sub_ps(_mm256_mul_ps(tz, e1x), _mm256_mul_ps(tx, e1z));
+        __m256 qz = _mm256_sub_ps(_mm256_mul_ps(tx, e1y), _mm256_mul_ps(ty, e1x));
+        __m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)), inverse);
+        __m256 t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), inverse);
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ));
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, zero, _CMP_GT_OQ));
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, _mm256_set1_ps(hit.t), _CMP_LT_OQ));
+        int bits = _mm256_movemask_ps(mask);
+        if (bits == 0)
+            continue;
+        alignas(32) float ts[8], us[8], vs[8];
+        _mm256_store_ps(ts, t);
+        _mm256_store_ps(us, u);
+        _mm256_store_ps(vs, v);
+        for (unsigned int lane = 0; lane < 8; lane++)
+        {
+            if ((bits & (1 << lane)) && ts[lane] < hit.t)
+            {
+                hit.t = ts[lane];
+                hit.u = us[lane];
+                hit.v = vs[lane];
+                hit.triangle = packets.ids[8 * packet + lane];
+                found = true;
+            }
+        }
+    }
+    return found;
+}
+
+size_t TriangleKernels::containsPointAVX2(const TrianglePackets &packets, size_t first, size_t count,
+                                         float x, float y, unsigned int *inside)
+{
+    const __m256 px = _mm256_set1_ps(x), py = _mm256_set1_ps(y);
+    const __m256 zero = _mm256_setzero_ps();
+    size_t found = 0;
+    for (size_t packet = first; packet < first + count; packet++)
+    {
+        const float *p = packets.packet(packet);
+        __m256 e1x = _mm256_loadu_ps(p + 24), e1y = _mm256_loadu_ps(p + 32);
+        __m256 e2x = _mm256_loadu_ps(p + 48), e2y = _mm256_loadu_ps(p + 56);
+        __m256 dx = _mm256_sub_ps(px, _mm256_loadu_ps(p));
+        __m256 dy = _mm256_sub_ps(py, _mm256_loadu_ps(p + 8));
+        __m256 d = _mm256_sub_ps(_mm256_mul_ps(e1x, e2y), _mm256_mul_ps(e1y, e2x));
+        __m256 s = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+        __m256 t = _mm256_sub_ps(_mm256_mul_ps(e1x, dy), _mm256_mul_ps(e1y, dx));
+        // Flip the signs of the three where d is negative
+        __m256 flip = _mm256_and_ps(_mm256_cmp_ps(d, zero, _CMP_LT_OQ), _mm256_set1_ps(-0.0f));
+        d = _mm256_xor_ps(d, flip);
+        s = _mm256_xor_ps(s, flip);
+        t = _mm256_xor_ps(t, flip);
+        __m256 mask = _mm256_cmp_ps(d, zero, _CMP_GT_OQ);
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(s, zero, _CMP_GE_OQ));
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, zero, _CMP_GE_OQ));
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_add_ps(s, t), d, _CMP_LE_OQ));
+        int bits = _mm256_movemask_ps(mask);
+        for (unsigned int lane = 0; bits; lane++, bits >>= 1)
+            if (bits & 1)
+                inside[found++] = packets.ids[8 * packet + lane];
+    }
+    return found;
+}
+
+#else
+
+bool TriangleKernels::intersectRayAVX2(const TrianglePackets &packets, size_t first, size_t count,
+                                       const float *origin, const float *direction, RayHit &hit)
+{
+    return intersectRayScalar(packets, first, count, origin, direction, hit);
+}
+
+size_t TriangleKernels::containsPointAVX2(const TrianglePackets &packets, size_t first, size_t count,
+                                         float x, float y, unsigned int *inside)
+{
+    return containsPointScalar(packets, first, count, x, y, inside);
+}
+
+#endif
@@ -0,0 +1,113 @@
+// Compiled with -mavx512f
+#include "TriangleKernels.h"
+
+#ifdef TRANSFORM_KERNELS_X86
+
+#include <immintrin.h>
+
+// Sixteen triangles per register, the tests narrow a mask register down
+// and the lanes left are taken in order as in the scalar kernel
+bool TriangleKernels::intersectRayAVX512(const TrianglePackets &packets, size_t first, size_t count,
+                                         const float *origin, const float *direction, RayHit &hit)
+{
+    const __m512 ox = _mm512_set1_ps(origin[0]), oy = _mm512_set1_ps(origin[1]), oz = _mm512_set1_ps(origin[2]);
+    const __m512 dx = _mm512_set1_ps(direction[0]), dy = _mm512_set1_ps(direction[1]), dz = _mm512_set1_ps(direction[2]);
+    const __m512 zero = _mm512_setzero_ps(), one = _mm512_set1_ps(1.0f);
+    const __m512 epsilon = _mm512_set1_ps(DETERMINANT_EPSILON);
+    bool found = false;
+    for (size_t packet = first; packet < first + count; packet++)
+    {
+        const float *p = packets.packet(packet);
+        __m512 e1x = _mm512_loadu_ps(p + 48), e1y = _mm512_loadu_ps(p + 64), e1z = _mm512_loadu_ps(p + 80);
+        __m512 e2x = _mm512_loadu_ps(p + 96), e2y = _mm512_loadu_ps(p + 112), e2z = _mm512_loadu_ps(p + 128);
+        __m512 px = _mm512_sub_ps(_mm512_mul_ps(dy, e2z), _mm512_mul_ps(dz, e2y));
+        __m512 py = _mm512_sub_ps(_mm512_mul_ps(dz, e2x), _mm512_mul_ps(dx, e2z));
+        __m512 pz = _mm512_sub_ps(_mm512_mul_ps(dx, e2y), _mm512_mul_ps(dy, e2x));
+        __m512 det = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(e1x, px), _mm512_mul_ps(e1y, py)), _mm512_mul_ps(e1z, pz));
+        __mmask16 mask = _mm512_cmp_ps_mask(_mm512_abs_ps(det), epsilon, _CMP_GT_OQ);
+        if (mask == 0)
+            continue;
+        __m512 inverse = _mm512_div_ps(one, det);
+        __m512 tx = _mm512_sub_ps(ox, _mm512_loadu_ps(p));
+        __m512 ty = _mm512_sub_ps(oy, _mm512_loadu_ps(p + 16));
+        __m512 tz = _mm512_sub_ps(oz, _mm512_loadu_ps(p + 32));
+        __m512 u = _mm512_mul_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(tx, px), _mm512_mul_ps(ty, py)), _mm512_mul_ps(tz, pz)), inverse);
+        __m512 qx = _mm512_sub_ps(_mm512_mul_ps(ty, e1z), _mm512_mul_ps(tz, e1y));
+        __m512 qy = _mm512_sub_ps(_mm512_mul_ps(tz, e1x), _mm512_mul_ps(tx, e1z));
+        __m512 qz = _mm512_sub_ps(_mm512_mul_ps(tx, e1y), _mm512_mul_ps(ty, e1x));
+        __m512 v = _mm512_mul_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dx, qx), _mm512_mul_ps(dy, qy)), _mm512_mul_ps(dz, qz)), inverse);
+        __m512 t = _mm512_mul_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(e2x, qx), _mm512_mul_ps(e2y, qy)), _mm512_mul_ps(e2z, qz)), inverse);
+        mask = _mm512_mask_cmp_ps_mask(mask, u, zero, _CMP_GE_OQ);
+        mask = _mm512_mask_cmp_ps_mask(mask, v, zero, _CMP_GE_OQ);
+        mask = _mm512_mask_cmp_ps_mask(mask, _mm512_add_ps(u, v), one, _CMP_LE_OQ);
+        mask = _mm512_mask_cmp_ps_mask(mask, t, zero, _CMP_GT_OQ);
+        mask = _mm512_mask_cmp_ps_mask(mask, t, _mm512_set1_ps(hit.t), _CMP_LT_OQ);
+        if (mask == 0)
+            continue;
+        alignas(64) float ts[16], us[16], vs[16];
+        _mm512_store_ps(ts, t);
+        _mm512_store_ps(us, u);
+        _mm512_store_ps(vs, v);
+        for (unsigned int lane = 0; lane < 16; lane++)
+        {
+            if ((mask & (1 << lane)) && ts[lane] < hit.t)
+            {
+                hit.t = ts[lane];
+                hit.u = us[lane];
+                hit.v = vs[lane];
+                hit.triangle = packets.ids[16 * packet + lane];
+                found = true;
+            }
+        }
+    }
+    return found;
+}
+
+size_t TriangleKernels::containsPointAVX512(const TrianglePackets &packets, size_t first, size_t count,
+                                           float x, float y, unsigned int *inside)
+{
+    const __m512 px = _mm512_set1_ps(x), py = _mm512_set1_ps(y);
+    const __m512 zero = _mm512_setzero_ps();
+    size_t found = 0;
+    for (size_t packet = first; packet < first + count; packet++)
+    {
+        const float *p = packets.packet(packet);
+        __m512 e1x = _mm512_loadu_ps(p + 48), e1y = _mm512_loadu_ps(p + 64);
+        __m512 e2x = _mm512_loadu_ps(p + 96), e2y = _mm512_loadu_ps(p + 112);
+        __m512 dx = _mm512_sub_ps(px, _mm512_loadu_ps(p));
+        __m512 dy = _mm512_sub_ps(py, _mm512_loadu_ps(p + 16));
+        __m512 d = _mm512_sub_ps(_mm512_mul_ps(e1x, e2y), _mm512_mul_ps(e1y, e2x));
+        __m512 s = _mm512_sub_ps(_mm512_mul_ps(dx, e2y), _mm512_mul_ps(dy, e2x));
+        __m512 t = _mm512_sub_ps(_mm512_mul_ps(e1x, dy), _mm512_mul_ps(e1y, dx));
+        // Negate the three where d is negative
+        __mmask16 flip = _mm512_cmp_ps_mask(d, zero, _CMP_LT_OQ);
+        d = _mm512_mask_sub_ps(d, flip, zero, d);
+        s = _mm512_mask_sub_ps(s, flip, zero, s);
+        t = _mm512_mask_sub_ps(t, flip, zero, t);
+        __mmask16 mask = _mm512_cmp_ps_mask(d, zero, _CMP_GT_OQ);
+        mask = _mm512_mask_cmp_ps_mask(mask, s, zero, _CMP_GE_OQ);
+        mask = _mm512_mask_cmp_ps_mask(mask, t, zero, _CMP_GE_OQ);
+        mask = _mm512_mask_cmp_ps_mask(mask, _mm512_add_ps(s, t), d, _CMP_LE_OQ);
+        unsigned int bits = mask;
+        for (unsigned int lane = 0; bits; lane++, bits >>= 1)
+            if (bits & 1)
+                inside[found++] = packets.ids[16 * packet + lane];
+    }
+    return found;
+}
+
+#else
+
+bool TriangleKernels::intersectRayAVX512(const TrianglePackets &packets, size_t first, size_t count,
+                                         const float *origin, const float *direction, RayHit &hit)
+{
+    return intersectRayScalar(packets, first, count, origin, direction, hit);
+}
+
+size_t TriangleKernels::containsPointAVX512(const TrianglePackets &packets, size_t first, size_t count,
+                                           float x, float y, unsigned int *inside)
+{
+    return containsPointScalar(packets, first, count, x, y, inside);
+}
+
+#endif
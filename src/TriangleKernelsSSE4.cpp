@@ -0,0 +1,115 @@
+// Compiled with -msse4.1
+#include "TriangleKernels.h"
+
+#ifdef TRANSFORM_KERNELS_X86
+
+#include <smmintrin.h>
+
+// Four triangles per register, the lanes that pass every test are then
+// taken in order so the closest one wins as in the scalar kernel
+bool TriangleKernels::intersectRaySSE4(const TrianglePackets &packets, size_t first, size_t count,
+                                       const float *origin, const float *direction, RayHit &hit)
+{
+    const __m128 ox = _mm_set1_ps(origin[0]), oy = _mm_set1_ps(origin[1]), oz = _mm_set1_ps(origin[2]);
+    const __m128 dx = _mm_set1_ps(direction[0]), dy = _mm_set1_ps(direction[1]), dz = _mm_set1_ps(direction[2]);
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+    const __m128 epsilon = _mm_set1_ps(DETERMINANT_EPSILON);
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    bool found = false;
+    for (size_t packet = first; packet < first + count; packet++)
+    {
+        const float *p = packets.packet(packet);
+        __m128 e1x = _mm_loadu_ps(p + 12), e1y = _mm_loadu_ps(p + 16), e1z = _mm_loadu_ps(p + 20);
+        __m128 e2x = _mm_loadu_ps(p + 24), e2y = _mm_loadu_ps(p + 28), e2z = _mm_loadu_ps(p + 32);
+        __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+        __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+        __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+        __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+        __m128 mask = _mm_cmpgt_ps(_mm_andnot_ps(sign, det), epsilon);
+        if (_mm_movemask_ps(mask) == 0)
+            continue;
+        __m128 inverse = _mm_div_ps(one, det);
+        __m128 tx = _mm_sub_ps(ox, _mm_loadu_ps(p));
+        __m128 ty = _mm_sub_ps(oy, _mm_loadu_ps(p + 4));
+        __m128 tz = _mm_sub_ps(oz, _mm_loadu_ps(p + 8));
+        __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), inverse);
+        __m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+        __m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+        __m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+        __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inverse);
+        __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inverse);
+        mask = _mm_and_ps(mask, _mm_cmpge_ps(u, zero));
+        mask = _mm_and_ps(mask, _mm_cmpge_ps(v, zero));
+        mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u, v), one));
+        mask = _mm_and_ps(mask, _mm_cmpgt_ps(t, zero));
+        mask = _mm_and_ps(mask, _mm_cmplt_ps(t, _mm_set1_ps(hit.t)));
+        int bits = _mm_movemask_ps(mask);
+        if (bits == 0)
+            continue;
+        alignas(16) float ts[4], us[4], vs[4];
+        _mm_store_ps(ts, t);
+        _mm_store_ps(us, u);
+        _mm_store_ps(vs, v);
+        for (unsigned int lane = 0; lane < 4; lane++)
+        {
+            if ((bits & (1 << lane)) && ts[lane] < hit.t)
+            {
+                hit.t = ts[lane];
+                hit.u = us[lane];
+                hit.v = vs[lane];
+                hit.triangle = packets.ids[4 * packet + lane];
+                found = true;
+            }
+        }
+    }
+    return found;
+}
+
+size_t TriangleKernels::containsPointSSE4(const TrianglePackets &packets, size_t first, size_t count,
+                                         float x, float y, unsigned int *inside)
+{
+    const __m128 px = _mm_set1_ps(x), py = _mm_set1_ps(y);
+    const __m128 zero = _mm_setzero_ps();
+    size_t found = 0;
+    for (size_t packet = first; packet < first + count; packet++)
+    {
+        const float *p = packets.packet(packet);
+        __m128 e1x = _mm_loadu_ps(p + 12), e1y = _mm_loadu_ps(p + 16);
+        __m128 e2x = _mm_loadu_ps(p + 24), e2y = _mm_loadu_ps(p + 28);
+        __m128 dx = _mm_sub_ps(px, _mm_loadu_ps(p));
+        __m128 dy = _mm_sub_ps(py, _mm_loadu_ps(p + 4));
+        __m128 d = _mm_sub_ps(_mm_mul_ps(e1x, e2y), _mm_mul_ps(e1y, e2x));
+        __m128 s = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+        __m128 t = _mm_sub_ps(_mm_mul_ps(e1x, dy), _mm_mul_ps(e1y, dx));
+        // Flip the signs of the three where d is negative
+        __m128 flip = _mm_and_ps(_mm_cmplt_ps(d, zero), _mm_set1_ps(-0.0f));
+        d = _mm_xor_ps(d, flip);
+        s = _mm_xor_ps(s, flip);
+        t = _mm_xor_ps(t, flip);
+        __m128 mask = _mm_cmpgt_ps(d, zero);
+        mask = _mm_and_ps(mask, _mm_cmpge_ps(s, zero));
+        mask = _mm_and_ps(mask, _mm_cmpge_ps(t, zero));
+        mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(s, t), d));
+        int bits = _mm_movemask_ps(mask);
+        for (unsigned int lane = 0; bits; lane++, bits >>= 1)
+            if (bits & 1)
+                inside[found++] = packets.ids[4 * packet + lane];
+    }
+    return found;
+}
+
+#else
+
+bool TriangleKernels::intersectRaySSE4(const TrianglePackets &packets, size_t first, size_t count,
+                                       const float *origin, const float *direction, RayHit &hit)
+{
+    return intersectRayScalar(packets, first, count, origin, direction, hit);
+}
+
+size_t TriangleKernels::containsPointSSE4(const TrianglePackets &packets, size_t first, size_t count,
+                                         float x, float y, unsigned int *inside)
+{
+    return containsPointScalar(packets, first, count, x, y, inside);
+}
+
+#endif
@@ -0,0 +1,73 @@
+#include "UniformBlocks.h"
+#include "GLCapture.h"
+#include "MemoryStats.h"
+
+static_assert(sizeof(FrameUniforms) == 240, "FrameUniforms must match the std140 Frame block");
+static_assert(sizeof(DrawUniforms) == 192, "DrawUniforms must match the std140 Draw block");
+
+void UniformBuffer::init(size_t bytes, GLuint binding)
+{
+    GLCapture::genBuffer(&id);
+    GLCapture::bindBuffer(GL_UNIFORM_BUFFER, id);
+    GLCapture::bufferData(GL_UNIFORM_BUFFER, bytes, NULL, GL_DYNAMIC_DRAW);
+    GLCapture::bindBufferRange(GL_UNIFORM_BUFFER, binding, id, 0, bytes);
+    memoryStats.resize(GPU_UNIFORM_BUFFERS, 0, bytes);
+    this->bytes = bytes;
+    check_gl_error();
+}
+
+void UniformBuffer::update(const void *data, size_t size)
+{
+    GLCapture::bindBuffer(GL_UNIFORM_BUFFER, id);
+    GLCapture::bufferSubData(GL_UNIFORM_BUFFER, 0, size, data);
+    memoryStats.uploaded(size);
+    check_gl_error();
+}
+
+void UniformBuffer::free()
+{
+    if (id)
+        GLCapture::deleteBuffer(&id);
+    memoryStats.resize(GPU_UNIFORM_BUFFERS, bytes, 0);
+    id = 0;
+    bytes = 0;
+}
+
+void UniformRing::init(size_t recordBytes, size_t batchRecords, unsigned int sections)
+{
+    GLint alignment = 256;
+    if (GLCapture::backend == GLCapture::NATIVE_BACKEND)
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    this->recordBytes = recordBytes;
+    this->batchRecords = batchRecords;
+    batchStride = (batchRecords * recordBytes + alignment - 1) / alignment * alignment;
+    // Room for four batches per frame before the first growth
+    stream.init(GL_UNIFORM_BUFFER, 4 * batchStride, sections, GPU_UNIFORM_BUFFERS);
+}
+
+char *UniformRing::begin(size_t count)
+{
+    size_t batches = (count + batchRecords - 1) / batchRecords;
+    return static_cast<char *>(stream.begin(batches * batchStride));
+}
+
+void UniformRing::end(size_t count)
+{
+    // The tail of the last batch is bound but never read
+    offset = stream.end(count == 0 ? 0 : recordOffset(count - 1) + recordBytes);
+}
+
+void UniformRing::bindBatch(GLuint binding, size_t batch)
+{
+    GLCapture::bindBufferRange(GL_UNIFORM_BUFFER, binding, stream.id, offset + batch * batchStride, batchRecords * recordBytes);
+}
+
+void UniformRing::fence()
+{
+    stream.fence();
+}
+
+void UniformRing::free()
+{
+    stream.free();
+}
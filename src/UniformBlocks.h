@@ -0,0 +1,102 @@
+#ifndef UNIFORM_BLOCKS_H
+#define UNIFORM_BLOCKS_H
+
+#include "Helpers.h"
+#include "StreamRing.h"
+
+#include <cstddef>
+
+// Binding points of the uniform blocks, the same in every program
+enum UniformBinding
+{
+    FRAME_BINDING = 0,
+    DRAW_BINDING = 1
+};
+
+// std140 layout of the Frame block, rewritten once per frame
+struct FrameUniforms
+{
+    float view[16];
+    float projection[16];
+    float viewProjection[16];
+    // xyz, w is padding
+    float cameraPosition[4];
+    float lightPosition[4];
+    float lightColor[4];
+};
+
+// Records in the Draw block, 12 KB which is below the 16 KB every
+// implementation supports
+static const size_t DRAW_BATCH = 64;
+
+// std140 layout of the DrawRecord struct, one record per draw
+struct DrawUniforms
+{
+    float mvp[16];
+    float model[16];
+    // a mat3 is stored as three columns padded to vec4
+    float normalMatrix[12];
+    float objectColor[4];
+};
+
+// A uniform buffer bound whole to one binding point
+class UniformBuffer
+{
+public:
+    GLuint id;
+    size_t bytes;
+
+    UniformBuffer() : id(0), bytes(0) {}
+
+    void init(size_t bytes, GLuint binding);
+
+    // Replace the content, size is at most bytes
+    void update(const void *data, size_t size);
+
+    void free();
+};
+
+// Records of the draws of the frames in flight, streamed through a
+// StreamRing. Every frame writes its records into the next section of the
+// ring. The Draw block is an array of DRAW_BATCH records, a draw binds the
+// batch holding its record with glBindBufferRange and picks the record
+// with its draw index, while the GPU may still read the sections of the
+// previous frames.
+class UniformRing
+{
+public:
+    StreamRing stream;
+    // Bytes of a record, also the std140 stride of the array
+    size_t recordBytes;
+    size_t batchRecords;
+    // Bytes between two batches, a multiple of GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+    size_t batchStride;
+    // Offset of the records of the last end()
+    size_t offset;
+
+    UniformRing() : recordBytes(0), batchRecords(0), batchStride(0), offset(0) {}
+
+    void init(size_t recordBytes, size_t batchRecords, unsigned int sections);
+
+    // Memory for count records, placed at recordOffset()
+    char *begin(size_t count);
+
+    // The count records of begin() are written
+    void end(size_t count);
+
+    // Where a record goes, from the pointer of begin()
+    size_t recordOffset(size_t record) const
+    {
+        return (record / batchRecords) * batchStride + (record % batchRecords) * recordBytes;
+    }
+
+    // Bind a batch of the records of the last end()
+    void bindBatch(GLuint binding, size_t batch);
+
+    // After the draws using the records of the last end()
+    void fence();
+
+    void free();
+};
+
+#endif
@@ -3,6 +3,49 @@
 // OpenGL Helpers to reduce the clutter
 #include "Helpers.h"
 
+// Frame timing and memory sampling for the stress mode
+#include "Profiling.h"
+
+// Recording and replay of the input callbacks
+#include "InputLog.h"
+
+// Capture of the OpenGL command stream and null backend
+#include "GLCapture.h"
+
+// CPU and GPU memory accounting
+#include "MemoryStats.h"
+
+// Per-frame arena for short-lived buffers
+#include "FrameArena.h"
+
+// Vertex attributes of all the loaded meshes
+#include "GeometryStore.h"
+
+// Mesh assets shared between paths and instances, ranges of the GPU buffers
+#include "AssetRegistry.h"
+#include "RangeAllocator.h"
+
+// Translation, rotation and scale of the instances, grouped in a hierarchy
+#include "Transform.h"
+#include "SceneGraph.h"
+
+// Batched MVP products, SSE4/AVX2/AVX-512 picked at runtime
+#include "TransformKernels.h"
+#include "TriangleKernels.h"
+
+// Shader variants selected with #define, one per rendering mode
+#include "ShaderPermutations.h"
+#include "UniformBlocks.h"
+
+// Direct, instanced or multi-draw indirect submission of the draw list
+#include "MultiDraw.h"
+
+// Still instances merged per spatial cell into pre-transformed geometry
+#include "StaticBatching.h"
+
+// Instance ids drawn on demand and read back asynchronously
+#include "IdPicker.h"
+
 // GLFW is necessary to handle the OpenGL context
 #include <GLFW/glfw3.h>
 
@@ -18,23 +61,73 @@
 #include <string>
 #include <list>
 #include <cstdlib>
+#include <ctime>
+#include <thread>
+#include <unordered_set>
+#include <limits>
+#include <stdexcept>
 using namespace std;
 
 #define PI 3.14159265
 
- Program program;
+// The shaders, compiled as one permutation per rendering mode
+ShaderPermutations shaders;
+
+// Permutation used by a rendering mode, NULL until the mode is first used
+struct ShadingProgram
+{
+    Program* program;
+};
+
+// The uniforms of every program come from two blocks: the Frame block is
+// rewritten once per frame, the Draw block of each draw is a range of a ring
+UniformBuffer frameBlock;
+UniformRing drawRing;
+
+// Locations of the attributes given to shaders.init
+const GLuint NORMAL_LOCATION = 1;
+const GLuint DRAW_INDEX_LOCATION = 2;
+const GLuint VERTEX_COLOR_LOCATION = 3;
+const GLuint PICK_ID_LOCATION = 4;
+// How the draw list is submitted, indirect falls back to instanced when
+// the context lacks it
+SubmitPath submitPath = SUBMIT_INDIRECT;
+// Commands of the indirect path and the draw index they read
+StreamRing drawCommands;
+DrawIndexArray drawIndices;
+// Draw calls issued since the start of the frame
+size_t drawCalls = 0;
+// Off unless --static-batching gives a cell size
+StaticBatcher staticBatcher;
+// Id pass drawn on the frames a click has to be resolved, and its program
+IdPicker picker;
+Program* idProgram = NULL;
+// What to do with the instance under the cursor once its id is read back
+enum PickAction
+{
+    PICK_SELECT,
+    PICK_DELETE
+};
+bool leftButtonDown = false;
+
+// Vertex array of the meshes, the static batches have their own
+VertexArrayObject VAO;
 
 // VertexBufferObject wrapper
 VertexBufferObject VBO;
 //VertexBufferObject CBO;
 VertexBufferObject NBO;
 IndexBufferObject IBO;
-
-// Contains the vertex positions
-Eigen::MatrixXf V;
+// Only Phong shading reads the normals: NBO is then created the first time
+// it is used, and the normals of a mesh computed the first time they are read
+bool lazyNormals = true;
+// Time spent importing meshes, and computing their normals
+double importMs = 0.0;
+double normalsMs = 0.0;
+
+// Contains the vertex positions, normals and barycenters
+GeometryStore geometry;
 Eigen::MatrixXf C;
-Eigen::MatrixXf N;
-Eigen::MatrixXf B;
 vector<unsigned int> I;
 
 Eigen::MatrixXf colorCodes;
@@ -53,6 +146,14 @@ enum RenderType
 
 RenderType rendering;
 
+// Defines of the permutation of every rendering mode
+const char* shadingDefines[] = {"WIRE_FRAME", "FLAT_SHADING", "PHONG_SHADING"};
+ShadingProgram shadingPrograms[3];
+// Program of the current rendering mode
+ShadingProgram* shading = NULL;
+// Invert the model matrix per vertex instead of using the uploaded normal matrix
+bool normalMatrixInShader = false;
+
 enum ObjectName
 {
     UNIT_CUBE,
@@ -60,16 +161,39 @@ enum ObjectName
     BUMPY_CUBE
 };
 
+// What happens to the CPU copy of a mesh once it is on the GPU
+enum ResidencyPolicy
+{
+    KEEP_RESIDENT,
+    RELEASE_AFTER_UPLOAD
+};
+
 class Object {
 public:
     unsigned int id;
     ObjectName name;
+    // indexOffset and vertexOffset locate the mesh in the GPU buffers,
+    // the values in I are numbered from the first vertex of the mesh
     unsigned int indexSize;
+    // Unique edges, two indices each, stored right after the triangles
+    // in I and in the IBO range of the mesh
+    unsigned int edgeSize;
     unsigned int indexOffset;
     unsigned int vertexColSize;
     unsigned int vertexOffset;
     Eigen::Vector3f center;
     Eigen::Vector3f baryCenter;
+    // Bounds in model space, kept when the CPU copy is released
+    Eigen::Vector3f boundsMin;
+    Eigen::Vector3f boundsMax;
+    string filename;
+    ResidencyPolicy residency;
+    // Location of the mesh in geometry and I while cpuResident
+    bool cpuResident;
+    unsigned int cpuVertexOffset;
+    unsigned int cpuIndexOffset;
+    // Whether the normals of the CPU copy were computed
+    bool normalsComputed;
     
     Object(){};
     
@@ -77,40 +201,66 @@ public:
         this->id = id;
         this->name = name;
         this->indexSize = indexSize;
+        this->edgeSize = 0;
         this->indexOffset = indexOffset;
         this->vertexColSize = vertexColSize;
         this->vertexOffset = vertexOffset;
         this->center = center;
+        this->boundsMin = center;
+        this->boundsMax = center;
+        this->residency = KEEP_RESIDENT;
+        this->cpuResident = true;
+        this->cpuVertexOffset = 0;
+        this->cpuIndexOffset = 0;
+        this->normalsComputed = false;
+    };
+    
+    // Column of vertex v (a value of I) in the geometry store
+    unsigned int cpuColumn(unsigned int v) const {
+        return v + cpuVertexOffset;
+    };
+    
+    // Bytes taken in VBO, NBO (once it exists) and IBO
+    size_t gpuBytes() const {
+        return (NBO.id != 0 ? 2 : 1) * vertexBytes() + indexBytes();
+    };
+    
+    // Bytes held on the CPU for this mesh by each attribute of the geometry store
+    size_t vertexBytes() const {
+        return sizeof(float) * 3 * vertexColSize;
+    };
+    
+    // Indices of the mesh in I and IBO, triangles then edges
+    unsigned int indexRangeSize() const {
+        return indexSize + edgeSize;
+    };
+    
+    // First edge index in IBO
+    unsigned int edgeOffset() const {
+        return indexOffset + indexSize;
+    };
+    
+    // Bytes held on the CPU for this mesh in I
+    size_t indexBytes() const {
+        return sizeof(unsigned int) * indexRangeSize();
     };
 };
 
 class Instance {
 public:
     unsigned int id;
-    Object object;
-    Eigen::Matrix4f baseMVP;
-    Eigen::Matrix4f transformationMVP;
-    Eigen::Matrix4f baseModel;
-    Eigen::Matrix4f transformationModel;
+    // Shared mesh, counted in the asset registry
+    Object* object;
+    // Handle of the placement in the scene graph
+    int node;
     Eigen::Vector3f color;
     
-    Instance(unsigned int id, Object object, Eigen::Matrix4f baseMVP, Eigen::Matrix4f baseModel, Eigen::Vector3f color){
+    Instance(unsigned int id, Object* object, int node, Eigen::Vector3f color){
         this->id = id;
         this->object = object;
-        this->baseMVP = baseMVP;
-        this->transformationMVP = Eigen::Matrix4f::Identity();
-        this->baseModel = baseModel;
-        this->transformationModel = Eigen::Matrix4f::Identity();
+        this->node = node;
         this->color = color;
     };
-
-    Eigen::Matrix4f getMVP() {
-        return this->transformationMVP * this->baseMVP;
-    };
-    
-    Eigen::Matrix4f getModel() {
-        return this->transformationModel * this->baseModel;
-    };
 };
 
 namespace LightSource {
@@ -125,6 +275,17 @@ Eigen::Vector3f worldUp(0.0, 1.0, 0.0);
 list<Object> objectCollection;
 list<Instance> instanceCollection;
 
+// Placement of the instances, a group moves with its parent instance
+SceneGraph sceneGraph;
+// Instance the next grouped instances are attached to (G key), -1 if none
+int groupParentId = -1;
+
+// Projection * View shared by all the instances, updated with the camera
+Eigen::Matrix4f viewMatrix = Eigen::Matrix4f::Identity();
+Eigen::Matrix4f projectionMatrix = Eigen::Matrix4f::Identity();
+Eigen::Matrix4f viewProjection = Eigen::Matrix4f::Identity();
+Eigen::Matrix4f viewProjectionInverse = Eigen::Matrix4f::Identity();
+
 enum Action
 {
     INSERTION,
@@ -324,25 +485,36 @@ void updateColorToTheSelectedInstance(int colorCodeIndex) {
     }
 }
 
-bool loadMeshFromFile(string filename, Eigen::Vector3f &objectCenter) {
+// Full path of a file of the data directory, empty if it is not found
+string findDataFile(string filename) {
+    if (ifstream("../../data/"+filename).good()) {
+        return "../../data/"+filename;
+    }
+    cout << "Try checking file presence one level above in directory" << endl;
+    if (ifstream("../data/"+filename).good()) {
+        return "../data/"+filename;
+    }
+    cout << "Oops! no file found!" << endl;
+    return "";
+}
+
+// Append the mesh to geometry and I, its indices are numbered from its first vertex
+bool loadMeshFromFile(string path, Eigen::Vector3f &objectCenter) {
+    AllocScope allocScope(ALLOC_LOADING);
     
     ifstream file;
     int no_of_vertices;
     int no_of_faces;
-    int previous_V_col_size = V.cols();
+    int previous_V_col_size = geometry.vertexCount;
     int previous_I_size = I.size();
     int i = 0;
     int totalIndicesPerRow = 0;
     Eigen::Vector3f vertexSum = Eigen::Vector3f::Zero();
     
-    file.open ("../../data/"+filename);
+    file.open (path);
     if (!file.is_open()) {
-        cout << "Try checking file presence one level above in directory" << endl;
-        file.open ("../data/"+filename);
-        if(!file.is_open()){
-            cout << "Oops! no file found!" << endl;
-            return false;
-        }
+        cout << "Oops! could not open " << path << endl;
+        return false;
     }
     
     std::string eachLine;
@@ -372,9 +544,10 @@ bool loadMeshFromFile(string filename, Eigen::Vector3f &objectCenter) {
                 }
                 wordNumber++;
             }
-            V.conservativeResize(3, previous_V_col_size + no_of_vertices);
+            geometry.appendVertices(no_of_vertices);
             //C.conservativeResize(3, previous_V_col_size + no_of_vertices);
         } else if(lineNumber > 1 && lineNumber < no_of_vertices + 2){
+            GeometryStore::Attribute V = geometry.V();
             while (wordStream >> eachWord) {
                 if (wordNumber < 3) {
                     V(wordNumber, previous_V_col_size + lineNumber -2) = stof(eachWord);
@@ -390,7 +563,7 @@ bool loadMeshFromFile(string filename, Eigen::Vector3f &objectCenter) {
                     totalIndicesPerRow = stoi(eachWord);
                 }
                 if (wordNumber > 0 && wordNumber < totalIndicesPerRow + 1) {
-                    I.push_back(previous_V_col_size + stoi(eachWord));
+                    I.push_back(stoi(eachWord));
                 }
                 wordNumber++;
             }
@@ -402,42 +575,330 @@ bool loadMeshFromFile(string filename, Eigen::Vector3f &objectCenter) {
     return true;
 }
 
-void drawOutput()
+// Everything needed to issue the draw of one instance
+struct DrawItem
 {
-    if(I.size() != 0){
-        GLenum mode = rendering == RenderType::WIRE_FRAME ? GL_LINE_LOOP : GL_TRIANGLES;
-       for (auto& instance : instanceCollection) {
-           //set Stencil value
-            glStencilFunc(GL_ALWAYS, instance.id, -1);
-            // in the vertex shader
-            glUniformMatrix4fv(program.uniform("mvp"), 1, GL_FALSE, instance.getMVP().data());
-            glUniformMatrix4fv(program.uniform("model"), 1, GL_FALSE, instance.getModel().data());
-            if(selectedInstanceId == instance.id && !colorUpdated){
-               glUniform3fv(program.uniform("objectColor"), 1, colorCodes.col(12).data());
-            } else {
-                glUniform3fv(program.uniform("objectColor"), 1, instance.color.data());
+    // into the batch of MVP matrices of the frame
+    const float* mvp;
+    const AffineMatrix* world;
+    // cached by the scene graph with the world matrix
+    const float* normal;
+    const Instance* instance;
+    const float* color;
+    const ShadingProgram* shading;
+};
+
+// Draw items of one program are drawn together, the ones of a mesh next
+// to each other so that the instanced path can merge them
+bool byProgram(const DrawItem& a, const DrawItem& b){
+    if(a.shading != b.shading){
+        return a.shading < b.shading;
+    }
+    return a.instance->object < b.instance->object;
+}
+
+// Draw block of an item, in the std140 layout
+void writeDrawUniforms(const DrawItem& item, DrawUniforms& record){
+    memcpy(record.mvp, item.mvp, sizeof(record.mvp));
+    const float* world = item.world->data();
+    for(int column = 0; column < 4; column++){
+        for(int row = 0; row < 3; row++){
+            record.model[4 * column + row] = world[3 * column + row];
+        }
+        record.model[4 * column + 3] = column == 3 ? 1.0f : 0.0f;
+    }
+    for(int column = 0; column < 3; column++){
+        for(int row = 0; row < 3; row++){
+            record.normalMatrix[4 * column + row] = item.normal[3 * column + row];
+        }
+        record.normalMatrix[4 * column + 3] = 0.0f;
+    }
+    memcpy(record.objectColor, item.color, 3 * sizeof(float));
+    record.objectColor[3] = 1.0f;
+}
+
+// Draw block shared by the static batches: their vertices are already in
+// world space and carry their color
+void writeBatchUniforms(DrawUniforms& record){
+    memcpy(record.mvp, viewProjection.data(), sizeof(record.mvp));
+    Eigen::Map<Eigen::Matrix4f>(record.model).setIdentity();
+    memset(record.normalMatrix, 0, sizeof(record.normalMatrix));
+    for(int column = 0; column < 3; column++){
+        record.normalMatrix[4 * column + column] = 1.0f;
+    }
+    memset(record.objectColor, 0, sizeof(record.objectColor));
+}
+
+// CPU geometry of a mesh for the static batches
+bool batchMeshOf(unsigned int objectId, BatchMesh& mesh);
+
+// Camera and lights, the same for every draw of the frame
+void updateFrameUniforms(){
+    FrameUniforms frame;
+    memcpy(frame.view, viewMatrix.data(), sizeof(frame.view));
+    memcpy(frame.projection, projectionMatrix.data(), sizeof(frame.projection));
+    memcpy(frame.viewProjection, viewProjection.data(), sizeof(frame.viewProjection));
+    Eigen::Map<Eigen::Vector4f>(frame.cameraPosition) << cameraPosition, 1.0f;
+    Eigen::Map<Eigen::Vector4f>(frame.lightPosition) << LightSource::position, 1.0f;
+    Eigen::Map<Eigen::Vector4f>(frame.lightColor) << LightSource::color, 1.0f;
+    frameBlock.update(&frame, sizeof(frame));
+}
+
+// Defines of the permutation of a rendering mode
+string permutationOf(RenderType type){
+    string defines = shadingDefines[type];
+    if(normalMatrixInShader){
+        defines += " NORMAL_PER_VERTEX";
+    }
+    return defines;
+}
+
+// Create NBO with the normals of every mesh
+void enableGpuNormals();
+
+// Switch to the permutation of a rendering mode, it is compiled the first
+// time and its uniform blocks are attached then
+bool setRendering(RenderType type){
+    ShadingProgram& entry = shadingPrograms[type];
+    if(!entry.program){
+        string defines = permutationOf(type);
+        entry.program = shaders.get(defines);
+        if(!entry.program){
+            cerr << "Could not build the shaders with " << defines << endl;
+            return false;
+        }
+        GLCapture::uniformBlockBinding(entry.program->program_shader, "Frame", FRAME_BINDING);
+        GLCapture::uniformBlockBinding(entry.program->program_shader, "Draw", DRAW_BINDING);
+    }
+    if(type == RenderType::PHONG_SHADING){
+        enableGpuNormals();
+    }
+    rendering = type;
+    shading = &entry;
+    return true;
+}
+
+typedef vector<DrawItem, ArenaAllocator<DrawItem> > DrawList;
+
+// The wireframe draws the edge list of a mesh, everything else its triangles
+unsigned int drawFirstIndex(const Object& object, GLenum mode){
+    return mode == GL_LINES ? object.edgeOffset() : object.indexOffset;
+}
+
+unsigned int drawIndexCount(const Object& object, GLenum mode){
+    return mode == GL_LINES ? object.edgeSize : object.indexSize;
+}
+
+// One draw per item
+void submitDirect(const DrawList& drawList, GLenum mode){
+    const ShadingProgram* bound = NULL;
+    for (size_t i = 0; i < drawList.size(); i++) {
+        const DrawItem& item = drawList[i];
+        const Instance& instance = *item.instance;
+        if(item.shading != bound){
+            item.shading->program->bind();
+            bound = item.shading;
+        }
+        // in the vertex shader
+        if(i % DRAW_BATCH == 0){
+            drawRing.bindBatch(DRAW_BINDING, i / DRAW_BATCH);
+        }
+        GLCapture::vertexAttribI1ui(DRAW_INDEX_LOCATION, i % DRAW_BATCH);
+
+        /* if(instance.object.name == ObjectName::UNIT_CUBE){
+            glDrawElements(mode, instance.object.indexSize, GL_UNSIGNED_INT, (unsigned int *) instance.object.indexOffset);
+        } else {
+            glDrawElements(mode, instance.object.indexSize, GL_UNSIGNED_INT, (unsigned int *) instance.object.indexOffset);
+        } */
+        GLCapture::drawElementsBaseVertex(mode, drawIndexCount(*instance.object, mode), GL_UNSIGNED_INT, sizeof(unsigned int) * drawFirstIndex(*instance.object, mode), instance.object->vertexOffset);
+        drawCalls++;
+        /*if(rendering == RenderType::FLAT_SHADING){
+            glUniform3f(program.uniform("objectColor"), 0.5, 0.5, 0.5);
+            glDrawElements(GL_LINE_LOOP, instance.object.indexSize, GL_UNSIGNED_INT, (void *) instance.object.indexOffset);
+        }*/
+    }
+}
+
+// One instanced draw per run of items of the same program, mesh and batch,
+// gl_InstanceID walks the records of the run
+void submitInstanced(const DrawList& drawList, GLenum mode){
+    const ShadingProgram* bound = NULL;
+    // no batch has that index
+    size_t boundBatch = drawList.size();
+    size_t first = 0;
+    while(first < drawList.size()){
+        const DrawItem& item = drawList[first];
+        const Object& object = *item.instance->object;
+        size_t last = first + 1;
+        while(last < drawList.size() && last % DRAW_BATCH != 0 && drawList[last].shading == item.shading
+              && drawList[last].instance->object == item.instance->object){
+            last++;
+        }
+        if(item.shading != bound){
+            item.shading->program->bind();
+            bound = item.shading;
+        }
+        if(first / DRAW_BATCH != boundBatch){
+            boundBatch = first / DRAW_BATCH;
+            drawRing.bindBatch(DRAW_BINDING, boundBatch);
+        }
+        GLCapture::vertexAttribI1ui(DRAW_INDEX_LOCATION, first % DRAW_BATCH);
+        GLCapture::drawElementsInstancedBaseVertex(mode, drawIndexCount(object, mode), GL_UNSIGNED_INT, sizeof(unsigned int) * drawFirstIndex(object, mode),
+                                                   last - first, object.vertexOffset);
+        drawCalls++;
+        first = last;
+    }
+}
+
+// The commands of the whole list go up together, then one multi-draw per
+// program and batch. The base instance of a command is its draw index.
+void submitIndirect(const DrawList& drawList, GLenum mode){
+    const size_t commandBytes = sizeof(DrawElementsIndirectCommand);
+    DrawElementsIndirectCommand* commands = static_cast<DrawElementsIndirectCommand*>(drawCommands.begin(commandBytes * drawList.size()));
+    for(size_t i = 0; i < drawList.size(); i++){
+        const Object& object = *drawList[i].instance->object;
+        DrawElementsIndirectCommand& command = commands[i];
+        command.count = drawIndexCount(object, mode);
+        command.instanceCount = 1;
+        command.firstIndex = drawFirstIndex(object, mode);
+        command.baseVertex = object.vertexOffset;
+        command.baseInstance = i % DRAW_BATCH;
+    }
+    size_t commandOffset = drawCommands.end(commandBytes * drawList.size());
+    GLCapture::bindBuffer(GL_DRAW_INDIRECT_BUFFER, drawCommands.id);
+    drawIndices.enable();
+    const ShadingProgram* bound = NULL;
+    size_t first = 0;
+    while(first < drawList.size()){
+        const DrawItem& item = drawList[first];
+        size_t last = first + 1;
+        while(last < drawList.size() && last % DRAW_BATCH != 0 && drawList[last].shading == item.shading){
+            last++;
+        }
+        if(item.shading != bound){
+            item.shading->program->bind();
+            bound = item.shading;
+        }
+        drawRing.bindBatch(DRAW_BINDING, first / DRAW_BATCH);
+        GLCapture::multiDrawElementsIndirect(mode, GL_UNSIGNED_INT, commandOffset + commandBytes * first, last - first, 0);
+        drawCalls++;
+        first = last;
+    }
+    drawIndices.disable();
+    drawCommands.fence();
+}
+
+// The id pass: one draw per item with its id in the pickId attribute, and
+// one per merged instance. Always triangles, a wireframe is picked by its
+// faces.
+void drawIds(const DrawList& drawList, size_t batchRecord){
+    picker.begin();
+    idProgram->bind();
+    for(size_t i = 0; i < drawList.size(); i++){
+        const Object& object = *drawList[i].instance->object;
+        if(i % DRAW_BATCH == 0){
+            drawRing.bindBatch(DRAW_BINDING, i / DRAW_BATCH);
+        }
+        GLCapture::vertexAttribI1ui(DRAW_INDEX_LOCATION, i % DRAW_BATCH);
+        GLCapture::vertexAttribI1ui(PICK_ID_LOCATION, drawList[i].instance->id);
+        GLCapture::drawElementsBaseVertex(GL_TRIANGLES, object.indexSize, GL_UNSIGNED_INT, sizeof(unsigned int) * object.indexOffset, object.vertexOffset);
+    }
+    if(staticBatcher.enabled){
+        drawRing.bindBatch(DRAW_BINDING, batchRecord / DRAW_BATCH);
+        GLCapture::vertexAttribI1ui(DRAW_INDEX_LOCATION, batchRecord % DRAW_BATCH);
+        staticBatcher.draw(GL_TRIANGLES, true);
+        VAO.bind();
+    }
+    picker.end();
+}
+
+void drawOutput(SubmitPath path)
+{
+    AllocScope allocScope(ALLOC_RENDER);
+    if(!objectCollection.empty()){
+        GLenum mode = rendering == RenderType::WIRE_FRAME ? GL_LINES : GL_TRIANGLES;
+        updateFrameUniforms();
+        // The draw list only lives for this frame
+        DrawList drawList{ArenaAllocator<DrawItem>(frameArena.frame())};
+        drawList.reserve(instanceCollection.size());
+        // world matrices of the subtrees edited since the last frame
+        sceneGraph.update();
+        // then one batched product for all the nodes, in the scene graph order
+        size_t nodes = sceneGraph.size();
+        float* mvps = static_cast<float*>(frameArena.frame().allocate(sizeof(float) * 16 * nodes, 64));
+        if(nodes > 0){
+            TransformKernels::multiplyAffine(viewProjection.data(), sceneGraph.world[0].data(), nodes, mvps);
+        }
+        for (auto& instance : instanceCollection) {
+            DrawItem item;
+            const AffineMatrix& world = sceneGraph.worldOf(instance.node);
+            if(staticBatcher.enabled){
+                BatchInstance still;
+                still.id = instance.id;
+                still.object = instance.object->id;
+                still.vertexCount = instance.object->vertexColSize;
+                still.world = &world;
+                still.normal = &sceneGraph.normalOf(instance.node);
+                still.color = instance.color.data();
+                still.center = &instance.object->center;
+                still.canMerge = selectedInstanceId != (int) instance.id && instance.object->cpuResident;
+                if(staticBatcher.track(still)){
+                    continue;
+                }
             }
-           
-    
-           /* if(instance.object.name == ObjectName::UNIT_CUBE){
-                glDrawElements(mode, instance.object.indexSize, GL_UNSIGNED_INT, (unsigned int *) instance.object.indexOffset);
-            } else {
-                glDrawElements(mode, instance.object.indexSize, GL_UNSIGNED_INT, (unsigned int *) instance.object.indexOffset);
-            } */
-            glDrawElements(mode, instance.object.indexSize, GL_UNSIGNED_INT, (void *) instance.object.indexOffset);
-           /*if(rendering == RenderType::FLAT_SHADING){
-               glUniform3f(program.uniform("objectColor"), 0.5, 0.5, 0.5);
-               glDrawElements(GL_LINE_LOOP, instance.object.indexSize, GL_UNSIGNED_INT, (void *) instance.object.indexOffset);
-           }*/
+            item.mvp = mvps + 16 * sceneGraph.position(instance.node);
+            item.world = &world;
+            item.normal = sceneGraph.normalOf(instance.node).data();
+            item.instance = &instance;
+            item.color = selectedInstanceId == instance.id && !colorUpdated ? colorCodes.col(12).data() : instance.color.data();
+            item.shading = shading;
+            drawList.push_back(item);
+        }
+        // one program switch per permutation, the check is cheap when nothing moved in the list
+        if(!is_sorted(drawList.begin(), drawList.end(), byProgram)){
+            sort(drawList.begin(), drawList.end(), byProgram);
         }
+        // the Draw blocks of the frame, in draw order, written straight into
+        // the stream ring, then the one of the static batches
+        size_t batchRecord = drawList.size();
+        char* records = drawRing.begin(drawList.size() + 1);
+        for(size_t i = 0; i < drawList.size(); i++){
+            writeDrawUniforms(drawList[i], *reinterpret_cast<DrawUniforms*>(records + drawRing.recordOffset(i)));
+        }
+        writeBatchUniforms(*reinterpret_cast<DrawUniforms*>(records + drawRing.recordOffset(batchRecord)));
+        drawRing.end(drawList.size() + 1);
+        switch(path){
+            case SUBMIT_DIRECT:
+                submitDirect(drawList, mode);
+                break;
+            case SUBMIT_INSTANCED:
+                submitInstanced(drawList, mode);
+                break;
+            default:
+                submitIndirect(drawList, mode);
+                break;
+        }
+        if(staticBatcher.enabled){
+            shading->program->bind();
+            drawRing.bindBatch(DRAW_BINDING, batchRecord / DRAW_BATCH);
+            GLCapture::vertexAttribI1ui(DRAW_INDEX_LOCATION, batchRecord % DRAW_BATCH);
+            drawCalls += staticBatcher.draw(mode, false);
+            VAO.bind();
+        }
+        if(picker.pending()){
+            drawIds(drawList, batchRecord);
+        }
+        // the section is free again once these draws are done
+        drawRing.fence();
     }
 }
 
-Eigen::Matrix4f calculateBaseModel(Object object){
+Transform initialTransform(const Object& object, ObjectName name){
     float objectScale;
-    Eigen::Matrix4f baseModel;
+    Transform transform;
     
-    switch (object.name) {
+    // the scale follows what was inserted, a mesh can be shared by several names
+    switch (name) {
         case ObjectName::UNIT_CUBE:
             objectScale = 0.2;
             break;
@@ -455,14 +916,16 @@ Eigen::Matrix4f calculateBaseModel(Object object){
     float rand_y = (rand() % 151)/100.0 -0.75; // y values btw -0.75, 0.75
     //float rand_z = (rand() % 3) -4; // z values btw -2, -4
     
-    baseModel = translate(rand_x, rand_y, 0) * translate(target - object.center) * scale(objectScale);
-    return baseModel;
+    // the mesh center is placed at the random position and stays the pivot of later edits
+    transform.pivot = object.center;
+    transform.translation = target + Eigen::Vector3f(rand_x, rand_y, 0);
+    transform.scale.setConstant(objectScale);
+    return transform;
 }
 
-Eigen::Matrix4f calculateBaseMVP(Eigen::Matrix4f baseModel){
+void updateViewProjection(){
     Eigen::Matrix4f View;
     Eigen::Matrix4f Projection;
-    Eigen::Matrix4f baseMvp;
     View = calculate_lookAt_matrix(cameraPosition, target, worldUp);
     float aspectRatio = 1.0f * screen_width / screen_height;
     if(projectionType == Projection::Orthographic){
@@ -470,97 +933,508 @@ Eigen::Matrix4f calculateBaseMVP(Eigen::Matrix4f baseModel){
     } else {
        Projection = perspective(45.0, aspectRatio, 0.1f, 10.0f);
     }
-    baseMvp = Projection * View * baseModel;
-    return baseMvp;
+    viewMatrix = View;
+    projectionMatrix = Projection;
+    viewProjection = Projection * View;
+    viewProjectionInverse = viewProjection.inverse();
 }
 
 void computeNormalsAndBarycenter(Object& object){
-    N.conservativeResize(V.rows(), V.cols());
-    B.conservativeResize(V.rows(), V.cols());
-    Eigen::VectorXf track_no_shared_faces_per_vertex;
-    track_no_shared_faces_per_vertex.conservativeResize(V.cols());
+    GeometryStore::Attribute V = geometry.V();
+    GeometryStore::Attribute N = geometry.N();
+    GeometryStore::Attribute B = geometry.B();
     unsigned int indexSize = object.indexSize;
-    unsigned int indexOffset = object.indexOffset;
+    unsigned int indexOffset = object.cpuIndexOffset;
     unsigned int vertexColSize = object.vertexColSize;
-    unsigned int vertexOffset = object.vertexOffset;
+    unsigned int vertexOffset = object.cpuVertexOffset;
+    // scratch counters of the mesh vertices, released with the frame
+    Eigen::Map<Eigen::VectorXf, Eigen::Aligned> track_no_shared_faces_per_vertex = arenaVector(frameArena.frame(), vertexColSize);
     
-    for(int i = vertexOffset; i < vertexColSize ; i++){
+    // only the span of this mesh is touched
+    for(unsigned int i = vertexOffset; i < vertexOffset + vertexColSize ; i++){
         N.col(i) << 0.0, 0.0, 0.0;
         B.col(i) << 0.0, 0.0, 0.0;
-        track_no_shared_faces_per_vertex(i) = 0;
+        track_no_shared_faces_per_vertex(i - vertexOffset) = 0;
     }
         
-        for( int i=indexOffset; i < indexSize;)
+        for(unsigned int i=indexOffset; i < indexOffset + indexSize;)
         {
             
-            Eigen::Vector3f V0 = V.col(I[i]);
-            Eigen::Vector3f V1 = V.col(I[i+1]);
-            Eigen::Vector3f V2 = V.col(I[i+2]);
+            unsigned int c0 = object.cpuColumn(I[i]);
+            unsigned int c1 = object.cpuColumn(I[i+1]);
+            unsigned int c2 = object.cpuColumn(I[i+2]);
+            Eigen::Vector3f V0 = V.col(c0);
+            Eigen::Vector3f V1 = V.col(c1);
+            Eigen::Vector3f V2 = V.col(c2);
             
             Eigen::Vector3f normal = (V1-V0).cross(V2-V0).normalized();
             
-            N.col(I[i]) += normal;
-            track_no_shared_faces_per_vertex(I[i]) += 1;
-            N.col(I[i+1]) += normal;
-            track_no_shared_faces_per_vertex(I[i+1]) += 1;
-            N.col(I[i+2]) += normal;
-            track_no_shared_faces_per_vertex(I[i+2]) += 1;
+            N.col(c0) += normal;
+            track_no_shared_faces_per_vertex(c0 - vertexOffset) += 1;
+            N.col(c1) += normal;
+            track_no_shared_faces_per_vertex(c1 - vertexOffset) += 1;
+            N.col(c2) += normal;
+            track_no_shared_faces_per_vertex(c2 - vertexOffset) += 1;
             
             //Eigen::Vector3f baryCenter = centroid_of_triangle(V0, V1, V2);
             
             i = i +3;
         }
     
-    for(int i = vertexOffset; i < vertexColSize ; i++){
-        N.col(i) = (N.col(i)/track_no_shared_faces_per_vertex(I[i])).normalized(); // normalize the average of the normal of all shared faces for a vertex
+    for(unsigned int i = vertexOffset; i < vertexOffset + vertexColSize ; i++){
+        if(track_no_shared_faces_per_vertex(i - vertexOffset) > 0){
+            N.col(i) = (N.col(i)/track_no_shared_faces_per_vertex(i - vertexOffset)).normalized(); // normalize the average of the normal of all shared faces for a vertex
+        }
     }
-    NBO.update(N);
 }
 
-void addObjectToTheScene(ObjectName objectName){
-    bool object_loaded = false;
-    for(auto const & object: objectCollection){
-        if(object.name == objectName){
-            object_loaded = true;
+// Append the unique edges of the triangles of the mesh to I, in the order
+// they are first met, and set edgeSize. I must end with the triangles.
+void extractEdges(Object& object){
+    unsigned int first = object.cpuIndexOffset;
+    unordered_set<uint64_t> seen;
+    seen.reserve(object.indexSize);
+    for(unsigned int i = first; i + 2 < first + object.indexSize; i += 3){
+        for(int side = 0; side < 3; side++){
+            unsigned int a = I[i + side];
+            unsigned int b = I[i + (side + 1) % 3];
+            uint64_t key = (uint64_t) min(a, b) << 32 | max(a, b);
+            if(seen.insert(key).second){
+                I.push_back(a);
+                I.push_back(b);
+            }
         }
     }
-    if(!object_loaded){
-        unsigned int previousObjectIndexSize = I.size();
-        unsigned int previousObjectvertexColSize = V.cols();
-        string filename;
-        switch (objectName) {
-            case ObjectName::UNIT_CUBE:
-                filename = "unit_cube_TRIANGLES.off";
-                break;
-            case ObjectName::BUMPY_CUBE:
-                filename = "bumpy_cube.off";
-                break;
-            case ObjectName::BUNNY:
-                filename = "bunny.off";
-                break;
-            default:
-                break;
+    object.edgeSize = I.size() - first - object.indexSize;
+}
+
+// Normals of the CPU copy, computed the first time something reads them
+void ensureCpuNormals(Object& object){
+    if(object.normalsComputed){
+        return;
+    }
+    ProfileClock::time_point start = ProfileClock::now();
+    geometry.allocateNormals();
+    computeNormalsAndBarycenter(object);
+    normalsMs += elapsedMs(start, ProfileClock::now());
+    object.normalsComputed = true;
+}
+
+// Directory of the binary geometry cache, empty to reload released meshes from their source
+string geometryCachePath;
+AssetRegistry assetRegistry;
+// Ranges of the meshes in VBO/NBO (vertices) and IBO (indices)
+RangeAllocator vertexRanges;
+RangeAllocator indexRanges;
+// Bytes the defragmentation may copy on the GPU per frame, and in total
+size_t defragBudget = 256 * 1024;
+size_t defragMovedBytes = 0;
+ResidencyPolicy defaultResidency = KEEP_RESIDENT;
+
+string geometryCacheFile(const Object& object){
+    return geometryCachePath + "/object_" + to_string(object.id) + ".geom";
+}
+
+// The flat and wireframe programs do not read the normals, so their array
+// is bound by location rather than through the current program
+void bindNormalArray(){
+    if(NBO.id == 0){
+        GLCapture::disableVertexAttribArray(NORMAL_LOCATION);
+        return;
+    }
+    NBO.bind();
+    GLCapture::enableVertexAttribArray(NORMAL_LOCATION);
+    GLCapture::vertexAttribPointer(NORMAL_LOCATION, 3, GL_FLOAT, GL_FALSE, 0, 0);
+}
+
+// Copy the mesh to its range of the GPU buffers, which grow as needed
+void uploadObject(Object& object){
+    bool grown = VBO.updateRange(geometry.positions + 3 * object.cpuVertexOffset, 3, object.vertexOffset, object.vertexColSize);
+    if(NBO.id != 0){
+        ensureCpuNormals(object);
+        grown = NBO.updateRange(geometry.normals + 3 * object.cpuVertexOffset, 3, object.vertexOffset, object.vertexColSize) || grown;
+    }
+    IBO.updateRange(I.data() + object.cpuIndexOffset, object.indexOffset, object.indexRangeSize());
+    if(first_load || grown){
+        // a grown buffer has a new id
+        shading->program->bindVertexAttribArray("position", VBO);
+        bindNormalArray();
+        //shading->program->bindVertexAttribArray("color", CBO);
+        first_load = false;
+    }
+}
+
+// Remove the mesh from geometry and I, moving the meshes after it down
+void dropCpuGeometry(Object& object){
+    geometry.remove(object.cpuVertexOffset, object.vertexColSize);
+    I.erase(I.begin() + object.cpuIndexOffset, I.begin() + object.cpuIndexOffset + object.indexRangeSize());
+    if(I.size() <= I.capacity() / 4){
+        I.shrink_to_fit();
+    }
+    for(auto& other: objectCollection){
+        if(other.cpuResident && other.cpuVertexOffset > object.cpuVertexOffset){
+            other.cpuVertexOffset -= object.vertexColSize;
+            other.cpuIndexOffset -= object.indexRangeSize();
         }
-        Eigen::Vector3f objectCenter;
-        if(loadMeshFromFile(filename, objectCenter)) {
-            Object newObject = Object(objectCollection.size()+1 , objectName, I.size() - previousObjectIndexSize, previousObjectIndexSize, V.cols() - previousObjectvertexColSize, previousObjectvertexColSize, objectCenter);
-            objectCollection.push_back(newObject);
-            computeNormalsAndBarycenter(newObject);
-            
-            VBO.update(V);
-            IBO.update(I);
-            
-            if(first_load){
-                program.bindVertexAttribArray("position", VBO);
-                program.bindVertexAttribArray("normal", NBO);
-                //program.bindVertexAttribArray("color", CBO);
-                first_load = false;
+    }
+    object.cpuResident = false;
+}
+
+// Drop the CPU copy of an uploaded mesh, only its bounds and center stay
+void releaseObjectGeometry(Object& object){
+    if(!object.cpuResident){
+        return;
+    }
+    if(!geometryCachePath.empty() && !geometry.saveSpan(geometryCacheFile(object), object.cpuVertexOffset, object.vertexColSize, I.data() + object.cpuIndexOffset, object.indexRangeSize(), object.normalsComputed)){
+        cerr << "Could not write " << geometryCacheFile(object) << ", the mesh will be reloaded from its source" << endl;
+    }
+    dropCpuGeometry(object);
+}
+
+// Bring the CPU copy of a released mesh back, from the cache or the source file
+bool pageInObject(Object& object){
+    if(object.cpuResident){
+        return true;
+    }
+    AllocScope allocScope(ALLOC_LOADING);
+    unsigned int cpuVertexOffset = geometry.vertexCount;
+    unsigned int cpuIndexOffset = I.size();
+    object.cpuVertexOffset = cpuVertexOffset;
+    object.cpuIndexOffset = cpuIndexOffset;
+    bool cachedNormals = false;
+    if(!geometryCachePath.empty() && geometry.loadSpan(geometryCacheFile(object), object.vertexColSize, I, cachedNormals)){
+        if(I.size() - cpuIndexOffset == object.indexRangeSize()){
+            object.normalsComputed = cachedNormals;
+            object.cpuResident = true;
+            return true;
+        }
+        // written before the edges were cached
+        geometry.remove(cpuVertexOffset, geometry.vertexCount - cpuVertexOffset);
+        I.resize(cpuIndexOffset);
+    }
+    Eigen::Vector3f objectCenter;
+    if(!loadMeshFromFile(object.filename, objectCenter)){
+        return false;
+    }
+    if(geometry.vertexCount - cpuVertexOffset != object.vertexColSize || I.size() - cpuIndexOffset != object.indexSize){
+        cerr << object.filename << " changed since it was uploaded" << endl;
+        geometry.remove(cpuVertexOffset, geometry.vertexCount - cpuVertexOffset);
+        I.resize(cpuIndexOffset);
+        return false;
+    }
+    object.normalsComputed = false;
+    extractEdges(object);
+    object.cpuResident = true;
+    return true;
+}
+
+void updateCpuMemoryStats(){
+    memoryStats.set(CPU_POSITIONS, geometry.capacityBytes());
+    memoryStats.set(CPU_NORMALS, geometry.normalBytes());
+    memoryStats.set(CPU_BARYCENTERS, geometry.normalBytes());
+    memoryStats.set(CPU_INDICES, sizeof(unsigned int) * I.capacity());
+    // every list node holds the instance and two links
+    memoryStats.set(CPU_INSTANCES, instanceCollection.size() * (sizeof(Instance) + 2 * sizeof(void *)) + sceneGraph.bytes());
+}
+
+void logMemoryUsage(){
+    memoryStats.log(cout);
+    assetRegistry.log(cout);
+    size_t residentBytes = 0;
+    size_t evictedBytes = 0;
+    for(auto const& object: objectCollection){
+        size_t normalBytes = object.normalsComputed ? object.vertexBytes() : 0;
+        size_t bytes = object.vertexBytes() + 2 * normalBytes + object.indexBytes();
+        (object.cpuResident ? residentBytes : evictedBytes) += bytes;
+        cout << "  object " << object.id << (object.cpuResident ? " (resident)" : " (released)") << ": positions " << object.vertexBytes() << " B, normals " << normalBytes
+             << " B, barycenters " << normalBytes << " B, indices " << object.indexBytes() << " B (edges " << sizeof(unsigned int) * object.edgeSize << " B)" << endl;
+    }
+    cout << "  CPU geometry: resident " << residentBytes << " B, released " << evictedBytes << " B" << endl;
+    cout << "  buffers: VBO " << VBO.bytes << " B, NBO " << NBO.bytes << " B, IBO " << IBO.bytes << " B" << endl;
+    cout << "  ranges: vertices " << vertexRanges.used << " used of " << vertexRanges.end << " (" << vertexRanges.freeRanges.size() << " holes), indices "
+         << indexRanges.used << " used of " << indexRanges.end << " (" << indexRanges.freeRanges.size() << " holes), defragmentation moved " << defragMovedBytes << " B" << endl;
+}
+
+// Apply a residency policy to every loaded object
+void setResidency(ResidencyPolicy policy){
+    for(auto& object: objectCollection){
+        object.residency = policy;
+        if(policy == RELEASE_AFTER_UPLOAD){
+            releaseObjectGeometry(object);
+        } else {
+            pageInObject(object);
+        }
+    }
+    updateCpuMemoryStats();
+}
+
+// Data file of every mesh the editor can insert
+string meshFileName(ObjectName objectName){
+    switch (objectName) {
+        case ObjectName::UNIT_CUBE:
+            return "unit_cube_TRIANGLES.off";
+        case ObjectName::BUMPY_CUBE:
+            return "bumpy_cube.off";
+        case ObjectName::BUNNY:
+            return "bunny.off";
+        default:
+            return "";
+    }
+}
+
+Object* findObject(unsigned int id){
+    for(auto& object: objectCollection){
+        if(object.id == id){
+            return &object;
+        }
+    }
+    return NULL;
+}
+
+bool batchMeshOf(unsigned int objectId, BatchMesh& mesh){
+    Object* object = findObject(objectId);
+    if(!object || !object->cpuResident){
+        return false;
+    }
+    mesh.positions = geometry.positions + 3 * object->cpuVertexOffset;
+    // Like NBO, the batches only get normals once Phong shading needs them
+    mesh.normals = NULL;
+    if(NBO.id != 0){
+        ensureCpuNormals(*object);
+        mesh.normals = geometry.normals + 3 * object->cpuVertexOffset;
+    }
+    mesh.indices = I.data() + object->cpuIndexOffset;
+    mesh.vertexCount = object->vertexColSize;
+    mesh.indexCount = object->indexSize;
+    mesh.edges = mesh.indices + object->indexSize;
+    mesh.edgeCount = object->edgeSize;
+    return true;
+}
+
+// A mesh range being copied to a lower free range of its buffer, a few
+// bytes per frame. The mesh is drawn from the old range until the copy is done.
+struct RangeMove
+{
+    Object* object = NULL;
+    unsigned int from = 0;
+    unsigned int to = 0;
+    unsigned int count = 0;
+    unsigned int copied = 0;
+};
+
+RangeMove vertexMove;
+RangeMove indexMove;
+
+// Stop moving the ranges of a mesh that goes away
+void cancelRangeMoves(const Object& object){
+    if(vertexMove.object == &object){
+        vertexRanges.release(vertexMove.to, vertexMove.count);
+        vertexMove = RangeMove();
+    }
+    if(indexMove.object == &object){
+        indexRanges.release(indexMove.to, indexMove.count);
+        indexMove = RangeMove();
+    }
+}
+
+// Delete a mesh with its GPU ranges, CPU copy and cache file
+void deleteObject(Object& object){
+    cancelRangeMoves(object);
+    if(object.cpuResident){
+        dropCpuGeometry(object);
+    }
+    if(!geometryCachePath.empty()){
+        remove(geometryCacheFile(object).c_str());
+    }
+    vertexRanges.release(object.vertexOffset, object.vertexColSize);
+    indexRanges.release(object.indexOffset, object.indexRangeSize());
+    assetRegistry.remove(object.id);
+    unsigned int id = object.id;
+    objectCollection.remove_if([id](const Object& other){ return other.id == id; });
+}
+
+// Delete unreferenced meshes, least recently used first, until bytes more fit in the budget
+void makeGpuRoom(size_t bytes){
+    for(unsigned int id: assetRegistry.evictionCandidates(bytes)){
+        Object* object = findObject(id);
+        if(object){
+            assetRegistry.evicted(id);
+            deleteObject(*object);
+        }
+    }
+}
+
+// Advance a move by at most budget bytes, or start one for the mesh with
+// the highest range if a free range below can hold it
+void stepRangeMove(RangeMove& move, bool vertices, size_t& budget){
+    RangeAllocator& ranges = vertices ? vertexRanges : indexRanges;
+    if(!move.object){
+        Object* last = NULL;
+        for(auto& object: objectCollection){
+            unsigned int offset = vertices ? object.vertexOffset : object.indexOffset;
+            if(!last || offset > (vertices ? last->vertexOffset : last->indexOffset)){
+                last = &object;
             }
         }
+        if(!last){
+            return;
+        }
+        move.from = vertices ? last->vertexOffset : last->indexOffset;
+        move.count = vertices ? last->vertexColSize : last->indexRangeSize();
+        move.copied = 0;
+        if(!ranges.allocateBelow(move.from, move.count, move.to)){
+            return;
+        }
+        move.object = last;
+    }
+    // positions and normals are moved together
+    size_t elementBytes = vertices ? 2 * 3 * sizeof(float) : sizeof(unsigned int);
+    unsigned int chunk = min<size_t>(move.count - move.copied, budget / elementBytes);
+    if(chunk == 0){
+        return;
+    }
+    if(vertices){
+        VBO.copyRange(move.from + move.copied, move.to + move.copied, chunk);
+        if(NBO.id != 0){
+            NBO.copyRange(move.from + move.copied, move.to + move.copied, chunk);
+        }
+    } else {
+        IBO.copyRange(move.from + move.copied, move.to + move.copied, chunk);
+    }
+    move.copied += chunk;
+    budget -= chunk * elementBytes;
+    defragMovedBytes += chunk * elementBytes;
+    if(move.copied == move.count){
+        (vertices ? move.object->vertexOffset : move.object->indexOffset) = move.to;
+        ranges.release(move.from, move.count);
+        move = RangeMove();
+    }
+}
+
+// Incremental compaction of the GPU buffers: meshes move down into free
+// ranges, the ends of the buffers follow and the buffers shrink once they
+// are mostly empty
+void defragmentStep(){
+    size_t budget = defragBudget;
+    stepRangeMove(vertexMove, true, budget);
+    stepRangeMove(indexMove, false, budget);
+    
+    if(!vertexMove.object && VBO.cols > 0 && vertexRanges.end <= VBO.bytes / (3 * sizeof(float)) / 4){
+        VBO.cols = vertexRanges.end;
+        VBO.reallocate(2 * vertexRanges.end);
+        if(NBO.id != 0){
+            NBO.cols = vertexRanges.end;
+            NBO.reallocate(2 * vertexRanges.end);
+        }
+        shading->program->bindVertexAttribArray("position", VBO);
+        bindNormalArray();
+    }
+    if(!indexMove.object && IBO.size > 0 && indexRanges.end <= IBO.bytes / sizeof(unsigned int) / 4){
+        IBO.size = indexRanges.end;
+        IBO.reallocate(2 * indexRanges.end);
+    }
+}
+
+void enableGpuNormals(){
+    if(NBO.id != 0){
+        return;
+    }
+    AllocScope allocScope(ALLOC_LOADING);
+    NBO.init();
+    for(auto& object: objectCollection){
+        // the budget now counts the normals of every mesh
+        MeshAsset* asset = assetRegistry.find(object.id);
+        if(asset){
+            asset->gpuBytes = object.gpuBytes();
+        }
+        bool resident = object.cpuResident;
+        if(!pageInObject(object)){
+            cerr << "Could not reload " << object.filename << ", it is shaded without normals" << endl;
+            continue;
+        }
+        ensureCpuNormals(object);
+        NBO.updateRange(geometry.normals + 3 * object.cpuVertexOffset, 3, object.vertexOffset, object.vertexColSize);
+        // the part of a move already copied has no normals yet
+        if(vertexMove.object == &object){
+            NBO.updateRange(geometry.normals + 3 * object.cpuVertexOffset, 3, vertexMove.to, object.vertexColSize);
+        }
+        if(!resident){
+            releaseObjectGeometry(object);
+        }
+    }
+    if(staticBatcher.enabled){
+        staticBatcher.addNormals(batchMeshOf);
+    }
+    VAO.bind();
+    bindNormalArray();
+    updateCpuMemoryStats();
+}
+
+// Give the mesh new GPU ranges and upload it there
+void placeOnGpu(Object& object){
+    makeGpuRoom(object.gpuBytes());
+    object.vertexOffset = vertexRanges.allocate(object.vertexColSize);
+    object.indexOffset = indexRanges.allocate(object.indexRangeSize());
+    uploadObject(object);
+}
+
+unsigned int nextObjectId = 1;
+// The ones of deleted instances are reused, ids index dense arrays
+unsigned int lastInstanceId = 0;
+vector<unsigned int> freeInstanceIds;
+
+unsigned int allocateInstanceId(){
+    if(freeInstanceIds.empty()){
+        return ++lastInstanceId;
+    }
+    unsigned int id = freeInstanceIds.back();
+    freeInstanceIds.pop_back();
+    return id;
+}
+
+void addObjectToTheScene(ObjectName objectName){
+    AllocScope allocScope(ALLOC_SCENE);
+    if(memoryStats.overBudget()){
+        cout << "Memory budget exceeded, nothing is added" << endl;
+        memoryStats.log(cout);
+        return;
+    }
+    string path = findDataFile(meshFileName(objectName));
+    uint64_t contentHash;
+    MeshAsset* asset;
+    if(path.empty() || !assetRegistry.lookup(path, contentHash, asset)){
+        return;
+    }
+    // meshes leave the GPU only by being deleted, a known asset is resident
+    Object* object = asset ? findObject(asset->objectId) : NULL;
+    if(!object){
+        ProfileClock::time_point importStart = ProfileClock::now();
+        unsigned int previousObjectIndexSize = I.size();
+        unsigned int previousObjectvertexColSize = geometry.vertexCount;
+        Eigen::Vector3f objectCenter;
+        if(!loadMeshFromFile(path, objectCenter)) {
+            return;
+        }
+        Object newObject = Object(nextObjectId++, objectName, I.size() - previousObjectIndexSize, 0, geometry.vertexCount - previousObjectvertexColSize, 0, objectCenter);
+        newObject.filename = path;
+        newObject.residency = defaultResidency;
+        newObject.cpuVertexOffset = previousObjectvertexColSize;
+        newObject.cpuIndexOffset = previousObjectIndexSize;
+        GeometryStore::Span positions = geometry.span(geometry.positions, newObject.cpuVertexOffset, newObject.vertexColSize);
+        newObject.boundsMin = positions.rowwise().minCoeff();
+        newObject.boundsMax = positions.rowwise().maxCoeff();
+        objectCollection.push_back(newObject);
+        object = &objectCollection.back();
+        extractEdges(*object);
+        placeOnGpu(*object);
+        assetRegistry.add(contentHash, object->id, object->gpuBytes());
+        importMs += elapsedMs(importStart, ProfileClock::now());
+    }
+    if(object->residency == RELEASE_AFTER_UPLOAD){
+        releaseObjectGeometry(*object);
     }
     
     Eigen::Vector3f color;
-    Eigen::Matrix4f mvp;
     switch (objectName) {
         case ObjectName::UNIT_CUBE:
             color << colorCodes.col(9);
@@ -575,14 +1449,77 @@ void addObjectToTheScene(ObjectName objectName){
             break;
     }
     
-    for(auto const& object: objectCollection){
-        if(object.name == objectName){
-            Eigen::Matrix4f baseModel = calculateBaseModel(object);
-            Eigen::Matrix4f baseMVP = calculateBaseMVP(baseModel);
-            Instance instance = Instance(instanceCollection.size()+1, object, baseMVP, baseModel, color);
-            instanceCollection.push_back(instance);
+    Instance instance = Instance(allocateInstanceId(), object, sceneGraph.create(initialTransform(*object, objectName)), color);
+    instanceCollection.push_back(instance);
+    assetRegistry.addReference(object->id);
+    updateCpuMemoryStats();
+}
+
+// Remove an instance, its mesh goes too once unreferenced unless a VRAM
+// budget keeps unreferenced meshes around for reuse
+void deleteInstance(unsigned int id){
+    AllocScope allocScope(ALLOC_SCENE);
+    for(auto it = instanceCollection.begin(); it != instanceCollection.end(); ++it){
+        if(it->id == id){
+            Object* object = it->object;
+            // grouped instances stay where they are, attached to the parent of this one
+            sceneGraph.destroy(it->node);
+            staticBatcher.forget(id);
+            instanceCollection.erase(it);
+            freeInstanceIds.push_back(id);
+            assetRegistry.releaseReference(object->id);
+            MeshAsset* asset = assetRegistry.find(object->id);
+            if(assetRegistry.gpuBudget == 0 && (!asset || asset->references == 0)){
+                deleteObject(*object);
+            } else {
+                makeGpuRoom(0);
+            }
+            if(selectedInstanceId == (int) id){
+                selectedInstanceId = -1;
+            }
+            if(groupParentId == (int) id){
+                groupParentId = -1;
+            }
+            updateCpuMemoryStats();
+            return;
+        }
+    }
+}
+
+Instance* findInstance(int id){
+    for(auto& instance: instanceCollection){
+        if((int) instance.id == id){
+            return &instance;
         }
     }
+    return NULL;
+}
+
+// The first instance grouped becomes the parent, the next ones are attached
+// to it and follow it from then on
+void groupSelectedInstance(){
+    Instance* selected = findInstance(selectedInstanceId);
+    if(!selected){
+        return;
+    }
+    Instance* parent = findInstance(groupParentId);
+    if(!parent || parent == selected){
+        groupParentId = selected->id;
+        cout << "Grouping under instance " << groupParentId << endl;
+    } else if(sceneGraph.setParent(selected->node, parent->node)){
+        cout << "Instance " << selected->id << " attached to instance " << parent->id << endl;
+    } else {
+        cout << "Instance " << parent->id << " belongs to the group of instance " << selected->id << endl;
+    }
+}
+
+// Detach the selected instance, with its own group, from its parent
+void ungroupSelectedInstance(){
+    Instance* selected = findInstance(selectedInstanceId);
+    groupParentId = -1;
+    if(selected){
+        sceneGraph.setParent(selected->node, SceneGraph::NO_NODE);
+    }
 }
 
 void updateChangesToSelectedInstance(){
@@ -593,30 +1530,58 @@ float pointer_x = 0.0;
 float pointer_y = 0.0;
 Eigen::Matrix4f beforeMVP = Eigen::Matrix4f::Identity();
 
+// Last cursor position delivered to the callbacks, so that the editor never
+// queries GLFW directly and a replayed session sees the recorded values
+double cursor_x = 0.0;
+double cursor_y = 0.0;
+
+InputRecorder inputRecorder;
+InputPlayer inputPlayer;
+bool replaying = false;
+bool replayAtRecordedPace = false;
+
+// Move the selected instance by the pointer displacement since the last call
+void dragSelectedInstanceTo(Eigen::Vector4f p_world)
+{
+    for(auto& instance: instanceCollection){
+        if(instance.id == selectedInstanceId){
+            float translation_x = p_world.x() - pointer_x;
+            float translation_y  = p_world.y() - pointer_y;
+            // the offset is in normalized device coordinates, move the instance
+            // in the plane parallel to the screen that goes through its position
+            sceneGraph.update();
+            Eigen::Vector3f position = sceneGraph.worldOf(instance.node) * sceneGraph.transform(instance.node).pivot.homogeneous();
+            Eigen::Vector4f clip = viewProjection * position.homogeneous();
+            clip.x() += translation_x * clip.w();
+            clip.y() += translation_y * clip.w();
+            Eigen::Vector4f moved = viewProjectionInverse * clip;
+            // the translation is expressed in the space of the parent
+            Eigen::Matrix3f toParent = sceneGraph.parentWorld(instance.node).leftCols<3>().inverse();
+            sceneGraph.edit(instance.node).translateBy(toParent * (moved.head<3>() / moved.w() - position));
+            pointer_x = p_world.x();
+            pointer_y = p_world.y();
+        }
+    }
+}
+
 void cursor_position_callback(GLFWwindow *window, double x, double y)
 {
+    AllocScope allocScope(ALLOC_INPUT);
+    inputRecorder.cursorPosition(glfwGetTime(), x, y);
+    cursor_x = x;
+    cursor_y = y;
     if (enableCursorTrack)
     {
         // Get the size of the window
-        int width, height;
-        glfwGetWindowSize(window, &width, &height);
+        int width = screen_width;
+        int height = screen_height;
         
         // Convert screen position to world coordinates
         Eigen::Vector4f p_screen(x,height-1-y,0,1); // NOTE: y axis is flipped in glfw
         Eigen::Vector4f p_canonical((p_screen[0]/width)*2-1,(p_screen[1]/height)*2-1,0,1);
        
-        for(auto& instance: instanceCollection){
-            if(instance.id == selectedInstanceId){
-                Eigen::Vector4f p_world = setTotalView && !totalView.isZero() ? totalView.inverse() * p_canonical : p_canonical;
-                float translation_x = p_world.x() - pointer_x;
-                float translation_y  = p_world.y() - pointer_y;
-                Eigen::Matrix4f transformMatrix = translate(translation_x, translation_y, 0.0);
-                instance.transformationMVP = transformMatrix  * instance.transformationMVP;
-                instance.transformationModel = transformMatrix * instance.transformationModel;
-                pointer_x = p_world.x();
-                pointer_y = p_world.y();
-            }
-        }
+        Eigen::Vector4f p_world = setTotalView && !totalView.isZero() ? totalView.inverse() * p_canonical : p_canonical;
+        dragSelectedInstanceTo(p_world);
     }
 }
 
@@ -639,36 +1604,54 @@ void cursor_position_callback(GLFWwindow *window, double x, double y)
     }
 }*/
 
-bool findInstanceSelected(GLFWwindow *window){
-    // Get the position of the mouse in the window
-    double xpos, ypos;
-    glfwGetCursorPos(window, &xpos, &ypos);
-    
-    GLuint index;
-    glReadPixels(xpos, screen_height - ypos - 1, 1, 1, GL_STENCIL_INDEX, GL_UNSIGNED_INT, &index);
-    if(index > 0){
-        selectedInstanceId = index;
-        return true;
+// Ask the id pass for the instance under the cursor, applyPick acts on it
+// once the id is read back
+void requestPick(PickAction action){
+    picker.request((int) cursor_x, screen_height - (int) cursor_y - 1, action);
+}
+
+void applyPick(GLuint id, PickAction action){
+    inputRecorder.pick(glfwGetTime(), id, action);
+    if(id == 0){
+        return;
     }
-    return false;
+    selectedInstanceId = id;
+    if(action == PICK_DELETE){
+        deleteInstance(id);
+        return;
+    }
+    // edited from now on, drawn on its own until it settles again
+    staticBatcher.unmerge(id);
+    // the drag starts if the button is still held
+    enableCursorTrack = leftButtonDown;
 }
 
 void mouse_button_callback(GLFWwindow *window, int button, int action, int mods)
 {
+    AllocScope allocScope(ALLOC_INPUT);
+    inputRecorder.mouseButton(glfwGetTime(), button, action, mods);
+
     // Get the position of the mouse in the window
-    double xpos, ypos;
-    glfwGetCursorPos(window, &xpos, &ypos);
+    double xpos = cursor_x;
+    double ypos = cursor_y;
     
     // Get the size of the window
-    int width, height;
-    glfwGetWindowSize(window, &width, &height);
+    int width = screen_width;
+    int height = screen_height;
     
     // Convert screen position to world coordinates
     Eigen::Vector4f p_screen(xpos,height-1-ypos,0,1); // NOTE: y axis is flipped in glfw
     Eigen::Vector4f p_canonical((p_screen[0]/width)*2-1,(p_screen[1]/height)*2-1,0,1);
     Eigen::Vector4f p_world = setTotalView && !totalView.isZero() ? totalView.inverse() * p_canonical : p_canonical;
     
-    if(actionTriggered == Action::TRANSLATION){
+    if(button == GLFW_MOUSE_BUTTON_LEFT){
+        leftButtonDown = action == GLFW_PRESS;
+    }
+    if(actionTriggered == Action::DELETION){
+        if(button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS){
+            requestPick(PICK_DELETE);
+        }
+    } else if(actionTriggered == Action::TRANSLATION){
         if (button == GLFW_MOUSE_BUTTON_LEFT)
         {
             switch (action)
@@ -679,11 +1662,10 @@ void mouse_button_callback(GLFWwindow *window, int button, int action, int mods)
                 {
                     case 1:
                     {
-                        if(findInstanceSelected(window)){
-                            pointer_x = p_world.x();
-                            pointer_y = p_world.y();
-                            enableCursorTrack = true;
-                        }
+                        // only read while dragging, which needs a hit
+                        pointer_x = p_world.x();
+                        pointer_y = p_world.y();
+                        requestPick(PICK_SELECT);
                         break;
                     }
                     default:
@@ -711,44 +1693,42 @@ void mouse_button_callback(GLFWwindow *window, int button, int action, int mods)
     }
 }
 
-void updateBaseMVP(){
-    for(auto& instance : instanceCollection){
-        instance.baseMVP =calculateBaseMVP(instance.baseModel);
-    }
-}
-
 void window_size_callback(GLFWwindow* window, int width, int height)
 {
+    AllocScope allocScope(ALLOC_INPUT);
+    inputRecorder.windowSize(glfwGetTime(), width, height);
     screen_width = width;
     screen_height = height;
-    updateBaseMVP();
+    picker.resize(width, height);
+    updateViewProjection();
 }
 
 void updateTransformationToTheSelectedInstance(Transformation transform, string action){
     if(selectedInstanceId > 0){
         for(auto& instance: instanceCollection){
             if(instance.id == selectedInstanceId){
-                Eigen::Matrix4f transformMatrix = Eigen::Matrix4f::Identity();
+                // rotations are about the viewing direction, so they turn the instance on screen
+                sceneGraph.update();
+                Eigen::Matrix3f toParent = sceneGraph.parentWorld(instance.node).leftCols<3>().inverse();
+                Eigen::Vector3f viewAxis = (toParent * (cameraPosition - target)).normalized();
                 switch (transform) {
                     case SCALE:
                         if(action == "UP"){
-                            transformMatrix =  translate(target - instance.object.center) * scale(1.25) * translate(instance.object.center - target);
+                            sceneGraph.edit(instance.node).scaleBy(1.25);
                         } else if(action == "DOWN"){
-                            transformMatrix =  translate(target - instance.object.center) * scale(0.75) * translate(instance.object.center - target);
+                            sceneGraph.edit(instance.node).scaleBy(0.75);
                         }
                         break;
                     case ROTATE:
                         if(action == "CW"){
-                            transformMatrix =  translate(target - instance.object.center) * rotationAboutZ(10) * translate(instance.object.center - target);
+                            sceneGraph.edit(instance.node).rotateBy(Eigen::Quaternionf(Eigen::AngleAxisf(10 * PI / 180, viewAxis)));
                         } else if(action == "CCW"){
-                            transformMatrix = translate(target - instance.object.center) * rotationAboutZ(-10) * translate(instance.object.center - target);
+                            sceneGraph.edit(instance.node).rotateBy(Eigen::Quaternionf(Eigen::AngleAxisf(-10 * PI / 180, viewAxis)));
                         }
                         break;
                     default:
                         break;
                 }
-                instance.transformationMVP = transformMatrix * instance.transformationMVP;
-                instance.transformationModel = transformMatrix * instance.transformationModel;
                 break;
             }
         }
@@ -757,15 +1737,13 @@ void updateTransformationToTheSelectedInstance(Transformation transform, string
 
 void adjustCameraViewBy(Eigen::Vector3f adjustBy){
     cameraPosition = cameraPosition + adjustBy;
-    if(I.size() > 0){
-        for(auto& instance: instanceCollection){
-            instance.baseMVP = calculateBaseMVP(instance.baseModel);
-        }
-    }
+    updateViewProjection();
 }
 
 void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods)
 {
+    AllocScope allocScope(ALLOC_INPUT);
+    inputRecorder.key(glfwGetTime(), key, scancode, action, mods);
     if(action == GLFW_RELEASE){
         // Update the position of the first vertex if the keys 1,2, or 3 are pressed
         switch (key)
@@ -778,6 +1756,12 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
                 selectedInstanceId = -1;
                 colorUpdated = false;
                 break;
+            case GLFW_KEY_D:
+                actionTriggered = Action::DELETION;
+                selectedInstanceId = -1;
+                no_of_clicks_translate = 0;
+                enableCursorTrack = false;
+                break;
             case GLFW_KEY_1:
                 if(actionTriggered == Action::INSERTION){
                     addObjectToTheScene(ObjectName::UNIT_CUBE);
@@ -830,16 +1814,13 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
                 }
                 break;
             case GLFW_KEY_W:
-                rendering = RenderType::WIRE_FRAME;
-                glUniform1i(program.uniform("shadingType"), rendering);
+                setRendering(RenderType::WIRE_FRAME);
                 break;
             case GLFW_KEY_F:
-                rendering = RenderType::FLAT_SHADING;
-                glUniform1i(program.uniform("shadingType"), rendering);
+                setRendering(RenderType::FLAT_SHADING);
                 break;
             case GLFW_KEY_P:
-                rendering = RenderType::PHONG_SHADING;
-                glUniform1i(program.uniform("shadingType"), rendering);
+                setRendering(RenderType::PHONG_SHADING);
                 break;
             case GLFW_KEY_Z:
                 if(actionTriggered == Action::TRANSLATION) {
@@ -860,6 +1841,16 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
                     updateTransformationToTheSelectedInstance(Transformation::ROTATE, "CCW");
                 }
                 break;
+            case GLFW_KEY_G:
+                if(actionTriggered == Action::TRANSLATION) {
+                    groupSelectedInstance();
+                }
+                break;
+            case GLFW_KEY_U:
+                if(actionTriggered == Action::TRANSLATION) {
+                    ungroupSelectedInstance();
+                }
+                break;
             case GLFW_KEY_LEFT:
                 adjustCameraViewBy(Eigen::Vector3f(-1.0, 0.0, 0.0));
                 break;
@@ -874,23 +1865,451 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
                 break;
             case GLFW_KEY_K:
                 projectionType = Projection::Perspective;
-                updateBaseMVP();
+                updateViewProjection();
                 break;
             case GLFW_KEY_L:
                 projectionType = Projection::Orthographic;
-                updateBaseMVP();
+                updateViewProjection();
+                break;
+            case GLFW_KEY_M:
+                logMemoryUsage();
+                break;
+            case GLFW_KEY_E:
+                // toggle between keeping and releasing the CPU copy of the meshes
+                defaultResidency = defaultResidency == KEEP_RESIDENT ? RELEASE_AFTER_UPLOAD : KEEP_RESIDENT;
+                setResidency(defaultResidency);
+                logMemoryUsage();
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+// Feed the recorded events of this frame back to the callbacks
+void replayInputEvents(GLFWwindow *window, unsigned int frame){
+    InputEvent event;
+    while(inputPlayer.poll(frame, event)){
+        if(replayAtRecordedPace){
+            double wait = event.time - glfwGetTime();
+            if(wait > 0){
+                this_thread::sleep_for(chrono::duration<double>(wait));
+            }
+        }
+        switch (event.type) {
+            case InputEventType::KEY_EVENT:
+                key_callback(window, event.a, event.b, event.c, event.d);
+                break;
+            case InputEventType::MOUSE_BUTTON_EVENT:
+                mouse_button_callback(window, event.a, event.c, event.d);
+                break;
+            case InputEventType::CURSOR_POSITION_EVENT:
+                cursor_position_callback(window, event.x, event.y);
+                break;
+            case InputEventType::WINDOW_SIZE_EVENT:
+                glfwSetWindowSize(window, event.a, event.b);
+                window_size_callback(window, event.a, event.b);
+                break;
+            case InputEventType::PICK_EVENT:
+            {
+                // applied on the frame it was recorded on, however long the GPU takes
+                GLuint pickedId;
+                int pickAction;
+                if(!picker.poll(true, pickedId, pickAction)){
+                    cerr << "Frame " << frame << ": the recorded pick has no id pass in the replay" << endl;
+                    break;
+                }
+                if(pickedId != (GLuint) event.a){
+                    cerr << "Frame " << frame << ": picked " << pickedId << " where the recording picked " << event.a << endl;
+                }
+                applyPick(pickedId, (PickAction) pickAction);
                 break;
+            }
             default:
                 break;
         }
     }
 }
 
+// Synthetic stress test, enabled from the command line:
+//   --stress N           insert N instances of every object
+//   --stress-frames F    number of measured frames (default 600)
+//   --stress-churn K     also delete the K oldest instances and insert K new
+//                        ones every frame (allocations are then expected)
+//   --stress-groups G    attach the instances in groups of G to the first one
+//   --stress-shading s   "phong" (default), "flat" or "wire", the wireframe
+//                        summary compares its line segments with line loops
+//   --csv path           csv file receiving the summary row
+//   --label name         label of the row, e.g. the build under test
+// Editing sessions can be recorded and replayed as benchmarks:
+//   --record path        write every input callback to a binary log, with the
+//                        frames the pick results were applied on
+//   --replay path        replay a log instead of listening to the user
+//   --replay-pace mode   "fast" (default) or "recorded" pacing
+//   --seed S             seed of the random instance placement
+//   --pick-region N      side in pixels of the square around the cursor the
+//                        id pass draws when picking (default 16, 0 for all)
+// The OpenGL side can be captured or removed:
+//   --capture-gl path    write the OpenGL calls of the first frames to a file
+//   --capture-frames F   number of frames to capture (default 60)
+//   --gl-null            skip every OpenGL call to time the CPU side alone
+//   --gl-debug severity  report errors through KHR_debug instead of glGetError,
+//                        keeping messages of at least high|medium|low|notification
+//   --gl-debug-sync      deliver debug messages inside the offending call, with
+//                        the last checked location when the checks are compiled in
+// Memory accounting (also printed with the M key):
+//   --memory-log S       print a memory line every S seconds
+//   --gpu-budget MB      refuse new objects once GPU buffers exceed MB
+//   --cpu-budget MB      same for the CPU geometry and instance storage
+//   --no-frame-arena     allocate the per-frame data on the heap instead of the
+//                        frame arena, to compare their allocations and times
+// CPU geometry residency (toggled with the E key):
+//   --release-cpu-geometry  drop the CPU copy of every mesh once uploaded
+//   --geometry-cache dir    save released meshes there instead of reparsing them
+//   --vram-budget MB        keep unreferenced meshes for reuse up to MB of GPU
+//                           buffers, without it they are deleted right away
+//   --defrag-budget KB      GPU bytes the buffer compaction may copy per frame
+// Micro benchmarks, run without opening a window:
+//   --bench-transforms N    time N instance edits with the TRS layout and with
+//                           the accumulated 4x4 matrices it replaced
+//   --bench-scene-graph N   time leaf and root edits of a hierarchy of N nodes
+//   --bench-kernels N       check the batched transform kernels against Eigen
+//                           and time them from 10k up to N matrices
+//   --bench-triangles N     check the ray and point in triangle kernels against
+//                           the scalar ones on N triangles and time them
+// Instruction set of the batched kernels (best supported by default):
+//   --kernel-isa name       scalar, sse4, avx2 or avx512
+// Shading (the stress summary then includes the GPU time of the draws):
+//   --normal-matrix where   "cpu" (default) uploads the normal matrix of every
+//                           instance, "shader" inverts the model matrix per vertex
+//   --shader-cache dir      save the linked programs there and load them on
+//                           later launches instead of compiling
+//   --normals when          "lazy" (default) computes and uploads the normals
+//                           once Phong shading needs them, "eager" at import.
+//                           The stress scene then reports the import time.
+// Draw submission (the stress summary reports the draw calls per frame):
+//   --submit path           "indirect" (default) issues one glMultiDrawElementsIndirect
+//                           per program, "instanced" one instanced draw per run of
+//                           a mesh, "direct" one draw per instance
+//   --static-batching size  merge the instances that stopped moving per cube
+//                           of size world units into pre-transformed geometry
+struct StressConfig
+{
+    bool enabled = false;
+    unsigned int instancesPerObject = 0;
+    unsigned int churn = 0;
+    unsigned int groupSize = 0;
+    RenderType shading = RenderType::PHONG_SHADING;
+    unsigned int warmupFrames = 30;
+    unsigned int frames = 600;
+    string csvPath = "stress_results.csv";
+    string label = "stress";
+};
+
+StressConfig stress;
+FrameStats frameStats;
+unsigned int steadyStateAllocations = 0;
+unsigned int randomSeed = 1;
+string recordPath;
+string replayPath;
+string capturePath;
+unsigned int captureFrames = 60;
+string glDebugSeverity;
+bool glDebugSynchronous = false;
+double memoryLogSeconds = 0.0;
+unsigned int benchTransformUpdates = 0;
+unsigned int benchSceneGraphNodes = 0;
+unsigned int benchKernelMatrices = 0;
+unsigned int benchTriangles = 0;
+string shaderCachePath;
+bool frameArenaHeap = false;
+// GPU time of the draws of every measured frame
+GpuTimer gpuTimer;
+vector<double> gpuFrameMs;
+
+// Whole non-negative numbers, "-5" or "12abc" are refused instead of wrapping or truncating
+bool readUnsigned(const string &text, unsigned int &value)
+{
+    try {
+        size_t used = 0;
+        unsigned long parsed = stoul(text, &used);
+        if(used != text.size() || text.find('-') != string::npos || parsed > numeric_limits<unsigned int>::max())
+            return false;
+        value = (unsigned int) parsed;
+        return true;
+    } catch(const logic_error &){
+        return false;
+    }
+}
 
-int main(void)
+bool readNonNegative(const string &text, double &value)
+{
+    try {
+        size_t used = 0;
+        double parsed = stod(text, &used);
+        if(used != text.size() || !(parsed >= 0.0))
+            return false;
+        value = parsed;
+        return true;
+    } catch(const logic_error &){
+        return false;
+    }
+}
+
+bool invalidValue(const string &arg, const char *value)
+{
+    cerr << "Invalid value for " << arg << ": " << value << endl;
+    return false;
+}
+
+bool parseArguments(int argc, char *argv[])
+{
+    unsigned int count;
+    double amount;
+    for(int i = 1; i < argc; i++){
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if(arg == "--stress" && hasValue){
+            stress.enabled = true;
+            if(!readUnsigned(argv[++i], stress.instancesPerObject))
+                return invalidValue(arg, argv[i]);
+        } else if(arg == "--stress-churn" && hasValue){
+            if(!readUnsigned(argv[++i], stress.churn))
+                return invalidValue(arg, argv[i]);
+        } else if(arg == "--stress-groups" && hasValue){
+            if(!readUnsigned(argv[++i], stress.groupSize))
+                return invalidValue(arg, argv[i]);
+        } else if(arg == "--stress-shading" && hasValue){
+            string name = argv[++i];
+            if(name == "wire"){
+                stress.shading = RenderType::WIRE_FRAME;
+            } else if(name == "flat"){
+                stress.shading = RenderType::FLAT_SHADING;
+            } else if(name == "phong"){
+                stress.shading = RenderType::PHONG_SHADING;
+            } else {
+                cerr << "Unknown shading: " << name << endl;
+                return false;
+            }
+        } else if(arg == "--stress-frames" && hasValue){
+            if(!readUnsigned(argv[++i], stress.frames))
+                return invalidValue(arg, argv[i]);
+        } else if(arg == "--csv" && hasValue){
+            stress.csvPath = argv[++i];
+        } else if(arg == "--label" && hasValue){
+            stress.label = argv[++i];
+        } else if(arg == "--record" && hasValue){
+            recordPath = argv[++i];
+        } else if(arg == "--replay" && hasValue){
+            replayPath = argv[++i];
+            replaying = true;
+        } else if(arg == "--replay-pace" && hasValue){
+            string pace = argv[++i];
+            if(pace != "fast" && pace != "recorded")
+                return invalidValue(arg, argv[i]);
+            replayAtRecordedPace = pace == "recorded";
+        } else if(arg == "--pick-region" && hasValue){
+            if(!readUnsigned(argv[++i], count))
+                return invalidValue(arg, argv[i]);
+            picker.region = (int) count;
+        } else if(arg == "--seed" && hasValue){
+            if(!readUnsigned(argv[++i], randomSeed))
+                return invalidValue(arg, argv[i]);
+        } else if(arg == "--capture-gl" && hasValue){
+            capturePath = argv[++i];
+        } else if(arg == "--capture-frames" && hasValue){
+            if(!readUnsigned(argv[++i], captureFrames))
+                return invalidValue(arg, argv[i]);
+        } else if(arg == "--gl-null"){
+            GLCapture::backend = GLCapture::NULL_BACKEND;
+        } else if(arg == "--gl-debug" && hasValue){
+            glDebugSeverity = argv[++i];
+            if(glDebugSeverity != "high" && glDebugSeverity != "medium" && glDebugSeverity != "low" && glDebugSeverity != "notification")
+                return invalidValue(arg, argv[i]);
+        } else if(arg == "--gl-debug-sync"){
+            glDebugSynchronous = true;
+        } else if(arg == "--memory-log" && hasValue){
+            if(!readNonNegative(argv[++i], memoryLogSeconds))
+                return invalidValue(arg, argv[i]);
+        } else if(arg == "--gpu-budget" && hasValue){
+            if(!readNonNegative(argv[++i], amount))
+                return invalidValue(arg, argv[i]);
+            memoryStats.gpuBudget = (size_t) (amount * 1024 * 1024);
+        } else if(arg == "--cpu-budget" && hasValue){
+            if(!readNonNegative(argv[++i], amount))
+                return invalidValue(arg, argv[i]);
+            memoryStats.cpuBudget = (size_t) (amount * 1024 * 1024);
+        } else if(arg == "--no-frame-arena"){
+            frameArenaHeap = true;
+        } else if(arg == "--release-cpu-geometry"){
+            defaultResidency = RELEASE_AFTER_UPLOAD;
+        } else if(arg == "--geometry-cache" && hasValue){
+            geometryCachePath = argv[++i];
+        } else if(arg == "--vram-budget" && hasValue){
+            if(!readNonNegative(argv[++i], amount))
+                return invalidValue(arg, argv[i]);
+            assetRegistry.gpuBudget = (size_t) (amount * 1024 * 1024);
+        } else if(arg == "--defrag-budget" && hasValue){
+            if(!readNonNegative(argv[++i], amount))
+                return invalidValue(arg, argv[i]);
+            defragBudget = (size_t) (amount * 1024);
+        } else if(arg == "--bench-transforms" && hasValue){
+            if(!readUnsigned(argv[++i], benchTransformUpdates))
+                return invalidValue(arg, argv[i]);
+        } else if(arg == "--bench-scene-graph" && hasValue){
+            if(!readUnsigned(argv[++i], benchSceneGraphNodes))
+                return invalidValue(arg, argv[i]);
+        } else if(arg == "--bench-kernels" && hasValue){
+            if(!readUnsigned(argv[++i], benchKernelMatrices))
+                return invalidValue(arg, argv[i]);
+        } else if(arg == "--bench-triangles" && hasValue){
+            if(!readUnsigned(argv[++i], benchTriangles))
+                return invalidValue(arg, argv[i]);
+        } else if(arg == "--shader-cache" && hasValue){
+            shaderCachePath = argv[++i];
+        } else if(arg == "--submit" && hasValue){
+            if(!submitPathFromName(argv[++i], submitPath)){
+                cerr << "Unknown submission path: " << argv[i] << endl;
+                return false;
+            }
+        } else if(arg == "--static-batching" && hasValue){
+            staticBatcher.enabled = true;
+            if(!readNonNegative(argv[++i], amount) || amount == 0.0)
+                return invalidValue(arg, argv[i]);
+            staticBatcher.cellSize = (float) amount;
+        } else if(arg == "--normals" && hasValue){
+            string when = argv[++i];
+            if(when != "lazy" && when != "eager")
+                return invalidValue(arg, argv[i]);
+            lazyNormals = when == "lazy";
+        } else if(arg == "--normal-matrix" && hasValue){
+            string where = argv[++i];
+            if(where != "cpu" && where != "shader")
+                return invalidValue(arg, argv[i]);
+            normalMatrixInShader = where == "shader";
+        } else if(arg == "--kernel-isa" && hasValue){
+            TransformKernels::Isa isa;
+            if(!TransformKernels::fromName(argv[++i], isa) || !TransformKernels::select(isa)){
+                cerr << "Unknown or unsupported instruction set: " << argv[i] << endl;
+                return false;
+            }
+        } else {
+            cerr << "Unknown or incomplete argument: " << arg << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+void setupStressScene(){
+    setRendering(stress.shading);
+    ObjectName objects[] = {ObjectName::UNIT_CUBE, ObjectName::BUMPY_CUBE, ObjectName::BUNNY};
+    for(auto objectName: objects){
+        for(unsigned int i = 0; i < stress.instancesPerObject; i++){
+            addObjectToTheScene(objectName);
+        }
+    }
+    if(stress.groupSize > 1){
+        int parentNode = SceneGraph::NO_NODE;
+        unsigned int index = 0;
+        for(auto& instance: instanceCollection){
+            if(index++ % stress.groupSize == 0){
+                parentNode = instance.node;
+            } else {
+                sceneGraph.setParent(instance.node, parentNode);
+            }
+        }
+    }
+    actionTriggered = Action::TRANSLATION;
+    cout << "Stress scene: " << instanceCollection.size() << " instances, " << TransformKernels::name(TransformKernels::selected()) << " transform kernels" << endl;
+    cout << "Import: " << objectCollection.size() << " meshes in " << importMs << " ms, normals " << normalsMs << " ms ("
+         << (lazyNormals ? "lazy" : "eager") << "), NBO " << NBO.bytes << " B" << endl;
+}
+
+// Print who allocated during a frame that should not have
+void reportFrameAllocations(unsigned int frame){
+    cerr << "Frame " << frame << " allocated:";
+    for(int i = 0; i < ALLOC_SUBSYSTEM_COUNT; i++){
+        AllocTracker::Counters counters = AllocTracker::frame((AllocSubsystem) i);
+        if(counters.count() > 0){
+            cerr << " " << AllocTracker::name((AllocSubsystem) i) << " " << counters.allocations << " new (" << counters.bytes << " B) "
+                 << counters.eigenAllocations << " Eigen";
+        }
+    }
+    cerr << endl;
+}
+
+// Camera flythrough plus one scripted drag/rotate/scale edit per frame
+void stepStressScene(unsigned int frame){
+    AllocScope allocScope(ALLOC_SCENE);
+    unsigned int totalFrames = stress.warmupFrames + stress.frames;
+    float angle = 2 * PI * frame / totalFrames;
+    Eigen::Vector3f orbit(target.x() + 3.0 * sin(angle), target.y() + 1.0 + 0.5 * sin(2 * angle), target.z() + 3.0 * cos(angle));
+    adjustCameraViewBy(orbit - cameraPosition);
+    
+    ObjectName objects[] = {ObjectName::UNIT_CUBE, ObjectName::BUMPY_CUBE, ObjectName::BUNNY};
+    for(unsigned int i = 0; i < stress.churn && !instanceCollection.empty(); i++){
+        deleteInstance(instanceCollection.front().id);
+        addObjectToTheScene(objects[(frame + i) % 3]);
+    }
+    
+    if(instanceCollection.empty()){
+        return;
+    }
+    selectedInstanceId = frame % instanceCollection.size() + 1;
+    pointer_x = 0.0;
+    pointer_y = 0.0;
+    float step = 0.01 * sin(8 * angle);
+    dragSelectedInstanceTo(Eigen::Vector4f(step, -step, 0.0, 1.0));
+    switch (frame % 4) {
+        case 0:
+            updateTransformationToTheSelectedInstance(Transformation::ROTATE, "CW");
+            break;
+        case 1:
+            updateTransformationToTheSelectedInstance(Transformation::SCALE, "UP");
+            break;
+        case 2:
+            updateTransformationToTheSelectedInstance(Transformation::ROTATE, "CCW");
+            break;
+        default:
+            updateTransformationToTheSelectedInstance(Transformation::SCALE, "DOWN");
+            break;
+    }
+    selectedInstanceId = -1;
+}
+
+int main(int argc, char *argv[])
 {
     GLFWwindow *window;
 
+    if (!parseArguments(argc, argv))
+        return -1;
+
+    if (benchTransformUpdates > 0 || benchSceneGraphNodes > 0 || benchKernelMatrices > 0 || benchTriangles > 0)
+    {
+        if (benchTransformUpdates > 0)
+            Transform::benchmark(benchTransformUpdates);
+        if (benchSceneGraphNodes > 0)
+            SceneGraph::benchmark(benchSceneGraphNodes);
+        if (benchKernelMatrices > 0 && !TransformKernels::benchmark(benchKernelMatrices))
+            return 1;
+        if (benchTriangles > 0 && !TriangleKernels::benchmark(benchTriangles))
+            return 1;
+        return 0;
+    }
+
+    if (replaying)
+    {
+        if (!inputPlayer.load(replayPath))
+            return -1;
+        randomSeed = inputPlayer.header.seed;
+        cout << "Replaying " << inputPlayer.events.size() << " input events from " << replayPath << endl;
+        if (stress.label == "stress")
+            stress.label = "replay";
+    }
+    // The placement of new instances is the only source of randomness
+    srand(randomSeed);
+
     // Initialize the library
     if (!glfwInit())
         return -1;
@@ -908,6 +2327,10 @@ int main(void)
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 #endif
 
+    // Debug messages are only guaranteed on a debug context
+    if (!glDebugSeverity.empty())
+        glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GL_TRUE);
+
     // Create a windowed mode window and its OpenGL context
     window = glfwCreateWindow(screen_width, screen_height, "Assignment3_All_tasks", NULL, NULL);
     if (!window)
@@ -938,15 +2361,27 @@ int main(void)
     printf("OpenGL version recieved: %d.%d.%d\n", major, minor, rev);
     printf("Supported OpenGL is %s\n", (const char *)glGetString(GL_VERSION));
     printf("Supported GLSL is %s\n", (const char *)glGetString(GL_SHADING_LANGUAGE_VERSION));
+
+    if (!glDebugSeverity.empty() && enable_gl_debug_output(glDebugSeverity, glDebugSynchronous))
+        cout << "OpenGL errors reported through KHR_debug (" << glDebugSeverity << ")" << endl;
     
     cout << "******* All tasks are covered *******" << endl;
 
+    // The capture starts before any object is created so that it can be replayed
+    if (!capturePath.empty() && !GLCapture::begin(capturePath))
+        return -1;
+    if (GLCapture::backend == GLCapture::NULL_BACKEND)
+        cout << "Null OpenGL backend: no OpenGL call is issued" << endl;
+
     // Initialize the VAO
     // A Vertex Array Object (or VAO) is an object that describes how the vertex
     // attributes are stored in a Vertex Buffer Object (or VBO). This means that
     // the VAO is not the actual object storing the vertex data,
     // but the descriptor of the vertex data.
-    VertexArrayObject VAO;
+    // Transient buffers come from here, the size grows if a frame needs more
+    frameArena.init(1024 * 1024);
+    frameArena.arenas[0].heap = frameArena.arenas[1].heap = frameArenaHeap;
+
     VAO.init();
     VAO.bind();
 
@@ -955,7 +2390,9 @@ int main(void)
     VBO.init();
     //CBO.init();
     IBO.init();
-    NBO.init();
+    if(!lazyNormals){
+        NBO.init();
+    }
     
     colorCodes.resize(3, 13);
     colorCodes <<
@@ -1009,127 +2446,409 @@ int main(void)
         "vec3 fragColor = (ambient + diffuse + specular) * objectColor;"
         "outColor = vec4(fragColor, 1.0);"
         "}";*/
+    // PHONG_SHADING lights the vertices from their normals and adds the
+    // specular term. FLAT_SHADING needs no normals: the fragments are lit
+    // from the face normal, the cross product of the screen space
+    // derivatives of the world position. The lines of WIRE_FRAME have no
+    // face, they get the light of a face turned to the light. ID_PASS
+    // writes the pickId attribute to an unsigned target.
+    // NORMAL_PER_VERTEX inverts the model matrix in the shader, to compare
+    // with the uploaded normal matrix.
+    const GLchar *frame_block =
+    "layout(std140) uniform Frame {"
+    "   mat4 view;"
+    "   mat4 projection;"
+    "   mat4 viewProjection;"
+    "   vec4 cameraPosition;"
+    "   vec4 lightPosition;"
+    "   vec4 lightColor;"
+    "};\n";
     const GLchar *vertex_shader =
-    "#version 150 core\n"
-    "in vec3 position;"
-    "in vec3 normal;"
-    "uniform mat4 mvp;"
-    "uniform mat4 model;"
-    "uniform vec3 objectColor;"
-    "uniform vec3 lightPosition;"
-    "uniform vec3 lightColor;"
-    "uniform vec3 cameraPosition;"
-    "uniform int shadingType;"
-    "flat out vec3 flatColor;"
-    "smooth out vec3 smoothColor;"
+    "in vec3 position;\n"
+    "#ifdef PHONG_SHADING\n"
+    "in vec3 normal;\n"
+    "#endif\n"
+    "struct DrawRecord {"
+    "   mat4 mvp;"
+    "   mat4 model;"
+    "   mat3 normalMatrix;"
+    "   vec4 objectColor;"
+    "};"
+    "layout(std140) uniform Draw {"
+    "   DrawRecord draws[DRAW_BATCH];"
+    "};"
+    // first record of the draw, the instances of a draw use the next ones
+    "in uint drawIndex;"
+    // only the static batches have a color per vertex, (0, 0, 0) otherwise
+    "in vec3 vertexColor;\n"
+    "#ifdef ID_PASS\n"
+    "in uint pickId;"
+    "flat out uint id;\n"
+    "#elif defined(FLAT_SHADING)\n"
+    "out vec3 fragPosition;"
+    "flat out vec3 color;\n"
+    "#else\n"
+    "smooth out vec3 color;\n"
+    "#endif\n"
     "void main()"
     "{"
-    "   gl_Position = mvp * vec4(position, 1.0);"
-    "   vec3 vNormal = mat3(transpose(inverse(model))) * normal;"
-    "   vec3 fragPos = vec3(model * vec4(position, 1.0)); "
+    "   DrawRecord draw = draws[drawIndex + uint(gl_InstanceID)];"
+    "   gl_Position = draw.mvp * vec4(position, 1.0);\n"
+    "#ifdef ID_PASS\n"
+    "   id = pickId;\n"
+    "#else\n"
+    "   vec3 fragPos = vec3(draw.model * vec4(position, 1.0));"
+    "   vec3 baseColor = draw.objectColor.rgb + vertexColor;\n"
+    "#ifdef FLAT_SHADING\n"
+    "   fragPosition = fragPos;"
+    "   color = baseColor;\n"
+    "#else\n"
     "   float Ka = 0.3;"
     "   float Kd = 0.2;"
-    "   float Ks = 0.5;"
-    "   vec3 ambient = Ka * lightColor;"
+    "   vec3 ambient = Ka * lightColor.rgb;\n"
+    "#ifdef PHONG_SHADING\n"
+    "#ifdef NORMAL_PER_VERTEX\n"
+    "   vec3 vNormal = mat3(transpose(inverse(draw.model))) * normal;\n"
+    "#else\n"
+    "   vec3 vNormal = draw.normalMatrix * normal;\n"
+    "#endif\n"
     "   vec3 norm = normalize(vNormal);"
-    "   vec3 lightDir = normalize(lightPosition - fragPos);"
+    "   vec3 lightDir = normalize(lightPosition.xyz - fragPos);"
     "   float diff = max(dot(norm, lightDir), 0.0);"
-    "   vec3 diffuse = Kd * diff * lightColor;"
-    "   vec3 specular = vec3(0.0, 0.0, 0.0);"
-    "   if(shadingType == 2){"
-    "   vec3 viewDir = normalize(cameraPosition - fragPos);"
+    "   float Ks = 0.5;"
+    "   vec3 viewDir = normalize(cameraPosition.xyz - fragPos);"
     "   vec3 reflectDir = reflect(-lightDir, norm);"
     "   float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32);"
-    "   specular = Ks * spec * lightColor; } "
-    "   flatColor = (ambient + diffuse + specular) * objectColor;"
-    "   smoothColor = (ambient + diffuse + specular) * objectColor;"
+    "   vec3 light = ambient + Kd * diff * lightColor.rgb + Ks * spec * lightColor.rgb;\n"
+    "#else\n"
+    "   vec3 light = ambient + Kd * lightColor.rgb;\n"
+    "#endif\n"
+    "   color = light * baseColor;\n"
+    "#endif\n"
+    "#endif\n"
     "}";
     const GLchar *fragment_shader =
-    "#version 150 core\n"
-    "flat in vec3 flatColor;"
-    "smooth in vec3 smoothColor;"
-    "uniform int shadingType;"
-    "out vec4 outColor;"
+    "#ifdef ID_PASS\n"
+    "flat in uint id;"
+    "out uint outColor;\n"
+    "#elif defined(FLAT_SHADING)\n"
+    "in vec3 fragPosition;"
+    "flat in vec3 color;"
+    "out vec4 outColor;\n"
+    "#else\n"
+    "smooth in vec3 color;"
+    "out vec4 outColor;\n"
+    "#endif\n"
     "void main()"
-    "{"
-    "   if(shadingType == 1){"
-    "       outColor = vec4(flatColor, 1.0);"
-    "   } else {"
-    "       outColor = vec4(smoothColor, 1.0);"
-    "   }"
-  
+    "{\n"
+    "#ifdef ID_PASS\n"
+    "   outColor = id;\n"
+    "#elif defined(FLAT_SHADING)\n"
+    // facing the viewer, which is the outside of a front face
+    "   vec3 norm = normalize(cross(dFdx(fragPosition), dFdy(fragPosition)));"
+    "   float Ka = 0.3;"
+    "   float Kd = 0.2;"
+    "   vec3 lightDir = normalize(lightPosition.xyz - fragPosition);"
+    "   float diff = max(dot(norm, lightDir), 0.0);"
+    "   vec3 light = Ka * lightColor.rgb + Kd * diff * lightColor.rgb;"
+    "   outColor = vec4(light * color, 1.0);\n"
+    "#else\n"
+    "   outColor = vec4(color, 1.0);\n"
+    "#endif\n"
     "}";
 
-    // Compile the two shaders and upload the binary to the GPU
+    // The permutations are compiled when their mode is first used
     // Note that we have to explicitly specify that the output "slot" called outColor
     // is the one that we want in the fragment buffer (and thus on screen)
-    program.init(vertex_shader, fragment_shader, "outColor");
-    program.bind();
+    string vertexSource = "#define DRAW_BATCH " + to_string(DRAW_BATCH) + "\n" + frame_block + vertex_shader;
+    string fragmentSource = string(frame_block) + fragment_shader;
+    shaders.init("#version 150 core", vertexSource, fragmentSource, "outColor", {"position", "normal", "drawIndex", "vertexColor", "pickId"});
+    frameBlock.init(sizeof(FrameUniforms), FRAME_BINDING);
+    // three frames in flight
+    drawRing.init(sizeof(DrawUniforms), DRAW_BATCH, 3);
+    if(submitPath == SUBMIT_INDIRECT && !multiDrawIndirectSupported()){
+        cout << "glMultiDrawElementsIndirect is not available, the draws are instanced instead" << endl;
+        submitPath = SUBMIT_INSTANCED;
+    }
+    if(submitPath == SUBMIT_INDIRECT){
+        drawIndices.init(DRAW_INDEX_LOCATION, DRAW_BATCH);
+        drawCommands.init(GL_DRAW_INDIRECT_BUFFER, 1024 * sizeof(DrawElementsIndirectCommand), 3, GPU_VERTEX_BUFFERS);
+    }
+    cout << "Draw submission: " << submitPathName(submitPath) << endl;
+    staticBatcher.init(0, NORMAL_LOCATION, VERTEX_COLOR_LOCATION, PICK_ID_LOCATION);
+    shaders.cacheDirectory = shaderCachePath;
+    if(has_gl_extension("GL_KHR_parallel_shader_compile")){
+        // as many compiler threads as the driver allows
+        typedef void (GLAPIENTRY *MaxShaderCompilerThreads)(GLuint count);
+        MaxShaderCompilerThreads maxThreads = (MaxShaderCompilerThreads) glfwGetProcAddress("glMaxShaderCompilerThreadsKHR");
+        if(maxThreads){
+            maxThreads(0xFFFFFFFF);
+        }
+        shaders.parallel = true;
+    }
+    // the cached permutations are loaded and the other ones queued together
+    shaders.prepare({permutationOf(RenderType::WIRE_FRAME), permutationOf(RenderType::FLAT_SHADING), permutationOf(RenderType::PHONG_SHADING), "ID_PASS"});
+    if(!setRendering(RenderType::WIRE_FRAME)){
+        return -1;
+    }
+    idProgram = shaders.get("ID_PASS");
+    if(!idProgram){
+        cerr << "Could not build the shaders with ID_PASS" << endl;
+        return -1;
+    }
+    GLCapture::uniformBlockBinding(idProgram->program_shader, "Frame", FRAME_BINDING);
+    GLCapture::uniformBlockBinding(idProgram->program_shader, "Draw", DRAW_BINDING);
+    shaders.printStats();
 
-    // Register the keyboard callback
-    glfwSetKeyCallback(window, key_callback);
+    if (replaying)
+    {
+        // The recorded events drive the editor, live input is ignored
+        glfwSetWindowSize(window, inputPlayer.header.width, inputPlayer.header.height);
+        screen_width = inputPlayer.header.width;
+        screen_height = inputPlayer.header.height;
+    }
+    else
+    {
+        glfwGetWindowSize(window, &screen_width, &screen_height);
 
-    // Register the mouse callback
-    glfwSetMouseButtonCallback(window, mouse_button_callback);
+        // Register the keyboard callback
+        glfwSetKeyCallback(window, key_callback);
 
-    // Register the cursor position callback
-    glfwSetCursorPosCallback(window, cursor_position_callback);
-    
-    // window resize callback
-    glfwSetWindowSizeCallback(window, window_size_callback);
+        // Register the mouse callback
+        glfwSetMouseButtonCallback(window, mouse_button_callback);
+
+        // Register the cursor position callback
+        glfwSetCursorPosCallback(window, cursor_position_callback);
+        
+        // window resize callback
+        glfwSetWindowSizeCallback(window, window_size_callback);
+    }
+    picker.resize(screen_width, screen_height);
+    updateViewProjection();
+
+    if (!recordPath.empty())
+    {
+        InputLogHeader header;
+        header.seed = randomSeed;
+        header.width = screen_width;
+        header.height = screen_height;
+        if (!inputRecorder.open(recordPath, header))
+            return -1;
+    }
     
-    glUniform3fv(program.uniform("lightPosition"), 1, LightSource::position.data());
-    glUniform3fv(program.uniform("lightColor"), 1, LightSource::color.data());
-    glUniform3fv(program.uniform("cameraPosition"), 1, cameraPosition.data());
-    glUniform1i(program.uniform("shadingType"), RenderType::WIRE_FRAME);
+    bool measureFrames = stress.enabled || replaying;
+    if (replaying)
+        stress.warmupFrames = 0;
+    if (measureFrames && !replayAtRecordedPace)
+    {
+        // Measure the editor, not the display refresh rate
+        glfwSwapInterval(0);
+    }
+    if (measureFrames && GLCapture::backend == GLCapture::NATIVE_BACKEND && !gpuTimer.init())
+        cerr << "Timer queries are not available, the GPU time is not measured" << endl;
+    if (stress.enabled)
+    {
+        setupStressScene();
+        frameStats.reserve(stress.frames);
+        gpuFrameMs.reserve(stress.frames);
+    }
+    if (replaying && !inputPlayer.events.empty())
+    {
+        frameStats.reserve(inputPlayer.events.back().frame + 1);
+        gpuFrameMs.reserve(inputPlayer.events.back().frame + 1);
+    }
+    unsigned int frame = 0;
+    size_t sceneGraphUpdatedNodes = 0;
+    size_t sceneGraphUpdatedMax = 0;
+    size_t drawCallsTotal = 0;
+    size_t drawCallsMax = 0;
+    ProfileClock::time_point frameStart = ProfileClock::now();
+    ProfileClock::time_point lastMemoryLog = frameStart;
+    // Event timestamps are relative to the first frame
+    glfwSetTime(0.0);
 
     // Loop until the user closes the window
     while (!glfwWindowShouldClose(window))
     {
+        AllocTracker::beginFrame();
+        frameArena.beginFrame();
+        sceneGraph.updatedNodes = 0;
+        if (stress.enabled)
+            stepStressScene(frame);
+        defragmentStep();
+        if (staticBatcher.enabled)
+            staticBatcher.step(batchMeshOf);
+
         // Bind your VAO (not necessary if you have only one)
         VAO.bind();
 
-        // Bind your program
-        program.bind();
+        // The program of each draw is bound by drawOutput
 
         // Clear the framebuffer
-        glClearColor(0.5f, 0.5f, 0.5f, 1.0f);
-        // this is the default value(background) for stencil
-        glClearStencil(0);
+        GLCapture::clearColor(0.5f, 0.5f, 0.5f, 1.0f);
         //glClear(GL_COLOR_BUFFER_BIT);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+        GLCapture::clear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         
         // Enable depth test
-        glEnable(GL_DEPTH_TEST);
-        glEnable(GL_CULL_FACE);
+        GLCapture::enable(GL_DEPTH_TEST);
+        GLCapture::enable(GL_CULL_FACE);
          // default cull face 'GL_BACK' and front face is 'GL_CCW'
         
         // Enable blend
         //glEnable(GL_BLEND);
         //glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
         
-        /* Enable stencil operations */
-        glEnable(GL_STENCIL_TEST);
-        glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
-        
-        drawOutput();
+        bool timeGpu = measureFrames && frame >= stress.warmupFrames;
+        if (timeGpu)
+            gpuTimer.begin();
+        ProfileClock::time_point submitStart = ProfileClock::now();
+        drawCalls = 0;
+        drawOutput(submitPath);
+        double submitMs = elapsedMs(submitStart, ProfileClock::now());
+        if (timeGpu)
+            gpuTimer.end();
+
+        GLCapture::endFrame();
+        if (GLCapture::capturing() && GLCapture::capturedFrames() == captureFrames)
+        {
+            GLCapture::end();
+            cout << "Captured " << captureFrames << " frames of OpenGL calls to " << capturePath << endl;
+        }
 
         // Swap front and back buffers
-        glfwSwapBuffers(window);
+        if (GLCapture::backend == GLCapture::NATIVE_BACKEND)
+            glfwSwapBuffers(window);
 
         // Poll for and process events
+        inputRecorder.setFrame(frame);
         glfwPollEvents();
+        if (replaying)
+            replayInputEvents(window, frame);
+        // The recording logs the frame each id arrived on, its replay applies
+        // the id there. Older logs wait for the ids on the next frame.
+        GLuint pickedId;
+        int pickAction;
+        if (!(replaying && inputPlayer.logsPicks()) && picker.poll(replaying, pickedId, pickAction))
+            applyPick(pickedId, (PickAction) pickAction);
+
+        // the queries finish a few frames late
+        double gpuMs;
+        while (gpuFrameMs.size() < gpuFrameMs.capacity() && gpuTimer.result(gpuMs))
+            gpuFrameMs.push_back(gpuMs);
+
+        memoryStats.endFrame();
+        drawRing.stream.endFrame();
+        drawCommands.endFrame();
+        picker.endFrame();
+        if (memoryLogSeconds > 0 && elapsedMs(lastMemoryLog, ProfileClock::now()) >= memoryLogSeconds * 1000.0)
+        {
+            memoryStats.log(cout);
+            lastMemoryLog = ProfileClock::now();
+        }
+
+        if (measureFrames)
+        {
+            ProfileClock::time_point frameEnd = ProfileClock::now();
+            AllocTracker::Counters allocations = AllocTracker::frame();
+            if (frame >= stress.warmupFrames)
+            {
+                frameStats.record(elapsedMs(frameStart, frameEnd), submitMs, currentResidentMemory(), allocations.count(), allocations.bytes);
+                sceneGraphUpdatedNodes += sceneGraph.updatedNodes;
+                sceneGraphUpdatedMax = max(sceneGraphUpdatedMax, sceneGraph.updatedNodes);
+                drawCallsTotal += drawCalls;
+                drawCallsMax = max(drawCallsMax, drawCalls);
+            }
+            if (frame >= stress.warmupFrames && stress.enabled && stress.churn == 0 && allocations.count() > 0 && steadyStateAllocations++ == 0)
+                reportFrameAllocations(frame);
+            frameStart = frameEnd;
+        }
+        // the first merges and builds of the static batches allocate, they belong to the warmup
+        if (stress.enabled && staticBatcher.enabled && frame + 1 == stress.warmupFrames
+            && (frame <= staticBatcher.settleFrames || staticBatcher.building()))
+            stress.warmupFrames++;
+        frame++;
+        if (stress.enabled && frame == stress.warmupFrames + stress.frames)
+            glfwSetWindowShouldClose(window, GL_TRUE);
+        if (replaying && inputPlayer.finished())
+            glfwSetWindowShouldClose(window, GL_TRUE);
+    }
+
+    GLCapture::end();
+    if (inputRecorder.active())
+    {
+        cout << "Recorded " << inputRecorder.events << " input events to " << recordPath << endl;
+        inputRecorder.close();
+    }
+    int exitCode = 0;
+    if (measureFrames)
+    {
+        frameStats.print(stress.label);
+        if (gpuTimer.available)
+        {
+            glFinish();
+            double gpuMs;
+            while (gpuTimer.result(gpuMs))
+                gpuFrameMs.push_back(gpuMs);
+            cout << "  gpu    ms p50/p95/p99: " << FrameStats::percentile(gpuFrameMs, 50) << " / " << FrameStats::percentile(gpuFrameMs, 95)
+                 << " / " << FrameStats::percentile(gpuFrameMs, 99) << " (normal matrix " << (normalMatrixInShader ? "per vertex" : "per instance") << ")" << endl;
+            gpuTimer.free();
+        }
+        const StreamRing& stream = drawRing.stream;
+        cout << "  draw uniforms streamed per frame avg/max: " << (stream.frames == 0 ? 0 : stream.streamedTotal / stream.frames) << " / "
+             << stream.streamedPeakFrame << " B (" << (stream.mode == StreamRing::PERSISTENT ? "persistent" : "orphaning") << "), "
+             << stream.stalls << " stalls, " << stream.stallMs << " ms waited" << endl;
+        cout << "  draw calls per frame avg/max: " << (frameStats.frameMs.empty() ? 0 : drawCallsTotal / frameStats.frameMs.size())
+             << " / " << drawCallsMax << " (" << submitPathName(submitPath) << " submission, " << instanceCollection.size() << " instances)" << endl;
+        if (staticBatcher.enabled)
+            staticBatcher.log(cout);
+        if (picker.results > 0)
+            cout << "  picking: " << picker.passes << " id passes, " << (double) picker.latencyFrames / picker.results
+                 << " frames from click to id, " << picker.waits << " waits" << endl;
+        if (rendering == RenderType::WIRE_FRAME)
+        {
+            // a line loop over the triangle indices drew one segment per index,
+            // every shared edge twice and one spurious segment between triangles
+            size_t edgeSegments = 0;
+            size_t loopSegments = 0;
+            for (auto const& instance : instanceCollection)
+            {
+                edgeSegments += instance.object->edgeSize / 2;
+                loopSegments += instance.object->indexSize;
+            }
+            cout << "  wireframe segments per frame: " << edgeSegments << " edges instead of " << loopSegments << " with line loops ("
+                 << (loopSegments == 0 ? 0.0 : 100.0 * (1.0 - (double) edgeSegments / loopSegments)) << "% fewer)" << endl;
+        }
+        cout << "  scene graph nodes updated per frame avg/max: " << (frameStats.frameMs.empty() ? 0 : sceneGraphUpdatedNodes / frameStats.frameMs.size())
+             << " / " << sceneGraphUpdatedMax << " of " << sceneGraph.size() << endl;
+        frameStats.appendCSV(stress.csvPath, stress.label, instanceCollection.size());
+        logMemoryUsage();
+        cout << "Frame arena" << (frameArenaHeap ? " (off, on the heap)" : "") << ": peak " << max(frameArena.arenas[0].peak, frameArena.arenas[1].peak) << " B of "
+             << frameArena.arenas[0].capacity << " B, " << frameArena.arenas[0].overflows + frameArena.arenas[1].overflows << " overflows" << endl;
+    }
+    if (stress.enabled && steadyStateAllocations > 0)
+    {
+        // The scene is loaded during the warmup, after it frames must not allocate
+        cerr << "FAILED: " << steadyStateAllocations << " steady-state frames allocated memory" << endl;
+        exitCode = 1;
     }
 
     // Deallocate opengl memory
-    program.free();
+    shaders.free();
+    frameBlock.free();
+    drawRing.free();
+    drawCommands.free();
+    drawIndices.free();
+    staticBatcher.free();
+    picker.free();
     VAO.free();
     VBO.free();
     //CBO.free();
     IBO.free();
     NBO.free();
+    geometry.free();
+    frameArena.free();
 
     // Deallocate glfw internals
     glfwTerminate();
-    return 0;
+    return exitCode;
 }
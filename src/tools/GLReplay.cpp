@@ -0,0 +1,105 @@
+// Standalone replayer for OpenGL command streams captured with --capture-gl.
+// It recreates the objects of the capture, then re-issues one frame many
+// times and reports how many calls per second the driver accepts.
+//
+// Usage: SceneEditor3D_replay capture.glc [--frame K] [--repeat N]
+
+#include "Helpers.h"
+#include "GLCapture.h"
+#include "Profiling.h"
+
+#include <GLFW/glfw3.h>
+
+#include <iostream>
+#include <string>
+#include <cstdlib>
+using namespace std;
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        cerr << "Usage: " << argv[0] << " capture.glc [--frame K] [--repeat N]" << endl;
+        return -1;
+    }
+    string path = argv[1];
+    int frame = -1;
+    unsigned int repeat = 1000;
+    for (int i = 2; i + 1 < argc; i += 2)
+    {
+        string arg = argv[i];
+        if (arg == "--frame")
+            frame = stoi(argv[i + 1]);
+        else if (arg == "--repeat")
+            repeat = stoi(argv[i + 1]);
+    }
+
+    GLCapture::CaptureFile capture;
+    if (!capture.load(path))
+        return -1;
+    if (capture.frames() == 0)
+    {
+        cerr << "The capture does not contain a complete frame" << endl;
+        return -1;
+    }
+    if (frame < 0 || frame >= (int) capture.frames())
+        frame = capture.frames() - 1;
+
+    if (!glfwInit())
+        return -1;
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
+#ifdef __APPLE__
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+#endif
+    glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+    GLFWwindow *window = glfwCreateWindow(640, 480, "GLReplay", NULL, NULL);
+    if (!window)
+    {
+        glfwTerminate();
+        return -1;
+    }
+    glfwMakeContextCurrent(window);
+#ifndef __APPLE__
+    glewExperimental = true;
+    if (glewInit() != GLEW_OK)
+    {
+        cerr << "glewInit failed" << endl;
+        return -1;
+    }
+    glGetError();
+#endif
+    cout << "Renderer: " << (const char *) glGetString(GL_RENDERER) << endl;
+
+    size_t first, last;
+    capture.frameRange(frame, first, last);
+
+    // Everything before the frame only rebuilds the state it starts from
+    capture.execute(0, first);
+    vector<GLCapture::Call> calls = capture.resolve(first, last);
+    glFinish();
+
+    ProfileClock::time_point start = ProfileClock::now();
+    for (unsigned int i = 0; i < repeat; i++)
+        capture.issue(calls);
+    double submitMs = elapsedMs(start, ProfileClock::now());
+    glFinish();
+    double totalMs = elapsedMs(start, ProfileClock::now());
+
+    size_t draws = 0;
+    for (size_t i = 0; i < calls.size(); i++)
+        if (calls[i].op == GLCapture::OP_DRAW_ELEMENTS || calls[i].op == GLCapture::OP_DRAW_ELEMENTS_BASE_VERTEX
+            || calls[i].op == GLCapture::OP_DRAW_ELEMENTS_INSTANCED_BASE_VERTEX || calls[i].op == GLCapture::OP_MULTI_DRAW_ELEMENTS_INDIRECT)
+            draws++;
+
+    double issued = (double) calls.size() * repeat;
+    cout << "Frame " << frame << " of " << capture.frames() << ": " << calls.size() << " calls, " << draws << " draws" << endl;
+    cout << "Replayed " << repeat << " times in " << totalMs << " ms (" << submitMs << " ms submitting)" << endl;
+    cout << "Calls per second: " << issued / (totalMs / 1000.0) << " (submit only: " << issued / (submitMs / 1000.0) << ")" << endl;
+    cout << "Frames per second: " << repeat / (totalMs / 1000.0) << endl;
+
+    capture.free();
+    glfwTerminate();
+    return 0;
+}
@@ -0,0 +1,39 @@
+// Headless check of the transform and triangle kernels of every supported
+// instruction set, against Eigen and the scalar kernels, and on edge cases
+// with known results. No window or GL context is needed, ctest runs it.
+//
+// Usage: SceneEditor3D_kernel_tests [count]
+
+#include "TransformKernels.h"
+#include "TriangleKernels.h"
+
+#include <iostream>
+#include <string>
+using namespace std;
+
+int main(int argc, char *argv[])
+{
+    size_t count = 10000;
+    if (argc > 1)
+    {
+        size_t end = 0;
+        try
+        {
+            count = stoul(argv[1], &end);
+        }
+        catch (const exception &)
+        {
+            end = 0;
+        }
+        if (end == 0 || argv[1][end] != '\0' || count == 0)
+        {
+            cerr << "Usage: " << argv[0] << " [count], count a positive number" << endl;
+            return -1;
+        }
+    }
+
+    bool transforms = TransformKernels::check(count);
+    bool triangles = TriangleKernels::check(count);
+    cout << (transforms && triangles ? "All kernels agree" : "Some kernels disagree") << endl;
+    return transforms && triangles ? 0 : 1;
+}